@@ -0,0 +1,234 @@
+/* coup_bench.cxx */
+// Measures coup's own overhead on generated projects
+// The compiler of every generated project is coup-fake-cxx, so builds cost
+// what coup adds to the compiles; results are written as JSON unless
+// another --benchmark_format is given
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_json.hxx"
+#include "../include/coup_project.hxx"
+#include "synthetic_project.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+namespace
+{
+// generated projects by their number of sources, kept for the whole run
+const fs::path &project_root(int num_sources)
+{
+	static std::map<int, fs::path> roots;
+	auto it = roots.find(num_sources);
+	if (it != roots.end())
+	{
+		return it->second;
+	}
+	synthetic_project project;
+	project.num_sources = num_sources;
+	project.num_headers = std::max(num_sources / 10, 1);
+	project.compiler = FAKE_COMPILER;
+	fs::path root = fs::temp_directory_path() / "coup_bench" /
+					("project-" + std::to_string(num_sources));
+	generate_project(root, project);
+	return roots.emplace(num_sources, root).first->second;
+}
+
+// the build directory and every .coup* file in the project root
+void remove_build_state(const fs::path &root)
+{
+	fs::remove_all(root / "build");
+	for (const fs::directory_entry &entry : fs::directory_iterator(root))
+	{
+		if (entry.path().filename().string().rfind(".coup", 0) == 0)
+			fs::remove(entry.path());
+	}
+}
+
+// Runs in a project root with stdout sent to /dev/null, so the build
+// progress does not mix with the results
+class quiet_project
+{
+private:
+	fs::path previous_directory;
+	int saved_stdout;
+
+public:
+	explicit quiet_project(const fs::path &root)
+		: previous_directory(fs::current_path())
+	{
+		fs::current_path(root);
+		std::cout.flush();
+		std::fflush(stdout);
+		saved_stdout = dup(STDOUT_FILENO);
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, STDOUT_FILENO);
+		close(null_fd);
+	}
+
+	~quiet_project()
+	{
+		std::cout.flush();
+		std::fflush(stdout);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+		fs::current_path(previous_directory);
+	}
+
+	quiet_project(const quiet_project &) = delete;
+	quiet_project &operator=(const quiet_project &) = delete;
+};
+
+std::optional<std::string> build_project()
+{
+	coup_project project = coup_project::make_project();
+	return project.execute_build(false, false);
+}
+
+void find_sources(benchmark::State &state)
+{
+	fs::path source_directory =
+		project_root(static_cast<int>(state.range(0))) / "src";
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(find_src_files(source_directory));
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void parse_depfile(benchmark::State &state)
+{
+	std::vector<std::string> headers;
+	for (int i = 0; i < state.range(0); ++i)
+		headers.push_back("include/d" + std::to_string(i % 16) + "/h" +
+						  std::to_string(i) + ".hxx");
+	fs::path dep_file = fs::temp_directory_path() / "coup_bench.d";
+	std::ofstream(dep_file) << make_depfile("build/u.o", "src/u.cxx", headers);
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(parse_dependency_file(dep_file));
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	fs::remove(dep_file);
+}
+
+// state.range(0) is 0 to parse coup_config.json every time, 1 to load
+// the snapshot of the previous load
+void load_config(benchmark::State &state)
+{
+	fs::path root = project_root(1000);
+	fs::path snapshot_file = root / "build" / "coup_bench.cache";
+	fs::remove(snapshot_file);
+	for (auto _ : state)
+	{
+		if (state.range(0) == 0)
+		{
+			state.PauseTiming();
+			fs::remove(snapshot_file);
+			state.ResumeTiming();
+		}
+		benchmark::DoNotOptimize(
+			coup_json::load(root / "coup_config.json", "coup_bench.cache"));
+	}
+	fs::remove(snapshot_file);
+}
+
+// every source compiled by the fake compiler: what coup costs around the
+// compiles, mostly scheduling and process creation
+void clean_build(benchmark::State &state)
+{
+	fs::path root = project_root(static_cast<int>(state.range(0)));
+	quiet_project quiet(root);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		remove_build_state(root);
+		state.ResumeTiming();
+		std::optional<std::string> error = build_project();
+		if (error.has_value())
+		{
+			state.SkipWithError(error->c_str());
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// nothing changed since the last build
+void noop_build(benchmark::State &state)
+{
+	fs::path root = project_root(static_cast<int>(state.range(0)));
+	quiet_project quiet(root);
+	remove_build_state(root);
+	if (std::optional<std::string> error = build_project())
+	{
+		state.SkipWithError(error->c_str());
+		return;
+	}
+	for (auto _ : state)
+	{
+		std::optional<std::string> error = build_project();
+		if (error.has_value())
+		{
+			state.SkipWithError(error->c_str());
+			break;
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+} // namespace
+
+BENCHMARK(find_sources)
+	->Arg(1000)
+	->Arg(10000)
+	->Arg(100000)
+	->Unit(benchmark::kMillisecond);
+BENCHMARK(parse_depfile)->Arg(100)->Arg(1000)->Arg(10000);
+BENCHMARK(load_config)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+BENCHMARK(clean_build)
+	->Arg(1000)
+	->Arg(10000)
+	->Arg(100000)
+	->Unit(benchmark::kMillisecond)
+	->UseRealTime();
+BENCHMARK(noop_build)
+	->Arg(1000)
+	->Arg(10000)
+	->Arg(100000)
+	->Unit(benchmark::kMillisecond)
+	->UseRealTime();
+
+int main(int argc, char *argv[])
+{
+	std::vector<char *> arguments(argv, argv + argc);
+	std::string json_format = "--benchmark_format=json";
+	bool has_format = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::string(argv[i]).rfind("--benchmark_format", 0) == 0)
+			has_format = true;
+	}
+	if (!has_format)
+	{
+		arguments.push_back(json_format.data());
+	}
+	int num_arguments = static_cast<int>(arguments.size());
+	benchmark::Initialize(&num_arguments, arguments.data());
+	if (benchmark::ReportUnrecognizedArguments(num_arguments,
+											   arguments.data()))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
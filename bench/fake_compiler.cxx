@@ -0,0 +1,99 @@
+/* fake_compiler.cxx */
+// Stands in for the compiler when measuring coup itself: takes the
+// arguments coup passes to g++, writes the depfile a real compile would
+// from the quoted includes it finds, and an empty object or executable
+// A compile takes COUP_FAKE_COMPILE_MS milliseconds when that is set
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "synthetic_project.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+namespace
+{
+// header named by #include "..." from file, searched next to file first
+fs::path find_header(const std::string &name, const fs::path &file,
+					 const std::vector<fs::path> &include_directories)
+{
+	fs::path local = file.parent_path() / name;
+	if (fs::exists(local))
+	{
+		return local;
+	}
+	for (const fs::path &directory : include_directories)
+	{
+		if (fs::exists(directory / name))
+			return directory / name;
+	}
+	return {};
+}
+
+void find_includes(const fs::path &file,
+				   const std::vector<fs::path> &include_directories,
+				   std::set<std::string> &seen,
+				   std::vector<std::string> &headers)
+{
+	std::ifstream input(file);
+	std::string line;
+	while (std::getline(input, line))
+	{
+		if (line.rfind("#include \"", 0) != 0)
+			continue;
+		std::size_t end = line.find('"', 10);
+		if (end == std::string::npos)
+			continue;
+		fs::path header =
+			find_header(line.substr(10, end - 10), file, include_directories);
+		if (header.empty() || !seen.insert(header.string()).second)
+			continue;
+		headers.push_back(header.string());
+		find_includes(header, include_directories, seen, headers);
+	}
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std::string source, output, dep_file;
+	std::vector<fs::path> include_directories;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			source = argv[++i];
+		else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			output = argv[++i];
+		else if (std::strcmp(argv[i], "-MF") == 0 && i + 1 < argc)
+			dep_file = argv[++i];
+		else if (std::strncmp(argv[i], "-I", 2) == 0)
+			include_directories.emplace_back(argv[i] + 2);
+	}
+	if (output.empty())
+	{
+		return 1;
+	}
+
+	if (!source.empty())
+	{
+		if (!fs::exists(source))
+			return 1;
+		std::set<std::string> seen;
+		std::vector<std::string> headers;
+		find_includes(source, include_directories, seen, headers);
+		if (!dep_file.empty())
+			std::ofstream(dep_file) << make_depfile(output, source, headers);
+		if (const char *compile_ms = std::getenv("COUP_FAKE_COMPILE_MS"))
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(std::atoi(compile_ms)));
+	}
+	std::ofstream object(output, std::ios::binary | std::ios::trunc);
+	return object ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+/* synthetic_project.cxx */
+#include "synthetic_project.hxx"
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// headers per include chain
+#define HEADER_CHAIN 4
+// subdirectories per directory level
+#define DIRECTORY_FANOUT 16
+
+namespace fs = std::filesystem;
+namespace coup
+{
+namespace
+{
+void write_text(const fs::path &file, const std::string &text)
+{
+	std::ofstream output(file, std::ios::binary | std::ios::trunc);
+	output << text;
+	if (!output)
+	{
+		throw std::runtime_error("Failed to write " + file.string());
+	}
+}
+
+std::string header_name(int i)
+{
+	return "h" + std::to_string(i) + ".hxx";
+}
+} // namespace
+
+fs::path synthetic_source(const synthetic_project &project, int i)
+{
+	fs::path source = "src";
+	int rest = i;
+	for (int level = 0; level < project.directory_depth; ++level)
+	{
+		source /= "d" + std::to_string(rest % DIRECTORY_FANOUT);
+		rest /= DIRECTORY_FANOUT;
+	}
+	return source / ("u" + std::to_string(i) + ".cxx");
+}
+
+void generate_project(const fs::path &root, const synthetic_project &project)
+{
+	fs::remove_all(root);
+	fs::create_directories(root / "include");
+	fs::create_directories(root / "src");
+
+	for (int i = 0; i < project.num_headers; ++i)
+	{
+		std::string text = "#pragma once\n";
+		if ((i + 1) % HEADER_CHAIN != 0 && i + 1 < project.num_headers)
+			text += "#include \"" + header_name(i + 1) + "\"\n";
+		text += "inline int h" + std::to_string(i) + "() { return " +
+				std::to_string(i) + "; }\n";
+		write_text(root / "include" / header_name(i), text);
+	}
+
+	for (int i = 0; i < project.num_sources; ++i)
+	{
+		std::string text;
+		for (int k = 0; k < project.include_fanout && project.num_headers > 0;
+			 ++k)
+		{
+			int header = (i * 7 + k * 13) % project.num_headers;
+			text += "#include \"" + header_name(header) + "\"\n";
+		}
+		text += "int u" + std::to_string(i) + "() { return " +
+				std::to_string(i) + "; }\n";
+		fs::path source = root / synthetic_source(project, i);
+		fs::create_directories(source.parent_path());
+		write_text(source, text);
+	}
+	write_text(root / "src" / "main.cxx", "int main() { return 0; }\n");
+
+	write_text(root / "coup_config.json",
+			   "{\n"
+			   "\t\"cpp\": \"c++20\",\n"
+			   "\t\"compiler\": \"" +
+				   project.compiler +
+				   "\",\n"
+				   "\t\"source\": [\"src\"],\n"
+				   "\t\"include\": [\"include\"],\n"
+				   "\t\"build\": \"build\",\n"
+				   "\t\"executable\": \"app\"\n"
+				   "}\n");
+}
+
+std::string make_depfile(const std::string &object, const std::string &source,
+						 const std::vector<std::string> &headers)
+{
+	std::string depfile = object + ": " + source;
+	for (const std::string &header : headers)
+	{
+		depfile += " \\\n " + header;
+	}
+	return depfile + "\n";
+}
+} // namespace coup
@@ -0,0 +1,35 @@
+/* synthetic_project.hxx */
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// Shape of a generated project
+// Headers include the next header in chains of HEADER_CHAIN, so every
+// include a source makes pulls in a few more headers
+struct synthetic_project
+{
+	int num_sources = 1000;
+	int num_headers = 100;
+	// headers every source includes directly
+	int include_fanout = 8;
+	// directories each source is nested in below src/
+	int directory_depth = 2;
+	std::string compiler = "g++";
+};
+
+// Writes the sources, headers and coup_config.json of a project into
+// root, replacing what was there
+void generate_project(const fs::path &root, const synthetic_project &project);
+
+// relative path of the i-th source of a project
+fs::path synthetic_source(const synthetic_project &project, int i);
+
+// depfile as gcc -MMD writes it
+std::string make_depfile(const std::string &object, const std::string &source,
+						 const std::vector<std::string> &headers);
+} // namespace coup
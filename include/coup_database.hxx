@@ -0,0 +1,151 @@
+/* coup_database.hxx */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "coup_hash.hxx"
+#include "coup_path_table.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// What coup remembers about the last successful compile of a source file
+struct build_record
+{
+	std::string source;
+	std::string object;
+
+	// hash of the full compile command (compiler, standard, flags,
+	// defines, include paths)
+	hash_t command_hash = 0;
+
+	// combined content hash of the source and every dependency
+	hash_t input_hash = 0;
+
+	// headers listed in the depfile, without the source itself
+	std::vector<std::string> dependencies;
+
+	// wall time of the compile in seconds
+	double compile_time = 0.0;
+};
+
+// A build_record as the database holds it, for lookups that should not
+// copy every path: dependencies are path ids, see
+// build_database::get_path
+// Valid until the database is next changed
+struct build_record_view
+{
+	std::string_view object;
+	hash_t command_hash = 0;
+	hash_t input_hash = 0;
+	std::span<const path_id> dependencies;
+	double compile_time = 0.0;
+};
+
+// Flags an external library was resolved to, and what they were resolved
+// from, so they are only resolved again after one of those changes
+struct package_record
+{
+	// hash of the declaration and of the pkg-config environment
+	hash_t key = 0;
+
+	// .pc files read, or looked for, with their mtime in nanoseconds
+	// (0 if the file did not exist)
+	std::vector<std::pair<std::string, std::int64_t>> files;
+
+	std::vector<std::string> compile_flags;
+	std::vector<std::string> link_flags;
+};
+
+// Per build directory record of how each object was produced, used to
+// decide which objects are still up to date
+// Also indexes which sources depend on each header, so the cost of
+// changing a header is known without reading any depfile
+// Every path is interned once; records and the reverse index only hold
+// path ids
+class build_database
+{
+private:
+	// a build_record with its paths interned
+	struct node
+	{
+		bool built = false;
+		// the last compile of the source failed, it then has no record
+		bool failed = false;
+		path_id object = 0;
+		hash_t command_hash = 0;
+		hash_t input_hash = 0;
+		double compile_time = 0.0;
+		std::vector<path_id> dependencies;
+	};
+
+	path_table paths;
+
+	// id of the lexically normal spelling of every path, so
+	// "src/../include/a.hxx" and "include/a.hxx" are the same header
+	std::vector<path_id> normal_ids;
+
+	// indexed by the id of the source
+	std::vector<node> nodes;
+
+	std::size_t num_records = 0;
+
+	// normal header id -> sources whose depfile lists it, built from the
+	// records when first asked for after a change
+	mutable path_graph dependents;
+	mutable bool dependents_valid = false;
+
+	// hash of the link command that produced each linked target
+	std::unordered_map<std::string, hash_t> link_hashes;
+
+	// external library name -> flags it was last resolved to
+	std::unordered_map<std::string, package_record> packages;
+
+public:
+	bool load(const fs::path &db_file);
+
+	bool save(const fs::path &db_file) const;
+
+	std::optional<build_record> find(const std::string &source) const;
+
+	std::optional<build_record_view> view(std::string_view source) const;
+
+	const char *get_path(path_id id) const;
+
+	void update(build_record record);
+
+	void erase(const std::string &source);
+
+	void mark_failed(const std::string &source);
+
+	bool has_failed(const std::string &source) const;
+
+	std::vector<std::string> get_sources() const;
+
+	std::size_t size() const noexcept;
+
+	std::vector<std::string> get_dependents(const std::string &header) const;
+
+	hash_t get_link_hash(const std::string &target) const;
+
+	void set_link_hash(const std::string &target, hash_t hash);
+
+	const package_record *find_package(const std::string &name) const;
+
+	void set_package(const std::string &name, package_record record);
+
+private:
+	path_id intern(std::string_view path);
+
+	void clear();
+};
+} // namespace coup
@@ -0,0 +1,97 @@
+/* coup_distributed.hxx */
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "coup_net.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// Compiles are distributed to coup-worker processes over HTTP/1.1, on TCP
+// or unix sockets:
+//      GET /status         200, body: "slots <n>"
+//      POST /compile       body: fields (see encode_fields) holding the
+//                          compiler arguments without input and output,
+//                          then the preprocessed translation unit
+//                          200, body: fields holding the exit code, the
+//                          compile time in seconds, the compiler output
+//                          and the object file
+// Sources are preprocessed locally, so workers need nothing but the
+// compiler; linking stays local as well
+
+// what a worker sent back for one translation unit
+struct remote_compile
+{
+	int exit_code = -1;
+	double seconds = 0.0;
+	std::string output;
+	std::string object;
+};
+
+// One worker as seen from coup
+// Its overhead, how much longer a compile takes through it than the
+// compile itself (preprocessing, transfer, waiting for a slot), starts at
+// the round trip of the status request and follows every compile
+class remote_worker
+{
+private:
+	std::string address;
+	http_url url;
+	int slots = 0;
+
+	mutable std::mutex overhead_mtx;
+	double overhead = 0.0;
+
+public:
+	remote_worker(std::string address_, http_url url_);
+
+	bool connect();
+
+	const std::string &get_address() const noexcept;
+
+	int get_slots() const noexcept;
+
+	double get_overhead() const;
+
+	void add_overhead(double seconds);
+
+	std::optional<remote_compile>
+	compile(const std::vector<std::string> &arguments,
+			const std::string &preprocessed);
+};
+
+// The server side, runs up to slots compiles at once in a scratch
+// directory; further requests wait for a free slot
+// Only compiles of preprocessed input by a known compiler driver (gcc,
+// g++, cc, c++, clang, clang++, optionally versioned, e.g. g++-13) with
+// flags from an allowlist are accepted, see is_worker_compile
+class compile_worker : public http_server
+{
+private:
+	int slots;
+	fs::path scratch_directory;
+
+	std::mutex slots_mtx;
+	std::condition_variable slots_cv;
+	int busy = 0;
+	unsigned long next_job = 0;
+
+	http_response compile(const std::vector<std::string> &fields);
+
+protected:
+	http_response handle_request(const http_message &request) override;
+
+public:
+	compile_worker(int slots_, fs::path scratch_directory_);
+};
+
+bool is_compiler_driver(const std::string &program);
+
+bool is_worker_compile(const std::vector<std::string> &arguments);
+} // namespace coup
@@ -0,0 +1,49 @@
+/* coup_events.hxx */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace coup
+{
+// Machine readable log of a command, one JSON object per line:
+//      {"event":"job_finished","time":1.25,"source":"src/a.cxx",...}
+// time is in seconds since the stream was opened
+// emit() only appends to a buffer; a writer thread hands the buffer to
+// the destination in large writes, so compiles never wait on its I/O
+// Does nothing until opened
+class event_stream
+{
+private:
+	int fd = -1;
+	std::chrono::steady_clock::time_point start;
+
+	std::mutex buffer_mtx;
+	std::condition_variable buffer_cv;
+	std::string buffer;
+	bool closing = false;
+	std::thread writer_thread;
+
+	void write_loop();
+
+public:
+	event_stream() = default;
+	~event_stream();
+
+	event_stream(const event_stream &) = delete;
+	event_stream &operator=(const event_stream &) = delete;
+
+	bool open(const std::string &destination);
+
+	void close();
+
+	bool is_open() const noexcept;
+
+	void emit(std::string_view type, nlohmann::json fields);
+};
+} // namespace coup
@@ -74,9 +74,20 @@ std::vector<fs::path> get_obj_files(const fs::path &root);
 // file creation
 fs::path make_dep_file(const fs::path &src_file);
 fs::path make_obj_file(const fs::path &src_file);
+fs::path make_output_file(const fs::path &src_file, const fs::path &out_dir,
+						  const std::string &ext);
+fs::path get_output_source(const fs::path &output_file,
+						   const fs::path &out_dir);
+bool make_parent_directories(const std::vector<fs::path> &files);
+bool write_file_if_changed(const fs::path &file, const std::string &contents);
 
 // file parsing
 std::string file_to_string(const fs::path &file);
+std::string file_contents(const fs::path &file);
 std::vector<std::string> parse_dependency_file(const fs::path &dep_file);
+std::vector<std::string> parse_include_directives(const fs::path &file);
+std::vector<std::string>
+find_include_chain(const std::string &source, const std::string &header,
+				   const std::vector<std::string> &dependencies);
 
 } // namespace coup
@@ -0,0 +1,94 @@
+/* coup_hash.hxx */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+namespace coup
+{
+using hash_t = std::uint64_t;
+
+// content hashing (XXH64)
+hash_t hash_bytes(const void *data, std::size_t size, hash_t seed = 0);
+hash_t hash_string(std::string_view s, hash_t seed = 0);
+hash_t hash_strings(const std::vector<std::string> &strings, hash_t seed = 0);
+hash_t hash_combine(hash_t seed, hash_t value);
+std::string hash_to_string(hash_t hash);
+std::optional<hash_t> hash_file_contents(const fs::path &file);
+
+// identity of a file on disk, used to decide if its contents must be re-read
+struct file_stamp
+{
+	std::uint64_t device = 0;
+	std::uint64_t inode = 0;
+	std::int64_t mtime_ns = 0;
+	std::uint64_t size = 0;
+
+	bool operator==(const file_stamp &other) const = default;
+};
+
+std::optional<file_stamp> get_file_stamp(const fs::path &file);
+std::optional<file_stamp> get_file_stamp(const char *file);
+
+// true if the file was modified so recently that a second write could still
+// leave its stamp unchanged, the stamp then does not identify the contents
+bool is_racy(const file_stamp &stamp);
+
+// Memoizes file content hashes per (device, inode, mtime, size)
+// A file is only read again when one of those changes, so touching a file
+// without editing it costs one stat and a re-hash, and leaves the hash as is
+// The cache can be persisted between runs with load() and save()
+class hash_cache
+{
+private:
+	struct entry
+	{
+		file_stamp stamp;
+		hash_t hash = 0;
+		bool used = false;
+	};
+
+	struct inode_key
+	{
+		std::uint64_t device;
+		std::uint64_t inode;
+
+		bool operator==(const inode_key &other) const = default;
+	};
+
+	struct inode_key_hash
+	{
+		std::size_t operator()(const inode_key &k) const noexcept
+		{
+			return static_cast<std::size_t>(hash_combine(k.device, k.inode));
+		}
+	};
+
+	std::unordered_map<inode_key, entry, inode_key_hash> entries;
+	mutable std::mutex entries_mtx;
+
+public:
+	hash_cache() = default;
+
+	std::optional<hash_t> hash_file(const fs::path &file);
+
+	std::optional<hash_t> hash_file(const char *file);
+
+	std::vector<std::optional<hash_t>>
+	hash_files(const std::vector<fs::path> &files);
+
+	bool load(const fs::path &cache_file);
+
+	bool save(const fs::path &cache_file) const;
+
+	std::size_t size() const;
+};
+} // namespace coup
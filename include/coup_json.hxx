@@ -1,57 +1,172 @@
 /* coup_json.hxx */
+#pragma once
+
+#include <cstdint>
 #include <filesystem>
-#include <nlohmann/json.hpp>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace fs = std::filesystem;
 namespace coup
 {
+// Everything that goes into the compile command of one source file
+// Produced by coup_json::get_compile_options after applying any
+// per-directory or per-file overrides from coup_config.json
+struct compile_options
+{
+	std::string compiler;
+	std::string cpp_standard;
+	std::vector<std::string> flags;
+	std::vector<std::string> defines;
+	std::vector<std::string> include_directories;
+};
+
+// Named set of flags selected with --profile, each profile builds into
+// its own subdirectory of the build directory
+struct build_profile
+{
+	std::string name;
+	std::vector<std::string> compile_flags;
+	std::vector<std::string> defines;
+	std::vector<std::string> link_flags;
+};
+
+// Test executable declared in the "tests" array of coup_config.json
+// Links the objects of its own source directories with every project
+// object except those of the excluded sources (e.g. the one with main)
+struct test_target
+{
+	std::string name;
+	std::vector<std::string> source_directories;
+	std::vector<std::string> link_flags;
+	std::vector<std::string> exclude;
+};
+
+// External library from the "dependencies" object of coup_config.json,
+// looked up with pkg-config by its name, or found below prefix
+struct package_dependency
+{
+	std::string name;
+	std::string prefix;
+	// libraries linked from prefix/lib when it has no .pc file for name,
+	// just name if empty
+	std::vector<std::string> libs;
+};
+
+// settings of one entry of "overrides", applied to the sources at or
+// below prefix
+struct config_override
+{
+	fs::path prefix;
+	std::vector<std::string> compile_flags;
+	std::vector<std::string> defines;
+	std::vector<std::string> include_directories;
+};
+
+// coup_config.json after validation, with the defaults of every optional
+// field filled in
+// Built once per command (see coup_json::load) and never changed after
+struct project_config
+{
+	// top-level fields present in coup_config.json
+	std::vector<std::string> fields;
+
+	std::string cpp_version;
+	std::string compiler;
+	std::string executable;
+	std::vector<std::string> source_directories;
+	std::string build_directory;
+	std::vector<std::string> compile_flags;
+	std::vector<std::string> defines;
+	std::vector<std::string> include_directories;
+	std::vector<std::string> link_flags;
+	std::string default_profile;
+	std::string remote_cache;
+	std::vector<std::string> workers;
+	bool modules = false;
+	std::string staging;
+	// profiles declared in coup_config.json, sorted by name
+	std::vector<build_profile> profiles;
+	std::vector<test_target> test_targets;
+	// sorted by key
+	std::vector<config_override> overrides;
+	// sorted by name
+	std::vector<package_dependency> dependencies;
+};
+
+project_config parse_project_config(const std::string &contents);
+
+// Read access to the project configuration in coup_config.json
+// Copies share the same parsed configuration
 class coup_json
 {
 private:
-	nlohmann::json config;
-	
-    // Helper function for getting retrieving the value
-	// associated with a certain field in coup_config.json
-	// If the field is defined, return the associated value
-	// or else return a fallback default value
-	template <typename T>
-	T get_entry_or(const char *k, T fallback) const noexcept
-	{
-		if (config.contains(k))
-			return config[k];
-		else
-			return fallback;
-	}
-
-	bool meets_required() const noexcept;
-
-	[[noreturn]] void config_error(const char *e);
+	std::shared_ptr<const project_config> config;
+	std::uint64_t content_hash = 0;
+
+	coup_json(project_config config_, std::uint64_t content_hash_);
 
 public:
 	coup_json();
-    ~coup_json();
-    coup_json(const fs::path& config_file);
-    coup_json(const coup_json& other);
-    coup_json(coup_json&& other) noexcept;
-    coup_json& operator=(const coup_json& other);
-    coup_json& operator=(coup_json&& other) noexcept;
+	~coup_json();
+	coup_json(const fs::path &config_file);
+	coup_json(const coup_json &other);
+	coup_json(coup_json &&other) noexcept;
+	coup_json &operator=(const coup_json &other);
+	coup_json &operator=(coup_json &&other) noexcept;
+
+	static coup_json load(const fs::path &config_file,
+						  const std::string &snapshot_name);
+
+	std::uint64_t get_content_hash() const noexcept;
+
+	const std::string &get_cpp_version() const noexcept;
+
+	const std::string &get_compiler() const noexcept;
+
+	const std::string &get_executable() const noexcept;
+
+	const std::vector<std::string> &get_source_directories() const noexcept;
+
+	const std::string &get_build_directory() const noexcept;
+
+	const std::vector<std::string> &get_compile_flags() const noexcept;
+
+	const std::vector<std::string> &get_defines() const noexcept;
+
+	const std::vector<std::string> &get_include_directories() const noexcept;
+
+	const std::vector<std::string> &get_link_flags() const noexcept;
+
+	std::vector<std::string>
+	get_link_flags(const build_profile &profile) const noexcept;
+
+	const std::string &get_default_profile() const noexcept;
+
+	const std::string &get_remote_cache() const noexcept;
+
+	const std::vector<std::string> &get_workers() const noexcept;
+
+	bool get_modules() const noexcept;
+
+	const std::string &get_staging() const noexcept;
 
-	std::string get_cpp_version() const noexcept;
+	build_profile get_profile(const std::string &name) const;
 
-	std::string get_compiler() const noexcept;
+	std::vector<std::string> get_profile_names() const;
 
-	std::string get_executable() const noexcept;
+	const std::vector<test_target> &get_test_targets() const noexcept;
 
-	std::vector<std::string> get_source_directories() const noexcept;
+	const std::vector<package_dependency> &get_dependencies() const noexcept;
 
-	std::string get_build_directory() const noexcept;
+	compile_options get_compile_options(const fs::path &source_file) const;
 
-	std::vector<std::string> get_compile_flags() const noexcept;
+	compile_options get_compile_options(const fs::path &source_file,
+										const build_profile &profile) const;
 
 	std::string dump(int tab_width) const noexcept;
 
-    bool contains(const char *key) const noexcept;
+	bool contains(const char *key) const noexcept;
 };
 } // namespace coup
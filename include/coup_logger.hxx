@@ -1,7 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <vector>
+
+#include "coup_stats.hxx"
+#include "coup_time_report.hxx"
 
 namespace coup
 {
@@ -15,8 +25,80 @@ void print_compile(std::string_view src_name, std::string_view compile_command,
 void print_link(const std::string &exec_name, std::string_view link_command,
 				bool verbose_output);
 
-void print_remove(std::string_view file_name, std::string_view rm_command,
-				  int log_count, int log_total, bool verbose_output);
+void print_remove(std::string_view file_name, int log_count, int log_total,
+				  bool verbose_output);
+
+void print_test(std::string_view test_name, bool passed, double runtime,
+				bool cached, bool verbose_output);
+
+void print_process_output(std::string_view output);
+
+void print_test_summary(int passed, int failed, int cached, int skipped);
+
+void print_affected(std::string_view source_name, double compile_time);
+
+void print_affected_summary(int count, double compile_time,
+							double estimated_time, unsigned int num_jobs);
+
+void print_include_chain(const std::vector<std::string> &chain);
+
+void print_time_entries(std::string_view title,
+						const std::vector<time_entry> &entries);
+
+void print_build_metrics(const build_metrics &metrics);
+
+void print_regressions(const std::vector<regression> &regressions);
+
+void print_generated(std::string_view file_name, bool written);
+
+void print_remote_fetch(int fetched, int looked_up);
+
+void print_workers(int slots, int reachable, int configured);
+
+// Reports the compiles of one build
+// On a terminal without verbose output a single status line shows the
+// running jobs, the work done weighted by expected compile time, the
+// throughput and an ETA, redrawn at a fixed rate by its own thread
+// Otherwise every compile prints a line as it starts
+// Compiler output and errors go through it so they never interleave with
+// the status line
+class build_progress
+{
+private:
+	bool interactive;
+	bool verbose_output;
+	int total;
+	double total_cost;
+	std::chrono::steady_clock::time_point start;
+
+	std::atomic<int> started = 0;
+	std::atomic<int> running = 0;
+	std::atomic<int> completed = 0;
+	// expected cost of the completed compiles, in microseconds
+	std::atomic<std::uint64_t> completed_cost_us = 0;
+
+	std::mutex output_mtx;
+	std::condition_variable stop_cv;
+	bool stopping = false;
+	bool status_shown = false;
+	std::thread redraw_thread;
+
+	void redraw_loop();
+	void draw_status();
+	void clear_status();
+
+public:
+	build_progress(int total_, double total_cost_, bool verbose_output_);
+	~build_progress();
+
+	build_progress(const build_progress &) = delete;
+	build_progress &operator=(const build_progress &) = delete;
+
+	void start_job(std::string_view src_name, std::string_view compile_command);
+	void finish_job(double expected_cost);
+	void print_output(std::string_view output);
+	void print_error(const std::string &error_message);
+};
 
 void print_result_success(std::string_view command, double runtime);
 
@@ -35,4 +117,16 @@ void print_clean_success(double runtime);
 
 void print_clean_failure(const std::string &error_message);
 
+void print_test_success(double runtime);
+
+void print_test_failure(const std::string &error_message);
+
+void print_query_success(double runtime);
+
+void print_query_failure(const std::string &error_message);
+
+void print_generate_success(double runtime);
+
+void print_generate_failure(const std::string &error_message);
+
 } // namespace coup
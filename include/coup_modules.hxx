@@ -0,0 +1,111 @@
+/* coup_modules.hxx */
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "coup_hash.hxx"
+#include "coup_json.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// The C++20 modules one translation unit provides and imports, as a P1689
+// scan reports them
+// A module interface unit or partition provides one logical name, "m" or
+// "m:part"; an implementation unit of m imports m
+// Header units are listed apart, coup does not build them
+struct module_scan
+{
+	std::string provides;
+	std::vector<std::string> imports;
+	std::vector<std::string> header_units;
+
+	bool uses_modules() const noexcept;
+};
+
+// how the modules of a translation unit are found
+enum class module_scanner
+{
+	// coup reads the module declarations itself, see scan_module_source
+	builtin,
+	// gcc 14 and later, -fdeps-format=p1689r5
+	gcc,
+	// clang-scan-deps -format=p1689
+	clang
+};
+
+module_scanner find_module_scanner(const std::string &compiler);
+
+std::optional<module_scan> parse_p1689(const std::string &json);
+
+module_scan scan_module_source(std::string_view source);
+
+std::optional<module_scan> scan_modules(module_scanner scanner,
+										const fs::path &source_file,
+										const fs::path &object_file,
+										const fs::path &scan_file,
+										const compile_options &options,
+										std::string &output);
+
+// Module DAG of a set of translation units, indexed like their sources
+struct module_graph
+{
+	std::vector<module_scan> units;
+	// units each unit imports from directly
+	std::vector<std::vector<std::size_t>> dependencies;
+	// every unit after the units it imports from
+	std::vector<std::size_t> order;
+	// modules each unit imports, directly or through the units it imports
+	// from, sorted; these are the interfaces it is compiled against
+	std::vector<std::vector<std::string>> imports;
+};
+
+std::optional<std::string>
+make_module_graph(const std::vector<fs::path> &sources,
+				  std::vector<module_scan> scans, module_graph &graph);
+
+// where the compiled interface (BMI) of a module is written
+fs::path module_interface_file(const fs::path &directory,
+							   const std::string &name,
+							   const std::string &compiler);
+
+std::vector<std::string> module_flags(const module_graph &graph,
+									  std::size_t unit,
+									  const fs::path &source_file,
+									  const fs::path &interface_directory,
+									  const fs::path &mapper_file,
+									  const std::string &compiler);
+
+std::string make_module_mapper(const module_graph &graph,
+							   const fs::path &interface_directory,
+							   const std::string &compiler);
+
+// Scan results of every source between builds, a source is scanned again
+// when its key (its compile command and contents) changes
+class module_scan_cache
+{
+private:
+	struct entry
+	{
+		hash_t key = 0;
+		module_scan scan;
+	};
+
+	std::unordered_map<std::string, entry> entries;
+
+public:
+	bool load(const fs::path &cache_file);
+
+	bool save(const fs::path &cache_file) const;
+
+	const module_scan *find(const std::string &source, hash_t key) const;
+
+	void record(const std::string &source, hash_t key, module_scan scan);
+};
+} // namespace coup
@@ -0,0 +1,153 @@
+/* coup_net.hxx */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace coup
+{
+// http://host[:port][/path], the only kind of URL coup talks to
+// A server on a unix socket has a socket_path instead of host and port
+struct http_url
+{
+	std::string host;
+	std::string port = "80";
+	std::string path;
+	std::string socket_path;
+};
+
+std::optional<http_url> parse_http_url(const std::string &url);
+std::optional<http_url> parse_socket_address(const std::string &address);
+
+// request or response as read from a connection; header names are lower
+// case, start_line is e.g. "GET /cas/ab HTTP/1.1" or "HTTP/1.1 200 OK"
+struct http_message
+{
+	std::string start_line;
+	std::unordered_map<std::string, std::string> headers;
+	std::string body;
+};
+
+struct http_request
+{
+	std::string method;
+	std::string path;
+	std::string body;
+};
+
+struct http_response
+{
+	int status = 0;
+	std::string body;
+};
+
+// blocking sockets, -1 on failure
+int connect_tcp(const std::string &host, const std::string &port);
+int connect_unix(const std::string &path);
+int listen_tcp(const std::string &address, const std::string &port);
+int listen_unix(const std::string &path);
+int local_port(int fd);
+bool send_all(int fd, std::string_view data);
+
+std::optional<http_message> read_http_message(int fd, std::string &buffer);
+std::string make_http_request(const http_request &request,
+							  const std::string &host);
+std::string make_http_response(int status, std::string_view body);
+
+// several byte strings in one body, each written as <length>:<bytes>
+std::string encode_fields(const std::vector<std::string> &fields);
+std::optional<std::vector<std::string>> decode_fields(std::string_view body);
+
+// Keep-alive HTTP/1.1 connection to one server
+// request() sends one request, requests() pipelines a batch: every request
+// is written before the first response is read, so a batch costs one
+// round trip instead of one per request
+// A connection the server closed in between is reopened once; a request
+// that still fails, or gets no answer within timeout_seconds, returns
+// std::nullopt
+class http_client
+{
+private:
+	http_url url;
+	int timeout_seconds;
+	int fd = -1;
+	// bytes read past the last response
+	std::string buffer;
+
+	bool connect();
+	void disconnect();
+
+	std::optional<std::vector<http_response>>
+	exchange(const std::vector<http_request> &requests);
+
+public:
+	explicit http_client(http_url url_, int timeout_seconds_ = 30);
+	~http_client();
+
+	http_client(const http_client &) = delete;
+	http_client &operator=(const http_client &) = delete;
+
+	std::optional<http_response> request(const http_request &request);
+
+	std::optional<std::vector<http_response>>
+	requests(const std::vector<http_request> &requests);
+};
+
+// HTTP/1.1 server on a TCP or unix socket, every connection is served by
+// its own thread and may pipeline requests; the number of connections
+// served at once is bounded and idle ones time out
+// Subclasses answer requests in handle_request(), on the thread of the
+// connection; serve() must have returned before a subclass is destroyed
+class http_server
+{
+private:
+	int listen_fd = -1;
+	std::string socket_path;
+	std::atomic<bool> stopping = false;
+
+	struct connection
+	{
+		int fd;
+		std::thread thread;
+		std::atomic<bool> done = false;
+	};
+	std::mutex connections_mtx;
+	std::condition_variable connections_cv;
+	std::list<connection> connections;
+
+	void serve_connection(connection &client);
+
+	void reap_connections(bool all);
+
+protected:
+	virtual http_response handle_request(const http_message &request) = 0;
+
+public:
+	http_server() = default;
+	virtual ~http_server();
+
+	http_server(const http_server &) = delete;
+	http_server &operator=(const http_server &) = delete;
+
+	bool listen(const std::string &address, const std::string &port);
+
+	bool listen_unix(const std::string &path);
+
+	int port() const;
+
+	void serve();
+
+	void stop();
+};
+
+void split_request_line(const http_message &request, std::string &method,
+						std::string &path);
+} // namespace coup
@@ -0,0 +1,51 @@
+/* coup_ninja.hxx */
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace coup
+{
+// one object and how to compile it
+struct ninja_compile
+{
+	std::string source;
+	std::string object;
+	std::string dep_file;
+	std::string command;
+};
+
+// one executable and how to link it
+struct ninja_link
+{
+	std::string target;
+	std::vector<std::string> objects;
+	std::string command;
+};
+
+// everything a profile builds; `ninja <name>` builds its executable and
+// `ninja <name>_tests` its test executables
+struct ninja_profile
+{
+	std::string name;
+	std::vector<ninja_compile> compiles;
+	ninja_link executable;
+	std::vector<ninja_link> tests;
+};
+
+// what re-runs `coup generate ninja` when ninja finds it out of date
+struct ninja_generator
+{
+	std::string ninja_file;
+	std::string command;
+	std::vector<std::string> inputs;
+};
+
+std::string ninja_escape_path(const std::string &path);
+std::string ninja_escape_value(const std::string &value);
+
+std::string make_ninja_file(const std::vector<ninja_profile> &profiles,
+							const std::string &default_profile,
+							const std::string &build_directory,
+							const ninja_generator &generator);
+} // namespace coup
@@ -0,0 +1,32 @@
+/* coup_packages.hxx */
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "coup_database.hxx"
+#include "coup_hash.hxx"
+#include "coup_json.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// identifies what an external library is resolved from apart from its
+// .pc files: its declaration and the pkg-config search path
+hash_t package_key(const package_dependency &dependency);
+
+// true if record was resolved for key and none of its .pc files was
+// added, changed or removed since
+bool is_current(const package_record &record, hash_t key);
+
+// Runs pkg-config for the compile and link flags of an external library,
+// or derives them from its prefix when it has no .pc file there
+// pkg-config output is written to scratch_file
+// Throws std::runtime_error if the library is not found
+package_record resolve_package(const package_dependency &dependency,
+							   const fs::path &scratch_file);
+
+// splits pkg-config output into flags, honouring backslash escapes
+std::vector<std::string> split_pkg_config_output(const std::string &output);
+} // namespace coup
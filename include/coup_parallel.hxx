@@ -0,0 +1,69 @@
+/* coup_parallel.hxx */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace coup
+{
+// number of workers used when no explicit job count is requested
+inline unsigned int default_job_count()
+{
+	unsigned int num_threads = std::thread::hardware_concurrency();
+	return num_threads == 0 ? 1 : num_threads;
+}
+
+// Runs task(i) for every i in [0, count) on a pool of worker threads
+// Workers claim indices from a shared atomic counter, so long tasks do not
+// hold up the rest of the range and no lock is taken per item
+// If num_threads is 0, one worker per hardware thread is used
+template <typename F>
+void parallel_for(std::size_t count, F &&task, unsigned int num_threads = 0)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	if (num_threads == 0)
+	{
+		num_threads = default_job_count();
+	}
+	num_threads = static_cast<unsigned int>(
+		std::min<std::size_t>(num_threads, count));
+
+	std::atomic<std::size_t> next{ 0 };
+	auto worker = [&]
+	{
+		for (;;)
+		{
+			std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+			if (i >= count)
+			{
+				return;
+			}
+			task(i);
+		}
+	};
+
+	if (num_threads == 1)
+	{
+		worker();
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads - 1);
+	for (unsigned int i = 1; i < num_threads; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &th : threads)
+	{
+		th.join();
+	}
+}
+} // namespace coup
@@ -0,0 +1,84 @@
+/* coup_path_table.hxx */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace coup
+{
+// index of a path in a path_table, ids are dense and start at 0
+using path_id = std::uint32_t;
+
+// Interns paths: every distinct path is stored once, back to back in one
+// string buffer and each followed by a null character, and named by a 32
+// bit id from then on
+// Views returned by get() and c_str() are invalidated by the next intern()
+class path_table
+{
+private:
+	std::string buffer;
+	// start of every path in buffer, followed by the end of the last one
+	// (past its null character)
+	std::vector<std::uint32_t> offsets{ 0 };
+	// open addressing hash index of the ids, EMPTY_SLOT where unused
+	std::vector<path_id> slots;
+
+public:
+	path_id intern(std::string_view path);
+
+	// id of a path that was interned before
+	std::optional<path_id> find(std::string_view path) const;
+
+	std::string_view get(path_id id) const;
+
+	// the path as a null-terminated string, e.g. to stat it
+	const char *c_str(path_id id) const;
+
+	std::size_t size() const noexcept;
+
+	void clear();
+
+	// the buffer and offsets, to write the table out in one piece
+	const std::string &get_buffer() const noexcept;
+
+	const std::vector<std::uint32_t> &get_offsets() const noexcept;
+
+	// replaces the table with one written out before
+	// Returns false, leaving the table empty, if the offsets do not
+	// describe the buffer or a path is not null-terminated
+	bool assign(std::string buffer_, std::vector<std::uint32_t> offsets_);
+
+private:
+	std::size_t slot_of(std::string_view path) const;
+
+	void grow();
+};
+
+// Directed edges between path ids in compressed sparse row form: the
+// targets of every node lie next to each other in one array
+class path_graph
+{
+private:
+	// targets of node n are targets[offsets[n], offsets[n + 1])
+	std::vector<std::uint32_t> offsets{ 0 };
+	std::vector<path_id> targets;
+
+public:
+	path_graph() = default;
+
+	// edges as (from, to) pairs, every id below num_nodes; targets of a
+	// node keep the order of the edges
+	path_graph(std::size_t num_nodes,
+			   const std::vector<std::pair<path_id, path_id>> &edges);
+
+	std::span<const path_id> edges(path_id node) const;
+
+	std::size_t num_nodes() const noexcept;
+};
+} // namespace coup
@@ -2,37 +2,198 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "coup_database.hxx"
+#include "coup_distributed.hxx"
+#include "coup_events.hxx"
+#include "coup_hash.hxx"
+#include "coup_json.hxx"
+#include "coup_modules.hxx"
+#include "coup_remote_cache.hxx"
+#include "coup_staging.hxx"
+#include "coup_stats.hxx"
+
 namespace fs = std::filesystem;
 namespace coup
 {
+// what `coup clean` removes
+enum class clean_mode
+{
+	// objects, depfiles, executable and database of the selected profile
+	profile,
+	// only objects and depfiles whose source file no longer exists
+	stale,
+	// the whole build directory, every profile at once
+	all
+};
+
+// options that follow the command on the command line
+struct command_options
+{
+	bool verbose = false;
+	std::string profile;
+	clean_mode clean = clean_mode::profile;
+	// `coup test` only builds and runs targets affected by a change
+	bool affected = false;
+	// `coup build` reports where the compiler spends its time
+	bool profile_compiles = false;
+	// file or file descriptor to write the JSON-lines event stream to
+	std::string events;
+	// everything after "--", passed on to the program by `coup run`
+	std::vector<std::string> run_args;
+	// arguments that are not options, the files `coup affected` and
+	// `coup why` ask about or what `coup generate` writes
+	std::vector<std::string> paths;
+};
+
+command_options parse_command_options(const std::vector<std::string> &args);
+
+// build database and file hashes, loaded once per command, what the
+// command cost so far, the remote cache if one is configured and the
+// outputs being published from the staging directory
+struct build_state
+{
+	build_database database;
+	hash_cache hashes;
+	build_metrics metrics;
+	std::unique_ptr<remote_cache> cache;
+	// set once a compile writes its outputs to the staging directory
+	std::unique_ptr<output_stager> stager;
+};
+
 class coup_project {
 private:
-    std::vector<fs::path> source_directories;
-    fs::path build_directory;
-    coup_json coup_config;
+	fs::path root;
+	std::vector<fs::path> source_directories;
+	fs::path build_directory;
+	coup_json coup_config;
+
+	// selected profile and the subdirectory of build_directory it
+	// writes objects, the executable and its build database to
+	build_profile profile;
+	fs::path output_directory;
+
+	// directory coup was started from, paths given on the command line
+	// are relative to it
+	fs::path invocation_directory;
+
+	// JSON-lines events of the running command, see --events
+	std::unique_ptr<event_stream> events = std::make_unique<event_stream>();
+
+	// flags compiling each source that provides or imports a module, see
+	// resolve_modules
+	std::unordered_map<std::string, std::vector<std::string>>
+		source_module_flags;
+
+	// flags of the external libraries in "dependencies", see
+	// resolve_packages
+	std::vector<std::string> package_compile_flags;
+	std::vector<std::string> package_link_flags;
+
+	coup_project(const fs::path &root_,
+				 const std::vector<fs::path> &source_directories_,
+				 const fs::path &build_directory_,
+				 const coup_json &coup_config_);
+
+	coup_project(fs::path &&root_,
+				 std::vector<fs::path> &&source_directories_,
+				 fs::path &&build_directory_,
+				 coup_json &&coup_config_) noexcept;
+
+	std::vector<fs::path>
+	find_sources(const std::vector<fs::path> &directories) const;
+
+	compile_options source_compile_options(const fs::path &source_file) const;
+
+	std::vector<std::string>
+	compile_arguments(const fs::path &source_file) const;
+
+	std::vector<std::string> project_link_flags() const;
 
-	coup_project(const std::vector<fs::path>& source_directories_,
-                 const fs::path& build_directory_,
-                 const coup_json& coup_config_);
+	std::vector<fs::path>
+	test_sources(const test_target &target,
+				 const std::vector<fs::path> &project_sources) const;
 
-	coup_project(std::vector<fs::path>&& source_directories_,
-                 fs::path&& build_directory_, 
-                 coup_json&& coup_config_) noexcept;
+	std::optional<hash_t>
+	hash_test_inputs(const std::vector<fs::path> &sources,
+					 const fs::path &test_binary,
+					 const std::vector<std::string> &link_flags,
+					 build_state &state) const;
+
+	std::string project_path(const std::string &path) const;
+
+	void load_state(build_state &state) const;
+
+	void save_state(build_state &state) const;
+
+	void resolve_packages(build_state &state);
+
+	std::vector<std::unique_ptr<remote_worker>> connect_workers() const;
+
+	std::optional<std::string>
+	resolve_modules(const std::vector<fs::path> &source_files,
+					build_state &state, module_graph &graph);
+
+	std::optional<std::string>
+	compile_sources(const std::vector<fs::path> &source_files,
+					build_state &state, std::vector<fs::path> &object_files,
+					int &num_compiled, bool verbose, bool profile_compiles);
+
+	std::vector<fs::path>
+	all_sources(const std::vector<fs::path> &project_sources) const;
+
+	hash_t compilation_database_key(const std::vector<fs::path> &sources) const;
+
+	bool
+	write_compilation_database(const std::vector<fs::path> &project_sources,
+							   bool force) const;
+
+	void report_compile_times(const std::vector<fs::path> &source_files,
+							  const std::vector<fs::path> &object_files) const;
+
+	std::optional<std::string>
+	link_objects(const std::vector<fs::path> &object_files,
+				 const fs::path &target,
+				 const std::vector<std::string> &link_flags,
+				 bool objects_changed, build_state &state, bool verbose);
 
 public:
 	static coup_project make_project();
-    
-	std::optional<std::string> execute_build(bool verbose) noexcept;
 
-	std::optional<std::string> execute_run() noexcept;
+	void select_profile(const std::string &name);
+
+	std::optional<std::string> execute_build(bool verbose,
+											 bool profile_compiles) noexcept;
+
+	std::optional<std::string>
+	execute_run(bool verbose, const std::vector<std::string> &args) noexcept;
+
+	std::optional<std::string> execute_test(bool verbose,
+											bool affected_only) noexcept;
+
+	std::optional<std::string> execute_clean(bool verbose,
+											 clean_mode mode) noexcept;
+
+	std::optional<std::string>
+	execute_affected(const std::vector<std::string> &paths) noexcept;
+
+	std::optional<std::string>
+	execute_why(const std::vector<std::string> &paths) noexcept;
+
+	std::optional<std::string> execute_stats() noexcept;
+
+	std::optional<std::string> execute_compdb() noexcept;
+
+	std::optional<std::string>
+	execute_generate(const std::vector<std::string> &paths) noexcept;
 
-	std::optional<std::string> execute_clean(bool verbose) noexcept;
-	
-    void execute_command(const std::string &command, const std::string &option);
+	bool execute_command(const std::string &command,
+						 const std::vector<std::string> &args);
 };
 
 } // namespace coup
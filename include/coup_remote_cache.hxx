@@ -0,0 +1,85 @@
+/* coup_remote_cache.hxx */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "coup_net.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// Client of a content addressed cache shared by every machine that builds
+// the project, spoken over HTTP/1.1:
+//      POST /find          body: keys, one per line
+//                          200, body: the keys the cache has
+//      GET /cas/<key>      200 with the entry, or 404
+//      PUT /cas/<key>      201, stores the body under the key
+// Keys are lower case hex
+// Lookups are batched and pipelined; uploads are queued and sent by a
+// background thread, so compiles never wait on them
+// The first request that fails disables the cache for the rest of the
+// command, a build never fails because of it
+class remote_cache
+{
+private:
+	http_url url;
+	std::atomic<bool> available = true;
+
+	std::mutex upload_mtx;
+	std::condition_variable upload_cv;
+	std::deque<std::pair<std::string, std::string>> uploads;
+	bool closing = false;
+	std::thread upload_thread;
+	std::atomic<std::size_t> num_uploaded = 0;
+
+	void upload_loop();
+
+public:
+	explicit remote_cache(http_url url_);
+	~remote_cache();
+
+	remote_cache(const remote_cache &) = delete;
+	remote_cache &operator=(const remote_cache &) = delete;
+
+	bool is_available() const noexcept;
+
+	std::vector<bool> contains(const std::vector<std::string> &keys);
+
+	std::vector<std::optional<std::string>>
+	get(const std::vector<std::string> &keys);
+
+	void put(std::string key, std::string data);
+
+	std::size_t flush();
+};
+
+// Reference server for remote_cache, entries are files below a directory
+// (<directory>/<first two key characters>/<key>)
+class cache_server : public http_server
+{
+private:
+	fs::path directory;
+
+	fs::path entry_file(const std::string &key) const;
+
+protected:
+	http_response handle_request(const http_message &request) override;
+
+public:
+	explicit cache_server(fs::path directory_);
+
+	bool listen(const std::string &address, const std::string &port);
+};
+
+bool is_cache_key(const std::string &key);
+} // namespace coup
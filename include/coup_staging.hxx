@@ -0,0 +1,72 @@
+/* coup_staging.hxx */
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// directory below staging_root that the outputs of output_directory are
+// staged in, the same on every run
+fs::path staging_directory(const fs::path &staging_root,
+						   const fs::path &output_directory);
+
+// Puts a copy of staged at output, replacing it atomically: a hard link
+// if both are on one filesystem, else a reflink or a copy that is renamed
+// into place
+// The staged file is kept
+bool publish_file(const fs::path &staged, const fs::path &output);
+
+// Compiler outputs are written to a RAM-backed directory (e.g. /dev/shm),
+// so compiles never wait on a slow build directory, and are published
+// into the build directory in batches by a thread of its own
+// Staged copies stay until finish(), the link reads them from there
+class output_stager
+{
+private:
+	fs::path directory;
+	fs::path output_directory;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	// (staged, output) pairs not published yet
+	std::vector<std::pair<fs::path, fs::path>> pending;
+	// output -> staged of every file published or pending
+	std::unordered_map<std::string, fs::path> staged_outputs;
+	std::vector<fs::path> failed_outputs;
+	bool stopping = false;
+	std::thread publisher;
+
+public:
+	output_stager(const fs::path &staging_root, fs::path output_directory_);
+
+	~output_stager();
+
+	output_stager(const output_stager &) = delete;
+	output_stager &operator=(const output_stager &) = delete;
+
+	// where the staged copy of a file in the output directory is written
+	fs::path staged_file(const fs::path &output_file) const;
+
+	void publish(fs::path staged, fs::path output);
+
+	// the staged copy of an output, or the output itself if it was not
+	// staged
+	fs::path read_path(const fs::path &output);
+
+	// Waits for every output to be published and removes the staged
+	// copies
+	// Returns the outputs that could not be published
+	std::vector<fs::path> finish();
+
+private:
+	void publish_pending();
+};
+} // namespace coup
@@ -0,0 +1,59 @@
+/* coup_stats.hxx */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// wall time of one compile
+struct unit_time
+{
+	std::string source;
+	double seconds = 0.0;
+};
+
+// What one build cost, appended to the stats file of its profile
+struct build_metrics
+{
+	// seconds since the epoch at the end of the build
+	std::int64_t timestamp = 0;
+
+	// wall time of the whole build and of its phases: checking which
+	// objects are up to date, compiling, linking
+	double total_time = 0.0;
+	double check_time = 0.0;
+	double compile_time = 0.0;
+	double link_time = 0.0;
+
+	int num_sources = 0;
+	int num_compiled = 0;
+	unsigned int num_jobs = 0;
+
+	// largest resident set of any compiler or linker process
+	long peak_rss_kb = 0;
+
+	std::vector<unit_time> units;
+};
+
+bool append_build_metrics(const fs::path &stats_file,
+						  const build_metrics &metrics);
+std::vector<build_metrics> load_build_metrics(const fs::path &stats_file);
+long peak_child_rss_kb();
+
+// a phase or translation unit that got slower than its baseline
+struct regression
+{
+	std::string name;
+	double baseline = 0.0;
+	double seconds = 0.0;
+};
+
+std::vector<regression>
+find_regressions(const std::vector<build_metrics> &history, std::size_t window,
+				 double threshold);
+} // namespace coup
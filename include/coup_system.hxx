@@ -2,9 +2,11 @@
 
 #include <cstdlib>
 #include <filesystem>
+#include <functional>
 #include <string>
 #include <vector>
 
+#include "coup_json.hxx"
 #include "coup_logger.hxx"
 #include "coup_project.hxx"
 
@@ -13,10 +15,36 @@ namespace coup
 {
 // executing system calls
 bool execute_system_call(const char *command);
+int spawn_process(const std::vector<std::string> &arguments,
+				  const fs::path &output_file);
 
 // composing system calls
+std::string quote_argument(const std::string &argument);
+std::string join_arguments(const std::vector<std::string> &arguments);
+std::vector<std::string> make_compile_arguments(const fs::path &src_file,
+												const fs::path &obj_file,
+												const fs::path &dep_file,
+												const compile_options &options);
+std::vector<std::string>
+make_preprocess_arguments(const fs::path &src_file, const fs::path &pre_file,
+						  const fs::path &obj_file, const fs::path &dep_file,
+						  const compile_options &options);
+std::vector<std::string>
+make_preprocessed_compile_arguments(const compile_options &options);
+std::vector<std::string>
+make_link_arguments(const std::vector<fs::path> &obj_files,
+					const fs::path &exec_file, const std::string &compiler,
+					const std::vector<std::string> &link_flags);
 std::string make_compile_command(const fs::path &src_file);
+std::string make_compile_command(const fs::path &src_file,
+								 const fs::path &obj_file,
+								 const fs::path &dep_file,
+								 const compile_options &options);
 std::string make_link_command(const std::vector<fs::path> &obj_files);
+std::string make_link_command(const std::vector<fs::path> &obj_files,
+							  const fs::path &exec_file,
+							  const std::string &compiler,
+							  const std::vector<std::string> &link_flags);
 std::string
 make_compile_and_link_command(const std::vector<fs::path> &src_files);
 std::string make_run_command(const fs::path &exec_file);
@@ -30,10 +58,16 @@ bool compile(const std::vector<fs::path> &src_files);
 bool link(const std::vector<fs::path> &obj_files);
 bool compile_and_link(const std::vector<fs::path> &src_files);
 bool run(const fs::path &exec_file);
+bool exec_file(const fs::path &exec_file, const std::vector<std::string> &args);
 bool remove_file(const fs::path &file);
 bool remove_directory(const fs::path &dir);
 bool make_directory(const fs::path &dir);
 
+// in-process removal, returns the files that could not be removed
+std::vector<fs::path>
+unlink_files(const std::vector<fs::path> &files,
+			 const std::function<void(const fs::path &)> &on_remove = {});
+
 // return file dependencies as a vector of file names
 std::vector<std::string> get_dependencies(const fs::path &src_file);
 } // namespace coup
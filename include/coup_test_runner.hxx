@@ -0,0 +1,73 @@
+/* coup_test_runner.hxx */
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "coup_hash.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// Remembers the outcome and duration of every test between runs
+// A test that passed is skipped while its test binary keeps the same hash
+// Durations are used to balance the shards of the next run
+// Also keeps the input hash of every test target at its last run in which
+// all of its tests passed, used by `coup test --affected`
+class test_cache
+{
+private:
+	struct entry
+	{
+		hash_t binary_hash = 0;
+		double duration = 0.0;
+		bool passed = false;
+	};
+
+	std::unordered_map<std::string, entry> entries;
+	std::unordered_map<std::string, hash_t> green_hashes;
+
+public:
+	bool load(const fs::path &cache_file);
+
+	bool save(const fs::path &cache_file) const;
+
+	bool passed(const std::string &test, hash_t binary_hash) const;
+
+	std::optional<double> get_duration(const std::string &test) const;
+
+	void record(const std::string &test, hash_t binary_hash, bool passed,
+				double duration);
+
+	std::optional<hash_t> get_green_hash(const std::string &target) const;
+
+	void set_green_hash(const std::string &target, hash_t inputs_hash);
+};
+
+// outcome of running the tests of one binary
+struct test_summary
+{
+	int passed = 0;
+	int failed = 0;
+	int cached = 0;
+	std::vector<std::string> failures;
+};
+
+// test discovery and scheduling
+std::vector<std::string> list_tests(const fs::path &test_binary,
+									const fs::path &scratch_file);
+std::vector<std::vector<std::string>>
+make_test_shards(const std::vector<std::string> &tests,
+				 const std::vector<double> &durations, unsigned int num_shards);
+std::vector<std::string>
+make_test_filters(const std::vector<std::string> &tests,
+				  std::size_t max_length);
+
+test_summary run_tests(const fs::path &test_binary,
+					   const std::string &target_name, hash_t binary_hash,
+					   test_cache &cache, const fs::path &scratch_directory,
+					   unsigned int num_jobs, bool verbose);
+} // namespace coup
@@ -0,0 +1,65 @@
+/* coup_time_report.hxx */
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// compiler flags and output files of `coup build --profile-compiles`
+bool is_clang_compiler(const std::string &compiler);
+std::vector<std::string> time_report_flags(const std::string &compiler);
+fs::path time_report_file(const fs::path &object_file,
+						  const std::string &compiler);
+
+// time spent on one header, instantiation, function or compiler phase,
+// summed over every translation unit
+struct time_entry
+{
+	std::string name;
+	double seconds = 0.0;
+	int count = 0;
+};
+
+// Aggregates the per translation unit timing output of the compiler
+// clang -ftime-trace traces give parse time per header (including the
+// headers it includes), time per template instantiation and code
+// generation time per function
+// gcc -ftime-report only measures compiler phases, so with gcc those are
+// reported instead
+class time_report
+{
+private:
+	using time_totals = std::unordered_map<std::string, time_entry>;
+
+	time_totals headers;
+	time_totals instantiations;
+	time_totals codegen;
+	time_totals phases;
+	time_totals units;
+
+	static void add(time_totals &totals, const std::string &name,
+					double seconds);
+
+	static std::vector<time_entry> top(const time_totals &totals,
+									   std::size_t limit);
+
+public:
+	bool add_clang_trace(const fs::path &trace_file,
+						 const std::string &source);
+
+	bool add_gcc_report(const fs::path &report_file,
+						const std::string &source);
+
+	std::vector<time_entry> top_headers(std::size_t limit) const;
+	std::vector<time_entry> top_instantiations(std::size_t limit) const;
+	std::vector<time_entry> top_codegen(std::size_t limit) const;
+	std::vector<time_entry> top_phases(std::size_t limit) const;
+	std::vector<time_entry> top_units(std::size_t limit) const;
+};
+
+std::string strip_time_report(const std::string &compiler_output);
+} // namespace coup
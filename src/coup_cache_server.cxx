@@ -0,0 +1,54 @@
+/* coup_cache_server.cxx */
+#include <csignal>
+#include <iostream>
+#include <string>
+
+#include "../include/coup_remote_cache.hxx"
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT "8080"
+
+using namespace coup;
+
+// coup-cache-server <directory> [--port=<port>] [--bind=<address>]
+// Serves a remote cache from a local directory, on 127.0.0.1:8080 unless
+// told otherwise; point coup at it with "remote_cache" in coup_config.json
+// or COUP_REMOTE_CACHE
+int main(int argc, char *argv[])
+{
+	std::string directory;
+	std::string address = DEFAULT_ADDRESS;
+	std::string port = DEFAULT_PORT;
+	bool valid = true;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg.starts_with("--port="))
+			port = arg.substr(7);
+		else if (arg.starts_with("--bind="))
+			address = arg.substr(7);
+		else if (directory.empty() && !arg.starts_with("-"))
+			directory = arg;
+		else
+			valid = false;
+	}
+	if (!valid || directory.empty())
+	{
+		std::cerr << "Usage: coup-cache-server <directory> [--port=<port>] "
+					 "[--bind=<address>]\n";
+		return -1;
+	}
+
+	std::signal(SIGPIPE, SIG_IGN);
+	cache_server server(directory);
+	if (!server.listen(address, port))
+	{
+		std::cerr << "Error: cannot listen on " << address << ":" << port
+				  << "\n";
+		return -1;
+	}
+	std::cout << "Serving " << directory << " on http://" << address << ":"
+			  << server.port() << std::endl;
+	server.serve();
+	return 0;
+}
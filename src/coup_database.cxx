@@ -0,0 +1,575 @@
+/* coup_database.cxx */
+#include "../include/coup_database.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#define DATABASE_MAGIC "COUPDB07"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+namespace
+{
+void write_u64(std::ofstream &output, std::uint64_t value)
+{
+	output.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void write_string(std::ofstream &output, const std::string &s)
+{
+	write_u64(output, s.size());
+	output.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+bool read_u64(std::ifstream &input, std::uint64_t &value)
+{
+	input.read(reinterpret_cast<char *>(&value), sizeof(value));
+	return static_cast<bool>(input);
+}
+
+void write_double(std::ofstream &output, double value)
+{
+	output.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+bool read_double(std::ifstream &input, double &value)
+{
+	input.read(reinterpret_cast<char *>(&value), sizeof(value));
+	return static_cast<bool>(input);
+}
+
+bool read_string(std::ifstream &input, std::string &s)
+{
+	std::uint64_t size = 0;
+	if (!read_u64(input, size))
+	{
+		return false;
+	}
+	s.resize(size);
+	input.read(s.data(), static_cast<std::streamsize>(size));
+	return static_cast<bool>(input);
+}
+
+// 32 bit values such as path ids, written as one block
+void write_u32s(std::ofstream &output, const std::vector<std::uint32_t> &values)
+{
+	write_u64(output, values.size());
+	output.write(reinterpret_cast<const char *>(values.data()),
+				 static_cast<std::streamsize>(values.size() *
+											  sizeof(std::uint32_t)));
+}
+
+bool read_u32s(std::ifstream &input, std::vector<std::uint32_t> &values)
+{
+	std::uint64_t size = 0;
+	if (!read_u64(input, size) || size > (1ull << 32))
+	{
+		return false;
+	}
+	values.resize(size);
+	input.read(reinterpret_cast<char *>(values.data()),
+			   static_cast<std::streamsize>(size * sizeof(std::uint32_t)));
+	return static_cast<bool>(input);
+}
+
+void write_strings(std::ofstream &output,
+				   const std::vector<std::string> &strings)
+{
+	write_u64(output, strings.size());
+	for (const std::string &s : strings)
+	{
+		write_string(output, s);
+	}
+}
+
+bool read_strings(std::ifstream &input, std::vector<std::string> &strings)
+{
+	std::uint64_t size = 0;
+	if (!read_u64(input, size) || size > (1u << 20))
+	{
+		return false;
+	}
+	strings.resize(size);
+	for (std::string &s : strings)
+	{
+		if (!read_string(input, s))
+			return false;
+	}
+	return true;
+}
+
+bool valid_ids(const std::vector<path_id> &ids, std::size_t num_paths)
+{
+	return std::all_of(ids.begin(), ids.end(),
+					   [&](path_id id) { return id < num_paths; });
+}
+} // namespace
+
+// Load records written by save()
+// Returns false if the file is missing, truncated or written by a
+// different version of coup; the database is then left empty and
+// every object is treated as out of date
+bool build_database::load(const fs::path &db_file)
+{
+	clear();
+
+	std::ifstream input(db_file, std::ios::binary);
+	if (!input)
+	{
+		return false;
+	}
+
+	char magic[8];
+	input.read(magic, sizeof(magic));
+	if (!input || std::memcmp(magic, DATABASE_MAGIC, sizeof(magic)) != 0)
+	{
+		return false;
+	}
+
+	std::uint64_t num_targets = 0;
+	if (!read_u64(input, num_targets))
+	{
+		return false;
+	}
+	std::unordered_map<std::string, hash_t> loaded_link_hashes;
+	for (std::uint64_t i = 0; i < num_targets; ++i)
+	{
+		std::string target;
+		hash_t hash = 0;
+		if (!read_string(input, target) || !read_u64(input, hash))
+		{
+			return false;
+		}
+		loaded_link_hashes.emplace(std::move(target), hash);
+	}
+
+	// every path once, then the normal spelling of each
+	std::string buffer;
+	std::vector<std::uint32_t> offsets;
+	path_table loaded_paths;
+	std::vector<path_id> loaded_normal_ids;
+	if (!read_string(input, buffer) || !read_u32s(input, offsets) ||
+		!loaded_paths.assign(std::move(buffer), std::move(offsets)) ||
+		!read_u32s(input, loaded_normal_ids) ||
+		loaded_normal_ids.size() != loaded_paths.size() ||
+		!valid_ids(loaded_normal_ids, loaded_paths.size()))
+		return false;
+
+	std::uint64_t count = 0;
+	if (!read_u64(input, count) || count > loaded_paths.size())
+	{
+		return false;
+	}
+	std::vector<node> loaded(loaded_paths.size());
+	for (std::uint64_t i = 0; i < count; ++i)
+	{
+		std::uint64_t source = 0;
+		std::uint64_t object = 0;
+		node record;
+		if (!read_u64(input, source) || !read_u64(input, object) ||
+			!read_u64(input, record.command_hash) ||
+			!read_u64(input, record.input_hash) ||
+			!read_double(input, record.compile_time) ||
+			!read_u32s(input, record.dependencies) ||
+			source >= loaded_paths.size() || object >= loaded_paths.size() ||
+			loaded[source].built ||
+			!valid_ids(record.dependencies, loaded_paths.size()))
+			return false;
+		record.built = true;
+		record.object = static_cast<path_id>(object);
+		loaded[source] = std::move(record);
+	}
+
+	std::vector<path_id> failed;
+	if (!read_u32s(input, failed) || !valid_ids(failed, loaded.size()))
+	{
+		return false;
+	}
+	for (path_id source : failed)
+	{
+		loaded[source].failed = true;
+	}
+
+	std::uint64_t num_packages = 0;
+	if (!read_u64(input, num_packages) || num_packages > (1u << 20))
+	{
+		return false;
+	}
+	std::unordered_map<std::string, package_record> loaded_packages;
+	for (std::uint64_t i = 0; i < num_packages; ++i)
+	{
+		std::string name;
+		package_record record;
+		std::uint64_t num_files = 0;
+		if (!read_string(input, name) || !read_u64(input, record.key) ||
+			!read_u64(input, num_files) || num_files > (1u << 20))
+			return false;
+		record.files.resize(num_files);
+		for (auto &[file, mtime_ns] : record.files)
+		{
+			std::uint64_t mtime = 0;
+			if (!read_string(input, file) || !read_u64(input, mtime))
+				return false;
+			mtime_ns = static_cast<std::int64_t>(mtime);
+		}
+		if (!read_strings(input, record.compile_flags) ||
+			!read_strings(input, record.link_flags))
+			return false;
+		loaded_packages.emplace(std::move(name), std::move(record));
+	}
+
+	paths = std::move(loaded_paths);
+	normal_ids = std::move(loaded_normal_ids);
+	nodes = std::move(loaded);
+	num_records = count;
+	link_hashes = std::move(loaded_link_hashes);
+	packages = std::move(loaded_packages);
+	return true;
+}
+
+// Write every record to db_file, replacing it atomically so an
+// interrupted build never leaves a half-written database behind
+// Paths no record refers to any more, of erased sources or of headers no
+// longer included, are left out; the others keep their order
+bool build_database::save(const fs::path &db_file) const
+{
+	std::vector<char> used(paths.size(), false);
+	for (std::size_t source = 0; source < nodes.size(); ++source)
+	{
+		const node &record = nodes[source];
+		used[source] = record.built || record.failed;
+		if (!record.built)
+			continue;
+		used[record.object] = true;
+		for (path_id dependency : record.dependencies)
+			used[dependency] = true;
+	}
+	// a normal spelling is its own normal spelling
+	for (std::size_t id = 0; id < used.size(); ++id)
+	{
+		if (used[id])
+			used[normal_ids[id]] = true;
+	}
+	path_table kept_paths;
+	std::vector<path_id> kept_ids(paths.size(), 0);
+	for (std::size_t id = 0; id < used.size(); ++id)
+	{
+		if (used[id])
+			kept_ids[id] =
+				kept_paths.intern(paths.get(static_cast<path_id>(id)));
+	}
+	std::vector<path_id> kept_normal_ids;
+	kept_normal_ids.reserve(kept_paths.size());
+	for (std::size_t id = 0; id < used.size(); ++id)
+	{
+		if (used[id])
+			kept_normal_ids.push_back(kept_ids[normal_ids[id]]);
+	}
+
+	fs::path tmp_file = db_file;
+	tmp_file += ".tmp";
+	{
+		std::ofstream output(tmp_file, std::ios::binary | std::ios::trunc);
+		if (!output)
+		{
+			return false;
+		}
+
+		output.write(DATABASE_MAGIC, 8);
+		write_u64(output, link_hashes.size());
+		for (const auto &[target, hash] : link_hashes)
+		{
+			write_string(output, target);
+			write_u64(output, hash);
+		}
+		write_string(output, kept_paths.get_buffer());
+		write_u32s(output, kept_paths.get_offsets());
+		write_u32s(output, kept_normal_ids);
+
+		write_u64(output, num_records);
+		std::vector<path_id> dependencies;
+		for (std::size_t source = 0; source < nodes.size(); ++source)
+		{
+			const node &record = nodes[source];
+			if (!record.built)
+				continue;
+			write_u64(output, kept_ids[source]);
+			write_u64(output, kept_ids[record.object]);
+			write_u64(output, record.command_hash);
+			write_u64(output, record.input_hash);
+			write_double(output, record.compile_time);
+			dependencies.clear();
+			for (path_id dependency : record.dependencies)
+				dependencies.push_back(kept_ids[dependency]);
+			write_u32s(output, dependencies);
+		}
+
+		std::vector<path_id> failed;
+		for (std::size_t source = 0; source < nodes.size(); ++source)
+		{
+			if (nodes[source].failed)
+				failed.push_back(kept_ids[source]);
+		}
+		write_u32s(output, failed);
+
+		write_u64(output, packages.size());
+		for (const auto &[name, record] : packages)
+		{
+			write_string(output, name);
+			write_u64(output, record.key);
+			write_u64(output, record.files.size());
+			for (const auto &[file, mtime_ns] : record.files)
+			{
+				write_string(output, file);
+				write_u64(output, static_cast<std::uint64_t>(mtime_ns));
+			}
+			write_strings(output, record.compile_flags);
+			write_strings(output, record.link_flags);
+		}
+		if (!output)
+		{
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(tmp_file, db_file, ec);
+	return !ec;
+}
+
+// returns the record for a source file, or std::nullopt if it was never
+// built
+std::optional<build_record>
+build_database::find(const std::string &source) const
+{
+	std::optional<build_record_view> found = view(source);
+	if (!found.has_value())
+	{
+		return std::nullopt;
+	}
+	build_record record;
+	record.source = source;
+	record.object = found->object;
+	record.command_hash = found->command_hash;
+	record.input_hash = found->input_hash;
+	record.compile_time = found->compile_time;
+	record.dependencies.reserve(found->dependencies.size());
+	for (path_id dependency : found->dependencies)
+	{
+		record.dependencies.emplace_back(paths.get(dependency));
+	}
+	return record;
+}
+
+// the record for a source file without copying it, for the up-to-date
+// check of every source on each build
+std::optional<build_record_view>
+build_database::view(std::string_view source) const
+{
+	std::optional<path_id> id = paths.find(source);
+	if (!id.has_value() || *id >= nodes.size() || !nodes[*id].built)
+	{
+		return std::nullopt;
+	}
+	const node &found = nodes[*id];
+	build_record_view record;
+	record.object = paths.get(found.object);
+	record.command_hash = found.command_hash;
+	record.input_hash = found.input_hash;
+	record.dependencies = found.dependencies;
+	record.compile_time = found.compile_time;
+	return record;
+}
+
+// a path of a build_record_view
+const char *build_database::get_path(path_id id) const
+{
+	return paths.c_str(id);
+}
+
+// insert or replace the record of a source file
+void build_database::update(build_record record)
+{
+	node updated;
+	updated.built = true;
+	updated.object = intern(record.object);
+	updated.command_hash = record.command_hash;
+	updated.input_hash = record.input_hash;
+	updated.compile_time = record.compile_time;
+	updated.dependencies.reserve(record.dependencies.size());
+	for (const std::string &dependency : record.dependencies)
+	{
+		updated.dependencies.push_back(intern(dependency));
+	}
+
+	path_id source = intern(record.source);
+	if (source >= nodes.size())
+	{
+		nodes.resize(source + 1);
+	}
+	if (!nodes[source].built)
+	{
+		num_records++;
+	}
+	nodes[source] = std::move(updated);
+	dependents_valid = false;
+}
+
+// forget a source file, e.g. after it was removed
+void build_database::erase(const std::string &source)
+{
+	std::optional<path_id> id = paths.find(source);
+	if (id.has_value() && *id < nodes.size())
+	{
+		if (nodes[*id].built)
+		{
+			num_records--;
+			dependents_valid = false;
+		}
+		nodes[*id] = node{};
+	}
+}
+
+// forget the record of a source whose compile failed, and remember the
+// failure until it compiles again
+void build_database::mark_failed(const std::string &source)
+{
+	erase(source);
+	path_id id = intern(source);
+	if (id >= nodes.size())
+	{
+		nodes.resize(id + 1);
+	}
+	nodes[id].failed = true;
+}
+
+bool build_database::has_failed(const std::string &source) const
+{
+	std::optional<path_id> id = paths.find(source);
+	return id.has_value() && *id < nodes.size() && nodes[*id].failed;
+}
+
+std::vector<std::string> build_database::get_sources() const
+{
+	std::vector<std::string> sources;
+	sources.reserve(num_records);
+	for (std::size_t source = 0; source < nodes.size(); ++source)
+	{
+		if (nodes[source].built)
+			sources.emplace_back(paths.get(static_cast<path_id>(source)));
+	}
+	return sources;
+}
+
+std::size_t build_database::size() const noexcept
+{
+	return num_records;
+}
+
+// sources that include a header, directly or through other headers
+std::vector<std::string>
+build_database::get_dependents(const std::string &header) const
+{
+	std::optional<path_id> id =
+		paths.find(fs::path(header).lexically_normal().string());
+	if (!id.has_value())
+	{
+		return {};
+	}
+
+	if (!dependents_valid)
+	{
+		std::vector<std::pair<path_id, path_id>> edges;
+		for (std::size_t source = 0; source < nodes.size(); ++source)
+		{
+			for (path_id dependency : nodes[source].dependencies)
+			{
+				edges.emplace_back(normal_ids[dependency],
+								   static_cast<path_id>(source));
+			}
+		}
+		dependents = path_graph(paths.size(), edges);
+		dependents_valid = true;
+	}
+
+	std::vector<std::string> sources;
+	for (path_id source : dependents.edges(*id))
+	{
+		// a header may be listed twice under different spellings
+		std::string_view path = paths.get(source);
+		if (sources.empty() || sources.back() != path)
+			sources.emplace_back(path);
+	}
+	return sources;
+}
+
+// hash of the link command that produced a target, 0 if it was never linked
+hash_t build_database::get_link_hash(const std::string &target) const
+{
+	auto it = link_hashes.find(target);
+	return it == link_hashes.end() ? 0 : it->second;
+}
+
+void build_database::set_link_hash(const std::string &target, hash_t hash)
+{
+	link_hashes.insert_or_assign(target, hash);
+}
+
+// flags an external library was last resolved to, nullptr if it never was
+const package_record *
+build_database::find_package(const std::string &name) const
+{
+	auto it = packages.find(name);
+	return it == packages.end() ? nullptr : &it->second;
+}
+
+void build_database::set_package(const std::string &name,
+								 package_record record)
+{
+	packages.insert_or_assign(name, std::move(record));
+}
+
+// id of a path, and of its normal spelling when it is new
+path_id build_database::intern(std::string_view path)
+{
+	path_id id = paths.intern(path);
+	if (id < normal_ids.size())
+	{
+		return id;
+	}
+	std::string normal = fs::path(path).lexically_normal().string();
+	// the normal spelling may be new as well, and is its own normal form
+	normal_ids.push_back(id);
+	if (normal != path)
+	{
+		path_id normal_id = paths.intern(normal);
+		if (normal_id == normal_ids.size())
+			normal_ids.push_back(normal_id);
+		normal_ids[id] = normal_id;
+	}
+	return id;
+}
+
+void build_database::clear()
+{
+	paths.clear();
+	normal_ids.clear();
+	nodes.clear();
+	num_records = 0;
+	dependents = path_graph();
+	dependents_valid = false;
+	link_hashes.clear();
+	packages.clear();
+}
+} // namespace coup
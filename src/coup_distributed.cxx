@@ -0,0 +1,302 @@
+/* coup_distributed.cxx */
+#include "../include/coup_distributed.hxx"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_system.hxx"
+
+// a compile may take long, a worker is only given up on after this
+#define COMPILE_TIMEOUT_SECONDS 600
+// weight of the newest measurement in a worker's overhead
+#define OVERHEAD_WEIGHT 0.3
+
+namespace fs = std::filesystem;
+namespace coup
+{
+
+namespace
+{
+// names of the -f flags a worker accepts, also as -fno-<name> and
+// -f<name>=<value>: code generation, language, warning and diagnostic
+// flags, none of which reads or writes a file or loads code
+// Anything else, e.g. -fplugin=, -fdeps-file=, -fprofile-generate,
+// -foptimization-record-file= or -fembed-offload-object=, is refused
+const char *const WORKER_F_FLAGS[] = {
+	// code generation
+	"PIC", "pic", "PIE", "pie", "plt", "common", "exceptions",
+	"asynchronous-unwind-tables", "unwind-tables", "rtti", "threadsafe-statics",
+	"omit-frame-pointer", "optimize-sibling-calls", "inline",
+	"inline-functions", "unroll-loops", "vectorize", "slp-vectorize",
+	"tree-vectorize", "strict-aliasing", "strict-overflow", "wrapv", "trapv",
+	"delete-null-pointer-checks", "fast-math", "finite-math-only",
+	"math-errno", "trapping-math", "signed-char", "unsigned-char",
+	"short-enums", "function-sections", "data-sections", "visibility",
+	"visibility-inlines-hidden", "semantic-interposition", "merge-constants",
+	"builtin", "ident", "lto", "openmp", "stack-protector",
+	"stack-protector-strong", "stack-protector-all", "stack-clash-protection",
+	"cf-protection", "sanitize", "sanitize-recover", "debug-prefix-map",
+	"macro-prefix-map", "file-prefix-map",
+	// language
+	"permissive", "char8_t", "coroutines", "concepts", "gnu-keywords",
+	"operator-names", "implicit-templates", "ms-extensions",
+	"constexpr-depth", "constexpr-steps", "template-depth",
+	// diagnostics
+	"diagnostics-color", "color-diagnostics", "diagnostics-show-option",
+	"diagnostics-show-caret", "caret-diagnostics", "diagnostics-urls",
+	"show-column", "message-length", "max-errors", "elide-type",
+	"template-backtrace-limit", "diagnostics-show-template-tree"
+};
+
+bool starts_with(const std::string &s, const char *prefix)
+{
+	return s.rfind(prefix, 0) == 0;
+}
+
+// Flags make_preprocessed_compile_arguments passes on from the config:
+// standard, optimization, debug info, warnings, code generation, target
+// and macro flags, and include directories, which preprocessed input
+// never reads from
+// Anything else, e.g. -wrapper, -specs=, -B, -include, @file, -Wl, or the
+// -Xclang and -mllvm pass-through, is refused
+bool is_worker_flag(const std::string &flag)
+{
+	if (flag == "-c" || flag == "-w" || flag == "-pthread" ||
+		flag == "-ansi" || flag == "-pedantic" || flag == "-pedantic-errors")
+		return true;
+	// -mllvm passes its argument to the compiler backend
+	if (flag == "-mllvm")
+		return false;
+	if (starts_with(flag, "-std=") || starts_with(flag, "-O") ||
+		starts_with(flag, "-g") || starts_with(flag, "-m") ||
+		starts_with(flag, "-D") || starts_with(flag, "-U") ||
+		starts_with(flag, "-I"))
+		return true;
+	if (starts_with(flag, "-W"))
+	{
+		return !starts_with(flag, "-Wl,") && !starts_with(flag, "-Wa,") &&
+			   !starts_with(flag, "-Wp,");
+	}
+	if (starts_with(flag, "-f"))
+	{
+		std::string_view name(flag);
+		name.remove_prefix(2);
+		if (name.starts_with("no-"))
+			name.remove_prefix(3);
+		name = name.substr(0, name.find('='));
+		return std::find(std::begin(WORKER_F_FLAGS), std::end(WORKER_F_FLAGS),
+						 name) != std::end(WORKER_F_FLAGS);
+	}
+	return false;
+}
+} // namespace
+
+// gcc, g++, cc, c++, clang or clang++, optionally followed by -<version>
+// and given with a directory
+bool is_compiler_driver(const std::string &program)
+{
+	std::string name = fs::path(program).filename().string();
+	std::size_t dash = name.find('-');
+	if (dash != std::string::npos)
+	{
+		std::string version = name.substr(dash + 1);
+		if (version.empty() ||
+			!std::all_of(version.begin(), version.end(), [](unsigned char c)
+						 { return std::isdigit(c) || c == '.'; }))
+			return false;
+		name.resize(dash);
+	}
+	return name == "gcc" || name == "g++" || name == "cc" || name == "c++" ||
+		   name == "clang" || name == "clang++";
+}
+
+// true if a worker runs a compile with arguments, which are a compiler
+// driver and worker flags (see is_worker_flag) for preprocessed input;
+// input and output are the worker's
+bool is_worker_compile(const std::vector<std::string> &arguments)
+{
+	if (arguments.empty() || !is_compiler_driver(arguments.front()))
+	{
+		return false;
+	}
+	for (std::size_t i = 1; i < arguments.size(); ++i)
+	{
+		if (arguments[i] == "-x")
+		{
+			if (++i == arguments.size() || arguments[i] != "c++-cpp-output")
+				return false;
+		}
+		else if (!is_worker_flag(arguments[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+remote_worker::remote_worker(std::string address_, http_url url_)
+	: address(std::move(address_)), url(std::move(url_))
+{
+}
+
+// asks the worker for its slots, false if it cannot be reached
+bool remote_worker::connect()
+{
+	auto start = std::chrono::steady_clock::now();
+	http_client client(url);
+	std::optional<http_response> response =
+		client.request({ "GET", "/status", "" });
+	std::chrono::duration<double> round_trip =
+		std::chrono::steady_clock::now() - start;
+	if (!response.has_value() || response->status != 200 ||
+		std::sscanf(response->body.c_str(), "slots %d", &slots) != 1)
+	{
+		slots = 0;
+		return false;
+	}
+	overhead = round_trip.count();
+	return slots > 0;
+}
+
+const std::string &remote_worker::get_address() const noexcept
+{
+	return address;
+}
+
+int remote_worker::get_slots() const noexcept
+{
+	return slots;
+}
+
+double remote_worker::get_overhead() const
+{
+	std::lock_guard<std::mutex> lock(overhead_mtx);
+	return overhead;
+}
+
+void remote_worker::add_overhead(double seconds)
+{
+	std::lock_guard<std::mutex> lock(overhead_mtx);
+	overhead = (1.0 - OVERHEAD_WEIGHT) * overhead + OVERHEAD_WEIGHT * seconds;
+}
+
+// Compiles a preprocessed translation unit on the worker
+// Returns std::nullopt if the worker could not be asked, not when the
+// compile failed
+std::optional<remote_compile>
+remote_worker::compile(const std::vector<std::string> &arguments,
+					   const std::string &preprocessed)
+{
+	std::vector<std::string> fields = arguments;
+	fields.push_back(preprocessed);
+	http_client client(url, COMPILE_TIMEOUT_SECONDS);
+	std::optional<http_response> response =
+		client.request({ "POST", "/compile", encode_fields(fields) });
+	if (!response.has_value() || response->status != 200)
+	{
+		return std::nullopt;
+	}
+
+	std::optional<std::vector<std::string>> result =
+		decode_fields(response->body);
+	if (!result.has_value() || result->size() != 4)
+	{
+		return std::nullopt;
+	}
+	remote_compile compiled;
+	compiled.exit_code = std::atoi((*result)[0].c_str());
+	compiled.seconds = std::atof((*result)[1].c_str());
+	compiled.output = std::move((*result)[2]);
+	compiled.object = std::move((*result)[3]);
+	return compiled;
+}
+
+compile_worker::compile_worker(int slots_, fs::path scratch_directory_)
+	: slots(std::max(slots_, 1)),
+	  scratch_directory(std::move(scratch_directory_))
+{
+}
+
+http_response compile_worker::handle_request(const http_message &request)
+{
+	std::string method, path;
+	split_request_line(request, method, path);
+	if (method == "GET" && path == "/status")
+	{
+		return { 200, "slots " + std::to_string(slots) + "\n" };
+	}
+	if (method == "POST" && path == "/compile")
+	{
+		std::optional<std::vector<std::string>> fields =
+			decode_fields(request.body);
+		if (!fields.has_value() || fields->size() < 2 ||
+			!is_worker_compile(std::vector<std::string>(fields->begin(),
+														 fields->end() - 1)))
+			return { 400, "" };
+		return compile(*fields);
+	}
+	return { 404, "" };
+}
+
+// runs one compile once a slot is free, in a directory of its own
+http_response compile_worker::compile(const std::vector<std::string> &fields)
+{
+	unsigned long job;
+	{
+		std::unique_lock<std::mutex> lock(slots_mtx);
+		slots_cv.wait(lock, [&] { return busy < slots; });
+		busy++;
+		job = next_job++;
+	}
+
+	fs::path job_directory =
+		scratch_directory / ("job-" + std::to_string(job));
+	fs::create_directories(job_directory);
+	fs::path input_file = job_directory / "input.ii";
+	fs::path object_file = job_directory / "output.o";
+	fs::path log_file = job_directory / "output.log";
+
+	std::vector<std::string> arguments(fields.begin(), fields.end() - 1);
+	arguments.insert(arguments.end(),
+					 { input_file.string(), "-o", object_file.string() });
+	int exit_code = -1;
+	std::chrono::duration<double> seconds{ 0.0 };
+	{
+		std::ofstream input(input_file, std::ios::binary);
+		input << fields.back();
+	}
+	if (fs::exists(input_file))
+	{
+		auto start = std::chrono::steady_clock::now();
+		exit_code = spawn_process(arguments, log_file);
+		seconds = std::chrono::steady_clock::now() - start;
+	}
+
+	std::vector<std::string> result = {
+		std::to_string(exit_code), std::to_string(seconds.count()),
+		file_contents(log_file),
+		exit_code == 0 ? file_contents(object_file) : std::string{}
+	};
+	std::error_code ec;
+	fs::remove_all(job_directory, ec);
+	{
+		std::lock_guard<std::mutex> lock(slots_mtx);
+		busy--;
+	}
+	slots_cv.notify_one();
+	return { 200, encode_fields(result) };
+}
+} // namespace coup
@@ -0,0 +1,139 @@
+/* coup_events.cxx */
+#include "../include/coup_events.hxx"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+// the writer wakes up at least this often, or once this much is buffered
+#define EVENT_FLUSH_INTERVAL_MS 100
+#define EVENT_FLUSH_BYTES (64 * 1024)
+
+namespace coup
+{
+
+event_stream::~event_stream()
+{
+	close();
+}
+
+// Open the stream on a file descriptor (a destination made only of
+// digits, e.g. "3") or a file, which is truncated
+// Returns false if the destination cannot be opened
+bool event_stream::open(const std::string &destination)
+{
+	close();
+	if (!destination.empty() &&
+		std::all_of(destination.begin(), destination.end(),
+					[](unsigned char c) { return std::isdigit(c); }))
+	{
+		fd = ::fcntl(std::stoi(destination), F_DUPFD_CLOEXEC, 0);
+	}
+	else
+	{
+		fd = ::open(destination.c_str(),
+					O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	start = std::chrono::steady_clock::now();
+	closing = false;
+	writer_thread = std::thread(&event_stream::write_loop, this);
+	return true;
+}
+
+// Write out every buffered event and close the destination
+void event_stream::close()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(buffer_mtx);
+		closing = true;
+	}
+	buffer_cv.notify_one();
+	writer_thread.join();
+	::close(fd);
+	fd = -1;
+}
+
+bool event_stream::is_open() const noexcept
+{
+	return fd >= 0;
+}
+
+// Append one event, fields is a JSON object that type and time are added to
+void event_stream::emit(std::string_view type, nlohmann::json fields)
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	std::chrono::duration<double> time =
+		std::chrono::steady_clock::now() - start;
+	fields["event"] = type;
+	fields["time"] = time.count();
+	std::string line = fields.dump(-1, ' ', false,
+								   nlohmann::json::error_handler_t::replace);
+	line += '\n';
+
+	std::size_t buffered;
+	{
+		std::lock_guard<std::mutex> lock(buffer_mtx);
+		buffer += line;
+		buffered = buffer.size();
+	}
+	if (buffered >= EVENT_FLUSH_BYTES)
+	{
+		buffer_cv.notify_one();
+	}
+}
+
+void event_stream::write_loop()
+{
+	std::string pending;
+	bool done = false;
+	while (!done)
+	{
+		{
+			std::unique_lock<std::mutex> lock(buffer_mtx);
+			buffer_cv.wait_for(
+				lock, std::chrono::milliseconds(EVENT_FLUSH_INTERVAL_MS),
+				[&] { return closing || buffer.size() >= EVENT_FLUSH_BYTES; });
+			std::swap(pending, buffer);
+			done = closing;
+		}
+
+		std::size_t written = 0;
+		while (written < pending.size())
+		{
+			ssize_t result = ::write(fd, pending.data() + written,
+									 pending.size() - written);
+			if (result < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (result <= 0)
+			{
+				break;
+			}
+			written += static_cast<std::size_t>(result);
+		}
+		pending.clear();
+	}
+}
+} // namespace coup
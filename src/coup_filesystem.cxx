@@ -1,12 +1,18 @@
 #include "../include/coup_filesystem.hxx"
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <filesystem>
 #include <fstream>
 #include <optional>
+#include <queue>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -218,8 +224,10 @@ bool is_src_file(const fs::path &src)
 {
 	std::string ext = get_extension(src);
 
+	// cppm, ixx, mpp and mxx are module interface units
 	if (ext == "cpp" || ext == "cc" || ext == "C" || ext == "cxx" ||
-		ext == "c++")
+		ext == "c++" || ext == "cppm" || ext == "ixx" || ext == "mpp" ||
+		ext == "mxx")
 	{
 		return true;
 	}
@@ -272,10 +280,9 @@ std::vector<fs::path> find_src_files(const fs::path &src_dir)
 		{
 			continue;
 		}
-		fs::path p = entry.path();
-		if (is_src_file(p))
+		if (is_src_file(entry.path()))
 		{
-			src_files.push_back(p);
+			src_files.push_back(entry.path());
 		}
 	}
 	return src_files;
@@ -377,6 +384,79 @@ fs::path make_obj_file(const fs::path &src_file)
 	return fs::path{ { replace_extension(src_file, "o") } };
 }
 
+// Make the output file of a source file at the same relative location
+// below out_dir, keeping the source extension so that util.cpp and util.cxx
+// in one directory do not collide, e.g. src/net/util.cxx -> out/src/net/util.cxx.o
+// Absolute paths and ".." components are folded into out_dir
+fs::path make_output_file(const fs::path &src_file, const fs::path &out_dir,
+						  const std::string &ext)
+{
+	fs::path output = out_dir;
+	for (const fs::path &component : src_file.lexically_normal().relative_path())
+	{
+		if (component == "..")
+		{
+			output /= "__";
+		}
+		else if (!component.empty())
+		{
+			output /= component;
+		}
+	}
+	output += '.' + ext;
+	return output;
+}
+
+// Inverse of make_output_file: the source file an output file was made for
+// (for sources outside the root this is only a best guess)
+fs::path get_output_source(const fs::path &output_file, const fs::path &out_dir)
+{
+	fs::path relative = output_file.lexically_relative(out_dir);
+	relative.replace_extension();
+
+	fs::path source;
+	for (const fs::path &component : relative)
+	{
+		source /= component == "__" ? fs::path("..") : component;
+	}
+	return source;
+}
+
+// Create the parent directory of every file in one batched pass
+// Parents are deduplicated and created in sorted order, so each directory
+// costs a single mkdir no matter how many files it will hold
+// Returns true if every directory exists afterwards
+bool make_parent_directories(const std::vector<fs::path> &files)
+{
+	std::vector<fs::path> directories;
+	directories.reserve(files.size());
+	for (const fs::path &file : files)
+	{
+		if (file.has_parent_path())
+		{
+			directories.push_back(file.parent_path());
+		}
+	}
+	std::sort(directories.begin(), directories.end());
+	directories.erase(std::unique(directories.begin(), directories.end()),
+					  directories.end());
+
+	for (const fs::path &directory : directories)
+	{
+		if (::mkdir(directory.c_str(), 0777) == 0 || errno == EEXIST)
+		{
+			continue;
+		}
+		std::error_code ec;
+		fs::create_directories(directory, ec);
+		if (ec)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 // returns a string representation of file contents
 std::string file_to_string(const fs::path &file)
 {
@@ -391,28 +471,207 @@ std::string file_to_string(const fs::path &file)
 	return s;
 }
 
+// Replace file with contents unless it already holds exactly that, so
+// tools watching its mtime only see real changes; the new file is renamed
+// into place, readers never see it half written
+// Returns true if the file was written
+// Throws std::runtime_error if it cannot be written
+bool write_file_if_changed(const fs::path &file, const std::string &contents)
+{
+	std::error_code ec;
+	if (fs::file_size(file, ec) == contents.size() && !ec &&
+		file_contents(file) == contents)
+	{
+		return false;
+	}
+
+	fs::path tmp_file = file;
+	tmp_file += ".tmp";
+	{
+		std::ofstream output(tmp_file, std::ios::trunc);
+		output << contents;
+		if (!output)
+		{
+			throw std::runtime_error("Failed to write " + tmp_file.string());
+		}
+	}
+	fs::rename(tmp_file, file);
+	return true;
+}
+
+// whole contents of a file, line breaks included
+std::string file_contents(const fs::path &file)
+{
+	std::ifstream input(file);
+	std::ostringstream contents;
+	contents << input.rdbuf();
+	return contents.str();
+}
+
 // parses dependency file contents to find project header dependencies
 // returns a list of header file names listed in the dependency file
+// Only rules for the targets of the first rule (the object, and the BMI
+// of a module interface) are read; the other rules gcc writes for modules
+// and the module names it lists as prerequisites (<name>.c++m) are skipped
 std::vector<std::string> parse_dependency_file(const fs::path &dep_file)
 {
-	std::string dep_file_content = file_to_string(dep_file);
+	std::string dep_file_content = file_contents(dep_file);
 
 	std::vector<std::string> dependencies;
 	std::istringstream iss(dep_file_content);
-	std::string current;
+	std::string line, rule, targets;
+	bool first_rule = true;
 
-	while (iss >> current)
+	while (std::getline(iss, line))
 	{
-		if (current.back() == ':' || current == "\\" || current.empty())
+		// a backslash at the end continues the rule on the next line
+		if (!line.empty() && line.back() == '\\')
 		{
+			line.pop_back();
+			rule += line + ' ';
 			continue;
 		}
-		else
+		rule += line;
+
+		// the targets end at the first colon followed by a blank or '|'
+		std::size_t colon = 0;
+		while ((colon = rule.find(':', colon)) != std::string::npos &&
+			   colon + 1 < rule.size() && rule[colon + 1] != ' ' &&
+			   rule[colon + 1] != '\t' && rule[colon + 1] != '|')
+			colon++;
+		if (colon == std::string::npos)
+		{
+			rule.clear();
+			continue;
+		}
+		std::string rule_targets = rule.substr(0, colon);
+		if (first_rule)
+		{
+			targets = rule_targets;
+			first_rule = false;
+		}
+		if (rule_targets == targets)
 		{
-			dependencies.push_back(current);
+			std::istringstream prerequisites(rule.substr(colon + 1));
+			std::string current;
+			while (prerequisites >> current)
+			{
+				if (!current.ends_with(".c++m"))
+					dependencies.push_back(current);
+			}
 		}
+		rule.clear();
 	}
 
 	return dependencies;
 }
+
+// returns the names written in the #include directives of a file, e.g.
+// "coup_hash.hxx" for both #include "coup_hash.hxx" and <coup_hash.hxx>
+// Conditional compilation is ignored, every directive is listed
+std::vector<std::string> parse_include_directives(const fs::path &file)
+{
+	std::vector<std::string> includes;
+	std::ifstream input(file);
+	std::string line;
+	while (std::getline(input, line))
+	{
+		std::size_t pos = line.find_first_not_of(" \t");
+		if (pos == std::string::npos || line[pos] != '#')
+		{
+			continue;
+		}
+		pos = line.find_first_not_of(" \t", pos + 1);
+		if (pos == std::string::npos || line.compare(pos, 7, "include") != 0)
+		{
+			continue;
+		}
+		pos = line.find_first_not_of(" \t", pos + 7);
+		if (pos == std::string::npos || (line[pos] != '"' && line[pos] != '<'))
+		{
+			continue;
+		}
+		char closing = line[pos] == '"' ? '"' : '>';
+		std::size_t end = line.find(closing, pos + 1);
+		if (end != std::string::npos)
+		{
+			includes.push_back(line.substr(pos + 1, end - pos - 1));
+		}
+	}
+	return includes;
+}
+
+// Finds how source ends up including header: the shortest chain of files
+// from source to header in which every file includes the next one
+// Only files in dependencies (the depfile of source) are followed, so an
+// include name resolves to the file the compiler actually used; a name is
+// looked up next to the including file first, then by path suffix
+// Returns an empty vector if header is not reached
+std::vector<std::string>
+find_include_chain(const std::string &source, const std::string &header,
+				   const std::vector<std::string> &dependencies)
+{
+	std::vector<std::string> files;
+	files.reserve(dependencies.size());
+	for (const std::string &dependency : dependencies)
+	{
+		files.push_back(fs::path(dependency).lexically_normal().string());
+	}
+	std::unordered_set<std::string> file_set(files.begin(), files.end());
+
+	auto resolve = [&](const std::string &from,
+					   const std::string &name) -> std::optional<std::string>
+	{
+		std::string local =
+			(fs::path(from).parent_path() / name).lexically_normal().string();
+		if (file_set.contains(local))
+		{
+			return local;
+		}
+		for (const std::string &file : files)
+		{
+			if (file == name || file.ends_with("/" + name))
+			{
+				return file;
+			}
+		}
+		return std::nullopt;
+	};
+
+	std::string start = fs::path(source).lexically_normal().string();
+	std::string goal = fs::path(header).lexically_normal().string();
+
+	// breadth first search, parent links give the chain back
+	std::unordered_map<std::string, std::string> parents;
+	std::queue<std::string> pending;
+	parents.emplace(start, "");
+	pending.push(start);
+	while (!pending.empty())
+	{
+		std::string current = std::move(pending.front());
+		pending.pop();
+		if (current == goal)
+		{
+			std::vector<std::string> chain;
+			for (std::string file = current; !file.empty();
+				 file = parents[file])
+			{
+				chain.push_back(file);
+			}
+			std::reverse(chain.begin(), chain.end());
+			return chain;
+		}
+
+		for (const std::string &name : parse_include_directives(current))
+		{
+			std::optional<std::string> included = resolve(current, name);
+			if (included.has_value() &&
+				parents.emplace(*included, current).second)
+			{
+				pending.push(*included);
+			}
+		}
+	}
+	return {};
+}
 } // namespace coup
@@ -0,0 +1,411 @@
+/* coup_hash.cxx */
+#include "../include/coup_hash.hxx"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+#include "../include/coup_parallel.hxx"
+
+#define HASH_CACHE_MAGIC "COUPHSH1"
+
+// files modified this close to the moment they are hashed are not memoized,
+// a second write within the same timestamp tick would otherwise go unnoticed
+#define RACY_WINDOW_NS 2000000000LL
+
+namespace fs = std::filesystem;
+namespace coup
+{
+namespace
+{
+constexpr std::uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+inline std::uint64_t rotl64(std::uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t read64(const unsigned char *p)
+{
+	std::uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline std::uint32_t read32(const unsigned char *p)
+{
+	std::uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline std::uint64_t round64(std::uint64_t acc, std::uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+inline std::uint64_t merge_round64(std::uint64_t acc, std::uint64_t val)
+{
+	acc ^= round64(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+std::int64_t now_ns()
+{
+	timespec ts{};
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<std::int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+} // namespace
+
+// XXH64 over a block of memory
+// The four independent accumulators of the main loop keep the multiply
+// units busy and are vectorized by the compiler where possible
+hash_t hash_bytes(const void *data, std::size_t size, hash_t seed)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	const unsigned char *end = p + size;
+	std::uint64_t h;
+
+	if (size >= 32)
+	{
+		const unsigned char *limit = end - 32;
+		std::uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		std::uint64_t v2 = seed + PRIME64_2;
+		std::uint64_t v3 = seed;
+		std::uint64_t v4 = seed - PRIME64_1;
+
+		do
+		{
+			v1 = round64(v1, read64(p));
+			v2 = round64(v2, read64(p + 8));
+			v3 = round64(v3, read64(p + 16));
+			v4 = round64(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = merge_round64(h, v1);
+		h = merge_round64(h, v2);
+		h = merge_round64(h, v3);
+		h = merge_round64(h, v4);
+	}
+	else
+	{
+		h = seed + PRIME64_5;
+	}
+
+	h += static_cast<std::uint64_t>(size);
+
+	while (p + 8 <= end)
+	{
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= static_cast<std::uint64_t>(read32(p)) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while (p < end)
+	{
+		h ^= static_cast<std::uint64_t>(*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		++p;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+// hash the characters of a string
+hash_t hash_string(std::string_view s, hash_t seed)
+{
+	return hash_bytes(s.data(), s.size(), seed);
+}
+
+// hash an ordered list of strings, element boundaries are part of the hash
+hash_t hash_strings(const std::vector<std::string> &strings, hash_t seed)
+{
+	hash_t h = seed;
+	for (const std::string &s : strings)
+	{
+		h = hash_combine(h, hash_string(s));
+	}
+	return hash_combine(h, strings.size());
+}
+
+// mix a value into an existing hash, order dependent
+hash_t hash_combine(hash_t seed, hash_t value)
+{
+	hash_t mixed = (seed ^ value) * PRIME64_1;
+	mixed = rotl64(mixed, 31) * PRIME64_2;
+	return mixed ^ (mixed >> 29) ^ seed;
+}
+
+// 16 character lowercase hex representation of a hash
+std::string hash_to_string(hash_t hash)
+{
+	char buffer[17];
+	std::snprintf(buffer, sizeof(buffer), "%016llx",
+				  static_cast<unsigned long long>(hash));
+	return std::string(buffer, 16);
+}
+
+// read a whole file and hash its contents, empty if it cannot be read
+std::optional<hash_t> hash_file_contents(const fs::path &file)
+{
+	int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return std::nullopt;
+	}
+
+	struct stat st{};
+	if (::fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return std::nullopt;
+	}
+
+	std::vector<unsigned char> buffer(static_cast<std::size_t>(st.st_size));
+	std::size_t total = 0;
+	while (total < buffer.size())
+	{
+		ssize_t n = ::read(fd, buffer.data() + total, buffer.size() - total);
+		if (n < 0)
+		{
+			::close(fd);
+			return std::nullopt;
+		}
+		if (n == 0)
+		{
+			break;
+		}
+		total += static_cast<std::size_t>(n);
+	}
+	::close(fd);
+
+	return hash_bytes(buffer.data(), total);
+}
+
+// stat a file and return its identity, empty if the file does not exist
+std::optional<file_stamp> get_file_stamp(const fs::path &file)
+{
+	return get_file_stamp(file.c_str());
+}
+
+std::optional<file_stamp> get_file_stamp(const char *file)
+{
+	struct stat st{};
+	if (::stat(file, &st) != 0)
+	{
+		return std::nullopt;
+	}
+
+	file_stamp stamp;
+	stamp.device = static_cast<std::uint64_t>(st.st_dev);
+	stamp.inode = static_cast<std::uint64_t>(st.st_ino);
+	stamp.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) *
+						 1000000000LL +
+					 st.st_mtim.tv_nsec;
+	stamp.size = static_cast<std::uint64_t>(st.st_size);
+	return stamp;
+}
+
+bool is_racy(const file_stamp &stamp)
+{
+	return now_ns() - stamp.mtime_ns <= RACY_WINDOW_NS;
+}
+
+// Returns the content hash of a file, reading it only when its stamp
+// differs from the memoized one
+// Returns std::nullopt if the file does not exist or cannot be read
+std::optional<hash_t> hash_cache::hash_file(const fs::path &file)
+{
+	return hash_file(file.c_str());
+}
+
+// the same for a path that is not an fs::path yet, which is only made
+// when the file has to be read
+std::optional<hash_t> hash_cache::hash_file(const char *file)
+{
+	std::optional<file_stamp> stamp = get_file_stamp(file);
+	if (!stamp.has_value())
+	{
+		return std::nullopt;
+	}
+
+	inode_key key{ stamp->device, stamp->inode };
+	{
+		std::lock_guard<std::mutex> lock(entries_mtx);
+		auto it = entries.find(key);
+		if (it != entries.end() && it->second.stamp == *stamp)
+		{
+			it->second.used = true;
+			return it->second.hash;
+		}
+	}
+
+	std::optional<hash_t> hash = hash_file_contents(fs::path(file));
+	if (!hash.has_value())
+	{
+		return std::nullopt;
+	}
+
+	std::lock_guard<std::mutex> lock(entries_mtx);
+	if (!is_racy(*stamp))
+	{
+		entries[key] = entry{ *stamp, *hash, true };
+	}
+	else
+	{
+		entries.erase(key);
+	}
+	return hash;
+}
+
+// hash a list of files in parallel, results are in the same order as files
+std::vector<std::optional<hash_t>>
+hash_cache::hash_files(const std::vector<fs::path> &files)
+{
+	std::vector<std::optional<hash_t>> hashes(files.size());
+	parallel_for(files.size(),
+				 [&](std::size_t i) { hashes[i] = hash_file(files[i]); });
+	return hashes;
+}
+
+// Load memoized hashes written by save()
+// Returns false if the file is missing, was written in another format or
+// its size does not match the entry count it declares, in which case the
+// cache is left empty
+bool hash_cache::load(const fs::path &cache_file)
+{
+	{
+		std::lock_guard<std::mutex> lock(entries_mtx);
+		entries.clear();
+	}
+	std::ifstream input(cache_file, std::ios::binary);
+	if (!input)
+	{
+		return false;
+	}
+
+	char magic[8];
+	std::uint64_t count = 0;
+	input.read(magic, sizeof(magic));
+	input.read(reinterpret_cast<char *>(&count), sizeof(count));
+	if (!input || std::memcmp(magic, HASH_CACHE_MAGIC, sizeof(magic)) != 0)
+	{
+		return false;
+	}
+
+	// a truncated or corrupt count must not size the allocation below
+	std::error_code ec;
+	std::uintmax_t file_size = fs::file_size(cache_file, ec);
+	std::uint64_t record_bytes = 5 * sizeof(std::uint64_t);
+	if (ec || file_size < sizeof(magic) + sizeof(count) ||
+		(file_size - sizeof(magic) - sizeof(count)) / record_bytes != count ||
+		(file_size - sizeof(magic) - sizeof(count)) % record_bytes != 0)
+		return false;
+
+	std::vector<std::uint64_t> records(count * 5);
+	input.read(reinterpret_cast<char *>(records.data()),
+			   static_cast<std::streamsize>(records.size() * 8));
+	if (!input)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(entries_mtx);
+	entries.reserve(count);
+	for (std::size_t i = 0; i < records.size(); i += 5)
+	{
+		file_stamp stamp;
+		stamp.device = records[i];
+		stamp.inode = records[i + 1];
+		stamp.mtime_ns = static_cast<std::int64_t>(records[i + 2]);
+		stamp.size = records[i + 3];
+		entries[inode_key{ stamp.device, stamp.inode }] =
+			entry{ stamp, records[i + 4], false };
+	}
+	return true;
+}
+
+// Persist the hashes of every file looked up since the cache was loaded
+// Entries that were not used are dropped, which keeps deleted files from
+// accumulating; the file is replaced atomically
+bool hash_cache::save(const fs::path &cache_file) const
+{
+	std::vector<std::uint64_t> records;
+	{
+		std::lock_guard<std::mutex> lock(entries_mtx);
+		records.reserve(entries.size() * 5);
+		for (const auto &[key, e] : entries)
+		{
+			if (!e.used)
+			{
+				continue;
+			}
+			records.push_back(e.stamp.device);
+			records.push_back(e.stamp.inode);
+			records.push_back(static_cast<std::uint64_t>(e.stamp.mtime_ns));
+			records.push_back(e.stamp.size);
+			records.push_back(e.hash);
+		}
+	}
+
+	fs::path tmp_file = cache_file;
+	tmp_file += ".tmp";
+	{
+		std::ofstream output(tmp_file, std::ios::binary | std::ios::trunc);
+		if (!output)
+		{
+			return false;
+		}
+		std::uint64_t count = records.size() / 5;
+		output.write(HASH_CACHE_MAGIC, 8);
+		output.write(reinterpret_cast<const char *>(&count), sizeof(count));
+		output.write(reinterpret_cast<const char *>(records.data()),
+					 static_cast<std::streamsize>(records.size() * 8));
+		if (!output)
+		{
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(tmp_file, cache_file, ec);
+	return !ec;
+}
+
+// number of memoized files
+std::size_t hash_cache::size() const
+{
+	std::lock_guard<std::mutex> lock(entries_mtx);
+	return entries.size();
+}
+} // namespace coup
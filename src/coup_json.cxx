@@ -1,142 +1,915 @@
 /* coup_json.cxx */
 #include "../include/coup_json.hxx"
 
-#include <cassert>
+#include <algorithm>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <memory>
 #include <nlohmann/json.hpp>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
 
-#define REQUIRED                          \
-	"Required\n\t\"cpp\" (c++ version)"   \
-	"\n\t\"source\" (source directories)" \
-	"\n\t\"build\" (build directory)"
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_hash.hxx"
 
 #define MISSING_CONFIG              \
 	"No coup_config.json found in " \
 	"root directory"
 
-#define MISSING_FIELDS             \
-	"Required fields are missing " \
-	"from coup_config.json\n" REQUIRED
-
 #define CPP_PATH "/usr/bin/c++"
 
 #define EXE "a.out"
 
+#define DEFAULT_PROFILE "debug"
+
+// bumped whenever project_config changes
+#define SNAPSHOT_MAGIC "COUPCFG3"
+
+// recorded instead of the mtime of a config file written within the racy
+// window (see is_racy), no file has it
+#define RACY_MTIME_NS INT64_MIN
+
 namespace fs = std::filesystem;
 namespace coup
 {
-bool coup_json::meets_required() const noexcept
+namespace
+{
+// Reads the fields of coup_config.json into typed values, collecting
+// every missing or mistyped field instead of stopping at the first
+// where names the enclosing entry in messages, e.g. "tests"[1]
+class config_reader
 {
-	if (!config_contains("source")) 
+private:
+	std::vector<std::string> &errors;
+
+public:
+	explicit config_reader(std::vector<std::string> &errors_)
+		: errors(errors_)
+	{
+	}
+
+	void error(const std::string &where, const std::string &message)
+	{
+		errors.push_back(where.empty() ? message : where + ": " + message);
+	}
+
+	bool require(const nlohmann::json &object, const char *key,
+				 const std::string &where, const char *description)
+	{
+		if (object.contains(key))
+			return true;
+		error(where, "\"" + std::string(key) + "\" is required (" +
+						 description + ")");
 		return false;
-	else
-		return true;
+	}
+
+	void read(const nlohmann::json &object, const char *key,
+			  const std::string &where, std::string &value)
+	{
+		if (!object.contains(key))
+			return;
+		if (object[key].is_string())
+			value = object[key].get<std::string>();
+		else
+			error(where, "\"" + std::string(key) + "\" must be a string");
+	}
+
+	void read(const nlohmann::json &object, const char *key,
+			  const std::string &where, std::vector<std::string> &values)
+	{
+		if (!object.contains(key))
+			return;
+		const nlohmann::json &array = object[key];
+		if (!array.is_array() ||
+			!std::all_of(array.begin(), array.end(),
+						 [](const nlohmann::json &value)
+						 { return value.is_string(); }))
+		{
+			error(where, "\"" + std::string(key) +
+							 "\" must be an array of strings");
+			return;
+		}
+		values = array.get<std::vector<std::string>>();
+	}
+
+	void read(const nlohmann::json &object, const char *key,
+			  const std::string &where, bool &value)
+	{
+		if (!object.contains(key))
+			return;
+		if (object[key].is_boolean())
+			value = object[key].get<bool>();
+		else
+			error(where, "\"" + std::string(key) + "\" must be true or false");
+	}
+
+	// entries of an object field, each of which must be an object itself
+	std::vector<std::pair<std::string, const nlohmann::json *>>
+	entries(const nlohmann::json &object, const char *key)
+	{
+		std::vector<std::pair<std::string, const nlohmann::json *>> result;
+		if (!object.contains(key))
+			return result;
+		if (!object[key].is_object())
+		{
+			error("", "\"" + std::string(key) + "\" must be an object");
+			return result;
+		}
+		for (const auto &[name, entry] : object[key].items())
+		{
+			if (entry.is_object())
+				result.emplace_back(name, &entry);
+			else
+				error("\"" + std::string(key) + "\"." + name,
+					  "must be an object");
+		}
+		return result;
+	}
+};
+
+void write_u64(std::ofstream &output, std::uint64_t value)
+{
+	output.write(reinterpret_cast<const char *>(&value), sizeof(value));
 }
 
-// Throw an error related to an issue with
-// coup_config.json
+void write_string(std::ofstream &output, const std::string &s)
+{
+	write_u64(output, s.size());
+	output.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
 
-[[noreturn]] void coup_json::config_error(const char *e)
+void write_strings(std::ofstream &output,
+				   const std::vector<std::string> &strings)
 {
-	throw std::runtime_error(e);
+	write_u64(output, strings.size());
+	for (const std::string &s : strings)
+	{
+		write_string(output, s);
+	}
 }
 
-// Initializes the only class member (json object)
-// with coup_config.json that should be in the project's
-// root directory
-// The following errors could occur during initilization:
-//      - There is no coup_config.json in the root directory
-//      - The minimum required fields are not specified
-//        in the config file
+bool read_u64(std::ifstream &input, std::uint64_t &value)
+{
+	input.read(reinterpret_cast<char *>(&value), sizeof(value));
+	return static_cast<bool>(input);
+}
+
+bool read_string(std::ifstream &input, std::string &s)
+{
+	std::uint64_t size = 0;
+	if (!read_u64(input, size) || size > (1u << 24))
+	{
+		return false;
+	}
+	s.resize(size);
+	input.read(s.data(), static_cast<std::streamsize>(size));
+	return static_cast<bool>(input);
+}
+
+bool read_strings(std::ifstream &input, std::vector<std::string> &strings)
+{
+	std::uint64_t count = 0;
+	if (!read_u64(input, count) || count > (1u << 20))
+	{
+		return false;
+	}
+	strings.resize(count);
+	for (std::string &s : strings)
+	{
+		if (!read_string(input, s))
+			return false;
+	}
+	return true;
+}
+
+// what a snapshot was taken of: the config file's mtime, size and hash
+struct snapshot_key
+{
+	std::int64_t mtime_ns = 0;
+	std::uint64_t size = 0;
+	hash_t hash = 0;
+};
 
+// Snapshot layout: magic, key, then every field of project_config in
+// declaration order; strings are length-prefixed, vectors count-prefixed
+bool write_snapshot(const fs::path &snapshot_file, const snapshot_key &key,
+					const project_config &config)
+{
+	fs::path tmp_file = snapshot_file;
+	tmp_file += ".tmp";
+	{
+		std::ofstream output(tmp_file, std::ios::binary | std::ios::trunc);
+		if (!output)
+		{
+			return false;
+		}
+		output.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1);
+		write_u64(output, static_cast<std::uint64_t>(key.mtime_ns));
+		write_u64(output, key.size);
+		write_u64(output, key.hash);
+
+		write_strings(output, config.fields);
+		write_string(output, config.cpp_version);
+		write_string(output, config.compiler);
+		write_string(output, config.executable);
+		write_strings(output, config.source_directories);
+		write_string(output, config.build_directory);
+		write_strings(output, config.compile_flags);
+		write_strings(output, config.defines);
+		write_strings(output, config.include_directories);
+		write_strings(output, config.link_flags);
+		write_string(output, config.default_profile);
+		write_string(output, config.remote_cache);
+		write_strings(output, config.workers);
+		write_u64(output, config.modules);
+		write_string(output, config.staging);
+		write_u64(output, config.profiles.size());
+		for (const build_profile &profile : config.profiles)
+		{
+			write_string(output, profile.name);
+			write_strings(output, profile.compile_flags);
+			write_strings(output, profile.defines);
+			write_strings(output, profile.link_flags);
+		}
+		write_u64(output, config.test_targets.size());
+		for (const test_target &target : config.test_targets)
+		{
+			write_string(output, target.name);
+			write_strings(output, target.source_directories);
+			write_strings(output, target.link_flags);
+			write_strings(output, target.exclude);
+		}
+		write_u64(output, config.overrides.size());
+		for (const config_override &entry : config.overrides)
+		{
+			write_string(output, entry.prefix.string());
+			write_strings(output, entry.compile_flags);
+			write_strings(output, entry.defines);
+			write_strings(output, entry.include_directories);
+		}
+		write_u64(output, config.dependencies.size());
+		for (const package_dependency &dependency : config.dependencies)
+		{
+			write_string(output, dependency.name);
+			write_string(output, dependency.prefix);
+			write_strings(output, dependency.libs);
+		}
+		if (!output)
+		{
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(tmp_file, snapshot_file, ec);
+	return !ec;
+}
+
+// Returns false if the snapshot is missing, truncated or was written by a
+// different version of coup
+bool read_snapshot(const fs::path &snapshot_file, snapshot_key &key,
+				   project_config &config)
+{
+	std::ifstream input(snapshot_file, std::ios::binary);
+	char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+	if (!input.read(magic, sizeof(magic)) ||
+		std::string_view(magic, sizeof(magic)) != SNAPSHOT_MAGIC)
+	{
+		return false;
+	}
+
+	std::uint64_t mtime_ns = 0, modules = 0, count = 0;
+	if (!read_u64(input, mtime_ns) || !read_u64(input, key.size) ||
+		!read_u64(input, key.hash))
+		return false;
+	key.mtime_ns = static_cast<std::int64_t>(mtime_ns);
+
+	if (!read_strings(input, config.fields) ||
+		!read_string(input, config.cpp_version) ||
+		!read_string(input, config.compiler) ||
+		!read_string(input, config.executable) ||
+		!read_strings(input, config.source_directories) ||
+		!read_string(input, config.build_directory) ||
+		!read_strings(input, config.compile_flags) ||
+		!read_strings(input, config.defines) ||
+		!read_strings(input, config.include_directories) ||
+		!read_strings(input, config.link_flags) ||
+		!read_string(input, config.default_profile) ||
+		!read_string(input, config.remote_cache) ||
+		!read_strings(input, config.workers) || !read_u64(input, modules) ||
+		!read_string(input, config.staging))
+		return false;
+	config.modules = modules != 0;
+
+	if (!read_u64(input, count) || count > (1u << 20))
+		return false;
+	config.profiles.resize(count);
+	for (build_profile &profile : config.profiles)
+	{
+		if (!read_string(input, profile.name) ||
+			!read_strings(input, profile.compile_flags) ||
+			!read_strings(input, profile.defines) ||
+			!read_strings(input, profile.link_flags))
+			return false;
+	}
+	if (!read_u64(input, count) || count > (1u << 20))
+		return false;
+	config.test_targets.resize(count);
+	for (test_target &target : config.test_targets)
+	{
+		if (!read_string(input, target.name) ||
+			!read_strings(input, target.source_directories) ||
+			!read_strings(input, target.link_flags) ||
+			!read_strings(input, target.exclude))
+			return false;
+	}
+	if (!read_u64(input, count) || count > (1u << 20))
+		return false;
+	config.overrides.resize(count);
+	for (config_override &entry : config.overrides)
+	{
+		std::string prefix;
+		if (!read_string(input, prefix) ||
+			!read_strings(input, entry.compile_flags) ||
+			!read_strings(input, entry.defines) ||
+			!read_strings(input, entry.include_directories))
+			return false;
+		entry.prefix = prefix;
+	}
+	if (!read_u64(input, count) || count > (1u << 20))
+		return false;
+	config.dependencies.resize(count);
+	for (package_dependency &dependency : config.dependencies)
+	{
+		if (!read_string(input, dependency.name) ||
+			!read_string(input, dependency.prefix) ||
+			!read_strings(input, dependency.libs))
+			return false;
+	}
+	return true;
+}
+
+// Looks for a snapshot named snapshot_name in the directories directly
+// below root, taking the first one that is in the build directory it names
+bool find_snapshot(const fs::path &root, const std::string &snapshot_name,
+				   fs::path &snapshot_file, snapshot_key &key,
+				   project_config &config)
+{
+	fs::path directory = root.empty() ? fs::path(".") : root;
+	std::error_code ec;
+	for (fs::directory_iterator it(directory, ec), end; !ec && it != end;
+		 it.increment(ec))
+	{
+		snapshot_file = it->path() / snapshot_name;
+		if (it->is_directory(ec) && read_snapshot(snapshot_file, key, config) &&
+			fs::equivalent(it->path(), directory / config.build_directory, ec))
+		{
+			return true;
+		}
+		config = project_config();
+	}
+	return false;
+}
+} // namespace
+
+// Parses and validates the contents of coup_config.json
+// Every problem is reported at once: a missing required field ("cpp",
+// "source", "build"), a field of the wrong type, a test without name or
+// source, or a default profile that does not exist
+// Unknown fields are ignored
+// Throws std::runtime_error listing the problems, one per line
+project_config parse_project_config(const std::string &contents)
+{
+	nlohmann::json json;
+	try
+	{
+		json = nlohmann::json::parse(contents);
+	}
+	catch (const nlohmann::json::parse_error &e)
+	{
+		throw std::runtime_error(
+			std::string("coup_config.json is not valid JSON: ") + e.what());
+	}
+	if (!json.is_object())
+	{
+		throw std::runtime_error("coup_config.json must hold a JSON object");
+	}
+
+	std::vector<std::string> errors;
+	config_reader reader(errors);
+	project_config config;
+	for (const auto &[field, value] : json.items())
+	{
+		config.fields.push_back(field);
+	}
+	config.compiler = CPP_PATH;
+	config.executable = EXE;
+	config.default_profile = DEFAULT_PROFILE;
+
+	reader.require(json, "cpp", "", "c++ version");
+	reader.require(json, "source", "", "source directories");
+	reader.require(json, "build", "", "build directory");
+	reader.read(json, "cpp", "", config.cpp_version);
+	reader.read(json, "compiler", "", config.compiler);
+	reader.read(json, "executable", "", config.executable);
+	reader.read(json, "source", "", config.source_directories);
+	reader.read(json, "build", "", config.build_directory);
+	reader.read(json, "compile_flags", "", config.compile_flags);
+	reader.read(json, "defines", "", config.defines);
+	reader.read(json, "include", "", config.include_directories);
+	reader.read(json, "link_flags", "", config.link_flags);
+	reader.read(json, "default_profile", "", config.default_profile);
+	reader.read(json, "remote_cache", "", config.remote_cache);
+	reader.read(json, "workers", "", config.workers);
+	reader.read(json, "modules", "", config.modules);
+	reader.read(json, "staging", "", config.staging);
+
+	for (const auto &[name, entry] : reader.entries(json, "profiles"))
+	{
+		std::string where = "\"profiles\"." + name;
+		build_profile profile;
+		profile.name = name;
+		reader.read(*entry, "compile_flags", where, profile.compile_flags);
+		reader.read(*entry, "defines", where, profile.defines);
+		reader.read(*entry, "link_flags", where, profile.link_flags);
+		config.profiles.push_back(std::move(profile));
+	}
+
+	if (json.contains("tests") && !json["tests"].is_array())
+	{
+		reader.error("", "\"tests\" must be an array");
+	}
+	else if (json.contains("tests"))
+	{
+		for (std::size_t i = 0; i < json["tests"].size(); ++i)
+		{
+			const nlohmann::json &entry = json["tests"][i];
+			std::string where = "\"tests\"[" + std::to_string(i) + "]";
+			if (!entry.is_object())
+			{
+				reader.error(where, "must be an object");
+				continue;
+			}
+			test_target target;
+			reader.require(entry, "name", where, "name of the test binary");
+			reader.require(entry, "source", where, "test source directories");
+			reader.read(entry, "name", where, target.name);
+			reader.read(entry, "source", where, target.source_directories);
+			reader.read(entry, "link_flags", where, target.link_flags);
+			reader.read(entry, "exclude", where, target.exclude);
+			config.test_targets.push_back(std::move(target));
+		}
+	}
+
+	for (const auto &[key, entry] : reader.entries(json, "overrides"))
+	{
+		std::string where = "\"overrides\"." + key;
+		config_override override_entry;
+		override_entry.prefix = fs::path(key).lexically_normal();
+		if (!override_entry.prefix.has_filename())
+			override_entry.prefix = override_entry.prefix.parent_path();
+		reader.read(*entry, "compile_flags", where,
+					override_entry.compile_flags);
+		reader.read(*entry, "defines", where, override_entry.defines);
+		reader.read(*entry, "include", where,
+					override_entry.include_directories);
+		config.overrides.push_back(std::move(override_entry));
+	}
+
+	for (const auto &[name, entry] : reader.entries(json, "dependencies"))
+	{
+		std::string where = "\"dependencies\"." + name;
+		package_dependency dependency;
+		dependency.name = name;
+		reader.read(*entry, "prefix", where, dependency.prefix);
+		reader.read(*entry, "libs", where, dependency.libs);
+		config.dependencies.push_back(std::move(dependency));
+	}
+
+	const std::string &default_profile = config.default_profile;
+	if (default_profile != "debug" && default_profile != "release" &&
+		default_profile != "asan" &&
+		std::none_of(config.profiles.begin(), config.profiles.end(),
+					 [&](const build_profile &profile)
+					 { return profile.name == default_profile; }))
+	{
+		reader.error("", "\"default_profile\" names no profile: " +
+							 default_profile);
+	}
+
+	if (!errors.empty())
+	{
+		std::string message = "Invalid coup_config.json";
+		for (const std::string &error : errors)
+			message += "\n\t" + error;
+		throw std::runtime_error(message);
+	}
+	return config;
+}
+
+coup_json::coup_json(project_config config_, std::uint64_t content_hash_)
+	: config(std::make_shared<const project_config>(std::move(config_))),
+	  content_hash(content_hash_)
+{
+}
+
+// Parses coup_config.json that should be in the project's root directory
+// Throws std::runtime_error if there is no such file or it is invalid
+// (see parse_project_config)
 coup_json::coup_json(const fs::path &config_file)
 {
 	if (!fs::exists(config_file))
-		config_error(MISSING_CONFIG);
+		throw std::runtime_error(MISSING_CONFIG);
 
-	std::ifstream input(config_file);
-	input >> config;
+	std::string contents = file_contents(config_file);
+	config = std::make_shared<const project_config>(
+		parse_project_config(contents));
+	content_hash = hash_string(contents);
+}
 
-	if (!meets_required())
-		config_error(MISSING_FIELDS);
+// Loads coup_config.json through its snapshot, a binary copy of the parsed
+// configuration that needs no JSON parsing, kept as snapshot_name in the
+// build directory
+// The build directory is only known from the configuration, so the snapshot
+// is looked for in the directories directly below the config file's; with a
+// build directory nested deeper or outside of it the config is parsed on
+// every run
+// The snapshot is used while the config file keeps the mtime and size it
+// was taken at, or else while the contents hash to the same value; it is
+// (re)written whenever it was not used as is
+// Throws std::runtime_error if there is no config file or it is invalid
+coup_json coup_json::load(const fs::path &config_file,
+						  const std::string &snapshot_name)
+{
+	std::optional<file_stamp> stamp = get_file_stamp(config_file);
+	if (!stamp.has_value())
+		throw std::runtime_error(MISSING_CONFIG);
+
+	fs::path root = config_file.parent_path();
+	fs::path snapshot_file;
+	snapshot_key key;
+	project_config snapshot;
+	bool has_snapshot =
+		find_snapshot(root, snapshot_name, snapshot_file, key, snapshot);
+	if (has_snapshot && key.mtime_ns == stamp->mtime_ns &&
+		key.size == stamp->size)
+	{
+		return coup_json(std::move(snapshot), key.hash);
+	}
+
+	std::string contents = file_contents(config_file);
+	hash_t hash = hash_string(contents);
+	project_config config = has_snapshot && key.hash == hash
+								? std::move(snapshot)
+								: parse_project_config(contents);
+
+	// a snapshot that cannot be written only costs the next run a parse
+	fs::path build_directory = root / config.build_directory;
+	std::error_code ec;
+	fs::create_directories(build_directory, ec);
+	if (has_snapshot &&
+		!fs::equivalent(snapshot_file.parent_path(), build_directory, ec))
+	{
+		fs::remove(snapshot_file, ec);
+	}
+	// a config file written this recently may change again without its
+	// stamp changing, so the next load has to hash it again
+	std::int64_t mtime_ns = is_racy(*stamp) ? RACY_MTIME_NS : stamp->mtime_ns;
+	write_snapshot(build_directory / snapshot_name,
+				   { mtime_ns, stamp->size, hash }, config);
+	return coup_json(std::move(config), hash);
 }
 
-// default constructor
-coup_json::coup_json() = default;
+// default constructor, an empty configuration
+coup_json::coup_json() : config(std::make_shared<const project_config>())
+{
+}
 
 // destructor
 coup_json::~coup_json() = default;
 
 // copy constructor
 coup_json::coup_json(const coup_json& other)
-    : config(other.config)
+    : config(other.config), content_hash(other.content_hash)
 {}
 
 // move constructor
-coup_json::coup_json(coup_json&& other) noexcept
-    : config(std::move(other.config))
-{}
+coup_json::coup_json(coup_json&& other) noexcept = default;
 
 // copy-assignment operator
 coup_json& coup_json::operator=(const coup_json& other)
 {
     if (this != &other)
+    {
         config = other.config;
+        content_hash = other.content_hash;
+    }
     return *this;
 }
 
 // move-assignment operator
-coup_json& coup_json::operator=(coup_json&& other) noexcept
+coup_json& coup_json::operator=(coup_json&& other) noexcept = default;
+
+// hash of the contents of coup_config.json, 0 for an empty configuration
+std::uint64_t coup_json::get_content_hash() const noexcept
 {
-    if (this != &other)
-        config = std::move(other.config);
-    return *this;
+	return content_hash;
 }
 
-std::string coup_json::get_cpp_version() const noexcept
+const std::string &coup_json::get_cpp_version() const noexcept
 {
-	return config["cpp"];
+	return config->cpp_version;
 }
 
-std::string coup_json::get_compiler() const noexcept
+const std::string &coup_json::get_compiler() const noexcept
 {
-	return get_entry_or("compiler", std::string(CPP_PATH));
+	return config->compiler;
 }
 
-std::string coup_json::get_executable() const noexcept
+const std::string &coup_json::get_executable() const noexcept
 {
-	return get_entry_or("executable", std::string(EXE));
+	return config->executable;
 }
 
-std::vector<std::string> 
+const std::vector<std::string> &
 coup_json::get_source_directories() const noexcept
 {
-	return config["source"];
+	return config->source_directories;
+}
+
+const std::string &coup_json::get_build_directory() const noexcept
+{
+	return config->build_directory;
+}
+
+const std::vector<std::string> &coup_json::get_compile_flags() const noexcept
+{
+	return config->compile_flags;
+}
+
+const std::vector<std::string> &coup_json::get_defines() const noexcept
+{
+	return config->defines;
+}
+
+const std::vector<std::string> &
+coup_json::get_include_directories() const noexcept
+{
+	return config->include_directories;
+}
+
+const std::vector<std::string> &coup_json::get_link_flags() const noexcept
+{
+	return config->link_flags;
+}
+
+// link flags of the configuration followed by those of a profile
+std::vector<std::string>
+coup_json::get_link_flags(const build_profile &profile) const noexcept
+{
+	std::vector<std::string> link_flags = get_link_flags();
+	link_flags.insert(link_flags.end(), profile.link_flags.begin(),
+					  profile.link_flags.end());
+	return link_flags;
+}
+
+const std::string &coup_json::get_default_profile() const noexcept
+{
+	return config->default_profile;
+}
+
+// URL of the shared cache of compiled objects, e.g.
+//      "remote_cache": "http://cache.example.com:8080"
+// empty if the project does not use one
+const std::string &coup_json::get_remote_cache() const noexcept
+{
+	return config->remote_cache;
+}
+
+// coup-worker processes compiles are distributed to, e.g.
+//      "workers": ["build1:7070", "unix:/tmp/coup-worker.sock"]
+const std::vector<std::string> &coup_json::get_workers() const noexcept
+{
+	return config->workers;
+}
+
+// "modules": true scans sources for C++20 modules, so module interfaces
+// are compiled before the sources importing them
+bool coup_json::get_modules() const noexcept
+{
+	return config->modules;
+}
+
+// RAM-backed directory compiler outputs are written to before they are
+// published into the build directory, e.g.
+//      "staging": "/dev/shm"
+// empty if compilers write into the build directory
+const std::string &coup_json::get_staging() const noexcept
+{
+	return config->staging;
+}
+
+// Returns the named profile from the "profiles" object of coup_config.json
+// debug, release and asan are always available and can be redefined there
+// Throws std::runtime_error if no profile with that name exists
+build_profile coup_json::get_profile(const std::string &name) const
+{
+	for (const build_profile &declared : config->profiles)
+	{
+		if (declared.name == name)
+			return declared;
+	}
+
+	build_profile profile;
+	profile.name = name;
+	if (name == "debug")
+	{
+		profile.compile_flags = { "-g", "-O0" };
+	}
+	else if (name == "release")
+	{
+		profile.compile_flags = { "-O2" };
+		profile.defines = { "NDEBUG" };
+	}
+	else if (name == "asan")
+	{
+		profile.compile_flags = { "-g", "-O1", "-fno-omit-frame-pointer",
+								  "-fsanitize=address,undefined" };
+		profile.link_flags = { "-fsanitize=address,undefined" };
+	}
+	else
+	{
+		throw std::runtime_error("Unknown profile '" + name + "'");
+	}
+	return profile;
+}
+
+// names of the built-in profiles and of those declared in coup_config.json,
+// sorted
+std::vector<std::string> coup_json::get_profile_names() const
+{
+	std::vector<std::string> names = { "asan", "debug", "release" };
+	for (const build_profile &profile : config->profiles)
+	{
+		if (std::find(names.begin(), names.end(), profile.name) == names.end())
+			names.push_back(profile.name);
+	}
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+// Returns the test executables declared in coup_config.json, e.g.
+//      "tests": [ { "name": "unit", "source": ["tests"],
+//                   "link_flags": ["-lgtest", "-lgtest_main"],
+//                   "exclude": ["src/main.cxx"] } ]
+const std::vector<test_target> &coup_json::get_test_targets() const noexcept
+{
+	return config->test_targets;
+}
+
+// Returns the external libraries declared in coup_config.json, e.g.
+//      "dependencies": { "zlib": {},
+//                        "foo": { "prefix": "/opt/foo", "libs": ["foo"] } }
+const std::vector<package_dependency> &
+coup_json::get_dependencies() const noexcept
+{
+	return config->dependencies;
+}
+
+// returns true if path is equal to prefix or nested somewhere below it
+static bool path_has_prefix(const fs::path &path, const fs::path &prefix)
+{
+	auto [path_it, prefix_it] = std::mismatch(path.begin(), path.end(),
+											  prefix.begin(), prefix.end());
+	return prefix_it == prefix.end();
 }
 
-std::string coup_json::get_build_directory() const noexcept
+// Resolve the compile options for a source file without a profile
+compile_options coup_json::get_compile_options(const fs::path &source_file) const
 {
-	return config["build"];
+	return get_compile_options(source_file, build_profile{});
 }
 
-const std::vector<std::string>&
-coup_json::get_compile_flags() const noexcept
+// Resolve the compile options for a source file (relative to the root)
+// Starts from the top-level settings, appends the flags and defines of
+// the profile, then appends the settings of every
+// entry in "overrides" whose key is a directory containing the file or
+// the file itself, least specific first, e.g.
+//      "overrides": {
+//          "src/legacy": { "compile_flags": ["-Wno-deprecated"] },
+//          "src/legacy/parser.cxx": { "defines": ["PARSER_DEBUG"] }
+//      }
+compile_options
+coup_json::get_compile_options(const fs::path &source_file,
+							   const build_profile &profile) const
 {
-    std::vector<std::string> compile_flags;
-	return get_entry_or("compile_flags", compile_flags);
+	compile_options options;
+	options.compiler = get_compiler();
+	options.cpp_standard = get_cpp_version();
+	options.flags = get_compile_flags();
+	options.defines = get_defines();
+	options.include_directories = get_include_directories();
+
+	options.flags.insert(options.flags.end(), profile.compile_flags.begin(),
+						 profile.compile_flags.end());
+	options.defines.insert(options.defines.end(), profile.defines.begin(),
+						   profile.defines.end());
+
+	fs::path source = source_file.lexically_normal();
+	std::vector<const config_override *> matches;
+	for (const config_override &entry : config->overrides)
+	{
+		if (path_has_prefix(source, entry.prefix))
+			matches.push_back(&entry);
+	}
+
+	std::stable_sort(matches.begin(), matches.end(),
+					 [](const config_override *a, const config_override *b)
+					 {
+						 return std::distance(a->prefix.begin(),
+											  a->prefix.end()) <
+								std::distance(b->prefix.begin(),
+											  b->prefix.end());
+					 });
+
+	for (const config_override *entry : matches)
+	{
+		auto append = [](std::vector<std::string> &values,
+						 const std::vector<std::string> &entries)
+		{ values.insert(values.end(), entries.begin(), entries.end()); };
+		append(options.flags, entry->compile_flags);
+		append(options.defines, entry->defines);
+		append(options.include_directories, entry->include_directories);
+	}
+	return options;
 }
 
+// the configuration with every default filled in, as JSON
 std::string coup_json::dump(int tab_width) const noexcept
 {
-	return config.dump(tab_width);
+	nlohmann::json json = {
+		{ "cpp", config->cpp_version },
+		{ "compiler", config->compiler },
+		{ "executable", config->executable },
+		{ "source", config->source_directories },
+		{ "build", config->build_directory },
+		{ "compile_flags", config->compile_flags },
+		{ "defines", config->defines },
+		{ "include", config->include_directories },
+		{ "link_flags", config->link_flags },
+		{ "default_profile", config->default_profile },
+		{ "remote_cache", config->remote_cache },
+		{ "workers", config->workers },
+		{ "modules", config->modules },
+		{ "staging", config->staging },
+		{ "profiles", nlohmann::json::object() },
+		{ "tests", nlohmann::json::array() },
+		{ "overrides", nlohmann::json::object() },
+		{ "dependencies", nlohmann::json::object() }
+	};
+	for (const build_profile &profile : config->profiles)
+	{
+		json["profiles"][profile.name] = {
+			{ "compile_flags", profile.compile_flags },
+			{ "defines", profile.defines },
+			{ "link_flags", profile.link_flags }
+		};
+	}
+	for (const test_target &target : config->test_targets)
+	{
+		json["tests"].push_back({ { "name", target.name },
+								  { "source", target.source_directories },
+								  { "link_flags", target.link_flags },
+								  { "exclude", target.exclude } });
+	}
+	for (const config_override &entry : config->overrides)
+	{
+		json["overrides"][entry.prefix.string()] = {
+			{ "compile_flags", entry.compile_flags },
+			{ "defines", entry.defines },
+			{ "include", entry.include_directories }
+		};
+	}
+	for (const package_dependency &dependency : config->dependencies)
+	{
+		json["dependencies"][dependency.name] = {
+			{ "prefix", dependency.prefix }, { "libs", dependency.libs }
+		};
+	}
+	return json.dump(tab_width);
 }
 
+// true if the field is set in coup_config.json
 bool coup_json::contains(const char *key) const noexcept
 {
-    return config.contains(key);
+	return std::find(config->fields.begin(), config->fields.end(), key) !=
+		   config->fields.end();
 }
 
 } // namespace coup
@@ -1,15 +1,25 @@
 #include "../include/coup_logger.hxx"
 
+#include <algorithm>
 #include <cassert>
+#include <ctime>
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
 
 #include "../include/coup_filesystem.hxx"
 #include "../include/coup_system.hxx"
 
+// redraws of the status line per second
+#define PROGRESS_REDRAW_HZ 10
+
 namespace fs = std::filesystem;
 namespace coup
 {
@@ -21,11 +31,29 @@ namespace coup
 void print_usage()
 {
 	std::cerr
-		<< "Usage: ./coup <command> <option>\nCommands:\n"
-		<< "  build: Compile and link source files into executable\n"
-		<< "  run: Complete build step and run executable\n"
-		<< "  clean: Remove build artifacts\n"
-		<< "Options:\n  verbose: Enable verbose ouput during command execution\n";
+		<< "Usage: ./coup <command> [files] <option> [-- program arguments]\n"
+		<< "Commands:\n"
+		<< "  build: Compile and link source files into executable "
+		<< "(--profile-compiles: report where compile time goes)\n"
+		<< "  run: Bring executable up to date and run it with the arguments "
+		<< "after --\n"
+		<< "  test: Build the test targets and run the tests that changed "
+		<< "(--affected: only targets affected since their last green run)\n"
+		<< "  clean: Remove build artifacts of the profile "
+		<< "(--stale: only objects without a source, --all: every profile)\n"
+		<< "  affected <file>...: List the sources a change to the files "
+		<< "recompiles\n"
+		<< "  why <source> <header>: Show the includes through which the "
+		<< "source depends on the header\n"
+		<< "  stats: Show the last builds and what got slower in the latest\n"
+		<< "  compdb: Write compile_commands.json to the build directory "
+		<< "(also done by every build)\n"
+		<< "  generate ninja: Write build.ninja for every profile to the build "
+		<< "directory\n"
+		<< "Options:\n  verbose: Enable verbose ouput during command execution\n"
+		<< "  --profile=<name>: Build with a profile from coup_config.json "
+		<< "(debug, release, asan, ...)\n"
+		<< "  --events=<file|fd>: Write build events as JSON lines\n";
 }
 
 // Error logging for generally occuring errors
@@ -53,6 +81,132 @@ void print_compile(std::string_view src_name, std::string_view compile_command,
 	}
 }
 
+build_progress::build_progress(int total_, double total_cost_,
+							   bool verbose_output_)
+	: interactive(!verbose_output_ && isatty(STDOUT_FILENO))
+	, verbose_output(verbose_output_)
+	, total(total_)
+	, total_cost(total_cost_)
+	, start(std::chrono::steady_clock::now())
+{
+	if (interactive && total > 0)
+	{
+		redraw_thread = std::thread(&build_progress::redraw_loop, this);
+	}
+}
+
+build_progress::~build_progress()
+{
+	{
+		std::lock_guard<std::mutex> lock(output_mtx);
+		stopping = true;
+	}
+	stop_cv.notify_one();
+	if (redraw_thread.joinable())
+	{
+		redraw_thread.join();
+	}
+	std::lock_guard<std::mutex> lock(output_mtx);
+	clear_status();
+}
+
+void build_progress::redraw_loop()
+{
+	std::unique_lock<std::mutex> lock(output_mtx);
+	while (!stopping)
+	{
+		draw_status();
+		stop_cv.wait_for(lock,
+						 std::chrono::milliseconds(1000 / PROGRESS_REDRAW_HZ));
+	}
+}
+
+// e.g. [4 running] 12/40 compiled, 38% of work, 3.1/s, ETA 7s
+// expects output_mtx to be held
+void build_progress::draw_status()
+{
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	int done = completed;
+	double done_cost = completed_cost_us / 1e6;
+	double fraction = total_cost > 0.0 ? std::min(done_cost / total_cost, 1.0)
+									   : static_cast<double>(done) / total;
+
+	std::ostringstream status;
+	status << std::fixed << std::setprecision(1) << "[" << running
+		   << " running] " << done << "/" << total << " compiled, "
+		   << static_cast<int>(100.0 * fraction) << "% of work, "
+		   << done / std::max(elapsed.count(), 1e-3) << "/s";
+	if (fraction > 0.0)
+	{
+		status << ", ETA "
+			   << static_cast<int>(elapsed.count() * (1.0 - fraction) /
+								   fraction)
+			   << "s";
+	}
+
+	std::string line = status.str();
+	struct winsize window;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_col > 1 &&
+		line.size() >= window.ws_col)
+	{
+		line.resize(window.ws_col - 1);
+	}
+	std::cout << "\r" << line << "\x1b[K" << std::flush;
+	status_shown = true;
+}
+
+// expects output_mtx to be held
+void build_progress::clear_status()
+{
+	if (status_shown)
+	{
+		std::cout << "\r\x1b[K" << std::flush;
+		status_shown = false;
+	}
+}
+
+// Count a compile as running, printing it unless the status line shows it
+void build_progress::start_job(std::string_view src_name,
+							   std::string_view compile_command)
+{
+	int count = ++started;
+	running++;
+	if (!interactive)
+	{
+		std::lock_guard<std::mutex> lock(output_mtx);
+		print_compile(src_name, compile_command, count, total, verbose_output);
+	}
+}
+
+// Count a compile as done, with the cost it was expected to have
+void build_progress::finish_job(double expected_cost)
+{
+	completed_cost_us += static_cast<std::uint64_t>(expected_cost * 1e6);
+	completed++;
+	running--;
+}
+
+// Print the captured output of a compiler above the status line
+void build_progress::print_output(std::string_view output)
+{
+	if (output.empty())
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(output_mtx);
+	clear_status();
+	print_process_output(output);
+}
+
+void build_progress::print_error(const std::string &error_message)
+{
+	std::lock_guard<std::mutex> lock(output_mtx);
+	clear_status();
+	std::cout << std::flush;
+	coup::print_error(error_message);
+}
+
 /*  Print log message indicating a linkage step occuring
  *  If verbose output is enabled, provide link command used
  */
@@ -72,16 +226,15 @@ void print_link(const std::string &exec_name, std::string_view link_command,
 
 /*  Print log message indicating a file removal during a clean
  *  If verbose output is enabled, provide current removed out of total
- *  file removals, and provide remove command used to delete file
+ *  file removals
  */
-void print_remove(std::string_view file_name, std::string_view rm_command,
-				  int log_count, int log_total, bool verbose_output)
+void print_remove(std::string_view file_name, int log_count, int log_total,
+				  bool verbose_output)
 {
 	if (verbose_output)
 	{
-		std::cout << "[" << log_count++ << "/" << log_total << "] Removing "
+		std::cout << "[" << log_count << "/" << log_total << "] Removing "
 				  << file_name << "\n";
-		std::cout << "  $ " << rm_command << "\n";
 	}
 	else
 	{
@@ -89,6 +242,154 @@ void print_remove(std::string_view file_name, std::string_view rm_command,
 	}
 }
 
+/*  Print the outcome of a single test
+ *  Failures are always printed, passing and cached tests only with
+ *  verbose output enabled
+ */
+void print_test(std::string_view test_name, bool passed, double runtime,
+				bool cached, bool verbose_output)
+{
+	if (!passed)
+	{
+		std::cout << "FAILED " << test_name << " (" << runtime << "s)\n";
+	}
+	else if (verbose_output && cached)
+	{
+		std::cout << "Cached " << test_name << "\n";
+	}
+	else if (verbose_output)
+	{
+		std::cout << "Passed " << test_name << " (" << runtime << "s)\n";
+	}
+}
+
+// Print the captured output of a compiler or failed test process
+void print_process_output(std::string_view output)
+{
+	std::cout << output;
+	if (!output.empty() && output.back() != '\n')
+	{
+		std::cout << "\n";
+	}
+}
+
+// Print how many tests passed, failed, or were skipped as cached, and how
+// many test targets `coup test --affected` skipped
+void print_test_summary(int passed, int failed, int cached, int skipped)
+{
+	std::cout << passed << " passed, " << failed << " failed, " << cached
+			  << " cached";
+	if (skipped > 0)
+	{
+		std::cout << ", " << skipped << " target"
+				  << (skipped == 1 ? "" : "s") << " skipped (unaffected)";
+	}
+	std::cout << "\n";
+}
+
+// Print a source that a change recompiles and its last compile time
+void print_affected(std::string_view source_name, double compile_time)
+{
+	std::cout << source_name << " (" << compile_time << "s)\n";
+}
+
+// Print how many sources a change recompiles and how long that takes
+void print_affected_summary(int count, double compile_time,
+							double estimated_time, unsigned int num_jobs)
+{
+	std::cout << count << " translation units, " << compile_time
+			  << "s of compile time, about " << estimated_time << "s with "
+			  << num_jobs << " jobs\n";
+}
+
+// Print an include chain, each file included by the one above it
+void print_include_chain(const std::vector<std::string> &chain)
+{
+	for (std::size_t i = 0; i < chain.size(); ++i)
+	{
+		std::cout << std::string(2 * i, ' ') << chain[i] << "\n";
+	}
+}
+
+// Print one section of the compile time report, skipped if it is empty
+void print_time_entries(std::string_view title,
+						const std::vector<time_entry> &entries)
+{
+	if (entries.empty())
+	{
+		return;
+	}
+	std::cout << title << ":\n";
+	for (const time_entry &entry : entries)
+	{
+		std::cout << "  " << entry.seconds << "s";
+		if (entry.count > 1)
+		{
+			std::cout << " (" << entry.count << "x)";
+		}
+		std::cout << "  " << entry.name << "\n";
+	}
+}
+
+// Print one recorded build: when, how long each phase took, how many
+// objects were reused, the jobs used and the peak compiler memory
+void print_build_metrics(const build_metrics &metrics)
+{
+	std::time_t timestamp = static_cast<std::time_t>(metrics.timestamp);
+	std::tm local_time;
+	localtime_r(&timestamp, &local_time);
+	int reused = metrics.num_sources - metrics.num_compiled;
+	int hit_rate =
+		metrics.num_sources > 0 ? 100 * reused / metrics.num_sources : 100;
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(3)
+		 << std::put_time(&local_time, "%F %T") << "  " << metrics.total_time
+		 << "s (check " << metrics.check_time << "s, compile "
+		 << metrics.compile_time << "s, link " << metrics.link_time
+		 << "s)  " << metrics.num_compiled << "/" << metrics.num_sources
+		 << " compiled, " << hit_rate << "% reused, " << metrics.num_jobs
+		 << " jobs, " << metrics.peak_rss_kb / 1024 << " MiB peak\n";
+	std::cout << line.str();
+}
+
+// Print what got slower than its baseline, or that nothing did
+void print_regressions(const std::vector<regression> &regressions)
+{
+	if (regressions.empty())
+	{
+		std::cout << "No regressions in the latest build\n";
+		return;
+	}
+	std::cout << "Regressions in the latest build:\n";
+	for (const regression &r : regressions)
+	{
+		std::cout << "  " << r.name << ": " << r.seconds << "s, baseline "
+				  << r.baseline << "s (+"
+				  << static_cast<int>(100.0 * (r.seconds / r.baseline - 1.0))
+				  << "%)\n";
+	}
+}
+
+// Print a generated file and whether it had to be rewritten
+void print_generated(std::string_view file_name, bool written)
+{
+	std::cout << (written ? "Wrote " : "Unchanged ") << file_name << "\n";
+}
+
+// Print how many out of date objects came from the remote cache
+void print_remote_fetch(int fetched, int looked_up)
+{
+	std::cout << "Fetched " << fetched << "/" << looked_up
+			  << " objects from the remote cache\n";
+}
+
+// Print the remote slots a build distributes to
+void print_workers(int slots, int reachable, int configured)
+{
+	std::cout << "Distributing to " << slots << " remote slots on "
+			  << reachable << "/" << configured << " workers\n";
+}
+
 /*  Determine which command executed successfully and delegate
  *  logging to the matching function
  */
@@ -106,6 +407,18 @@ void print_result_success(std::string_view command, double runtime)
 	{
 		print_clean_success(runtime);
 	}
+	else if (command == "test")
+	{
+		print_test_success(runtime);
+	}
+	else if (command == "affected" || command == "why" || command == "stats")
+	{
+		print_query_success(runtime);
+	}
+	else if (command == "compdb" || command == "generate")
+	{
+		print_generate_success(runtime);
+	}
 	else
 	{
 		// should never reach this branch
@@ -130,6 +443,18 @@ void print_result_failure(std::string_view command,
 	{
 		print_clean_failure(error_message);
 	}
+	else if (command == "test")
+	{
+		print_test_failure(error_message);
+	}
+	else if (command == "affected" || command == "why" || command == "stats")
+	{
+		print_query_failure(error_message);
+	}
+	else if (command == "compdb" || command == "generate")
+	{
+		print_generate_failure(error_message);
+	}
 	else
 	{
 		// should never reach this branch
@@ -172,4 +497,40 @@ void print_clean_failure(const std::string &error_message)
 {
 	std::cout << "Clean failed: " << error_message << "\n";
 }
+
+// log test success
+void print_test_success(double runtime)
+{
+	std::cout << "Tests succeeded in " << runtime << "s\n";
+}
+
+// log test failure
+void print_test_failure(const std::string &error_message)
+{
+	std::cout << "Tests failed: " << error_message << "\n";
+}
+
+// log query success
+void print_query_success(double runtime)
+{
+	std::cout << "Query answered in " << runtime << "s\n";
+}
+
+// log query failure
+void print_query_failure(const std::string &error_message)
+{
+	std::cout << "Query failed: " << error_message << "\n";
+}
+
+// log generate success
+void print_generate_success(double runtime)
+{
+	std::cout << "Generated in " << runtime << "s\n";
+}
+
+// log generate failure
+void print_generate_failure(const std::string &error_message)
+{
+	std::cout << "Generate failed: " << error_message << "\n";
+}
 } // namespace coup
@@ -0,0 +1,699 @@
+/* coup_modules.cxx */
+#include "../include/coup_modules.hxx"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_system.hxx"
+#include "../include/coup_time_report.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+bool module_scan::uses_modules() const noexcept
+{
+	return !provides.empty() || !imports.empty() || !header_units.empty();
+}
+
+namespace
+{
+bool is_identifier_start(char c)
+{
+	return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool is_identifier_char(char c)
+{
+	return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// The tokens of a source that module declarations are made of
+// Comments and preprocessor directives are dropped, every literal becomes
+// a single '"' token, and the header name after an import is kept whole
+std::vector<std::string> module_tokens(std::string_view source)
+{
+	std::vector<std::string> tokens;
+	std::size_t i = 0;
+	std::size_t n = source.size();
+	bool line_start = true;
+	auto after_import = [&]
+	{ return !tokens.empty() && tokens.back() == "import"; };
+	while (i < n)
+	{
+		char c = source[i];
+		if (c == '\n')
+		{
+			line_start = true;
+			i++;
+		}
+		else if (std::isspace(static_cast<unsigned char>(c)))
+		{
+			i++;
+		}
+		else if (source.compare(i, 2, "//") == 0)
+		{
+			i = std::min(source.find('\n', i), n);
+		}
+		else if (source.compare(i, 2, "/*") == 0)
+		{
+			std::size_t end = source.find("*/", i + 2);
+			i = end == std::string_view::npos ? n : end + 2;
+		}
+		else if (c == '#' && line_start)
+		{
+			// a directive ends at the first newline not escaped by '\'
+			while (i < n && source[i] != '\n')
+				i += source.compare(i, 2, "\\\n") == 0 ? 2 : 1;
+		}
+		else if (is_identifier_start(c))
+		{
+			std::size_t start = i;
+			while (i < n && is_identifier_char(source[i]))
+				i++;
+			std::string_view word = source.substr(start, i - start);
+			// raw string literal, R"delimiter( ... )delimiter"
+			if (i < n && source[i] == '"' && word.back() == 'R' &&
+				word.size() <= 3)
+			{
+				std::size_t open = source.find('(', i);
+				if (open == std::string_view::npos)
+					break;
+				std::string close = ")";
+				close += source.substr(i + 1, open - i - 1);
+				close += '"';
+				std::size_t end = source.find(close, open);
+				i = end == std::string_view::npos ? n : end + close.size();
+				tokens.emplace_back("\"");
+			}
+			else
+			{
+				tokens.emplace_back(word);
+			}
+			line_start = false;
+		}
+		else if ((c == '<' || c == '"') && after_import())
+		{
+			char closing = c == '<' ? '>' : '"';
+			std::size_t end = source.find(closing, i + 1);
+			if (end == std::string_view::npos)
+				break;
+			tokens.emplace_back(source.substr(i, end + 1 - i));
+			i = end + 1;
+			line_start = false;
+		}
+		else if (c == '"' || c == '\'')
+		{
+			i++;
+			while (i < n && source[i] != c && source[i] != '\n')
+				i += source[i] == '\\' ? 2 : 1;
+			i++;
+			tokens.emplace_back("\"");
+			line_start = false;
+		}
+		else if (std::isdigit(static_cast<unsigned char>(c)))
+		{
+			std::size_t start = i;
+			while (i < n && (is_identifier_char(source[i]) ||
+							 source[i] == '.' || source[i] == '\''))
+				i++;
+			tokens.emplace_back(source.substr(start, i - start));
+			line_start = false;
+		}
+		else
+		{
+			tokens.emplace_back(1, c);
+			i++;
+			line_start = false;
+		}
+	}
+	return tokens;
+}
+
+// Reads a module name, e.g. "a.b" or "a.b:part", starting at tokens[k]
+// k is left at the token after the name
+// Returns an empty string if there is no module name
+std::string read_module_name(const std::vector<std::string> &tokens,
+							 std::size_t &k)
+{
+	std::string name;
+	bool partition = false;
+	while (k < tokens.size() && is_identifier_start(tokens[k].front()))
+	{
+		name += tokens[k++];
+		if (k < tokens.size() && tokens[k] == ".")
+		{
+			name += tokens[k++];
+		}
+		else if (k < tokens.size() && tokens[k] == ":" && !partition)
+		{
+			name += tokens[k++];
+			partition = true;
+		}
+		else
+		{
+			return name;
+		}
+	}
+	return {};
+}
+
+// clang-scan-deps of the same installation and version as a clang
+// driver, e.g. /usr/bin/clang-scan-deps-17 for /usr/bin/clang++-17
+std::string clang_scan_deps(const std::string &compiler)
+{
+	fs::path driver(compiler);
+	std::string name = driver.filename().string();
+	std::size_t dash = name.find('-');
+	std::string version = dash == std::string::npos ? "" : name.substr(dash);
+	return (driver.parent_path() / ("clang-scan-deps" + version)).string();
+}
+} // namespace
+
+// Finds the P1689 scanner that comes with the compiler: clang-scan-deps for
+// clang, the compiler itself for a gcc that takes -fdeps-format
+// Falls back to the builtin scanner if there is none
+module_scanner find_module_scanner(const std::string &compiler)
+{
+	if (is_clang_compiler(compiler))
+	{
+		return spawn_process({ clang_scan_deps(compiler), "--version" },
+							 "/dev/null") == 0
+				   ? module_scanner::clang
+				   : module_scanner::builtin;
+	}
+	std::vector<std::string> probe = { compiler,
+									   "-std=c++20",
+									   "-fmodules-ts",
+									   "-fdeps-format=p1689r5",
+									   "-fdeps-file=/dev/null",
+									   "-fdeps-target=probe.o",
+									   "-E",
+									   "-x",
+									   "c++",
+									   "/dev/null",
+									   "-o",
+									   "/dev/null" };
+	return spawn_process(probe, "/dev/null") == 0 ? module_scanner::gcc
+												  : module_scanner::builtin;
+}
+
+// Reads the P1689 description of a single translation unit, e.g.
+//      {"rules": [{"primary-output": "m.o",
+//                  "provides": [{"logical-name": "m"}],
+//                  "requires": [{"logical-name": "n"}]}]}
+// Required header units have a lookup-method other than "by-name"
+// Returns std::nullopt if json is not such a description
+std::optional<module_scan> parse_p1689(const std::string &json)
+{
+	nlohmann::json document = nlohmann::json::parse(json, nullptr, false);
+	if (document.is_discarded() || !document.is_object() ||
+		!document.contains("rules") || !document["rules"].is_array() ||
+		document["rules"].empty())
+		return std::nullopt;
+
+	const nlohmann::json &rule = document["rules"].front();
+	module_scan scan;
+	try
+	{
+		for (const nlohmann::json &provided :
+			 rule.value("provides", nlohmann::json::array()))
+		{
+			scan.provides = provided.at("logical-name").get<std::string>();
+		}
+		for (const nlohmann::json &required :
+			 rule.value("requires", nlohmann::json::array()))
+		{
+			std::string name = required.at("logical-name").get<std::string>();
+			if (required.value("lookup-method", "by-name") == "by-name")
+				scan.imports.push_back(std::move(name));
+			else
+				scan.header_units.push_back(
+					required.value("source-path", name));
+		}
+	}
+	catch (const nlohmann::json::exception &)
+	{
+		return std::nullopt;
+	}
+	return scan;
+}
+
+// Finds the module declarations and imports of a source without the
+// compiler, for compilers that cannot write P1689
+// Only what is written in the source itself is seen: conditional
+// compilation is ignored, and an import that comes from a macro or an
+// included header is missed
+module_scan scan_module_source(std::string_view source)
+{
+	module_scan scan;
+	std::vector<std::string> tokens = module_tokens(source);
+	// module of the module declaration, without its partition
+	std::string module_name;
+	bool statement_start = true;
+	for (std::size_t i = 0; i < tokens.size(); ++i)
+	{
+		const std::string &token = tokens[i];
+		bool at_start = statement_start;
+		statement_start = token == ";" || token == "{" || token == "}";
+		if (!at_start)
+			continue;
+
+		bool exported = token == "export";
+		std::size_t k = exported ? i + 1 : i;
+		if (k + 1 >= tokens.size())
+			break;
+		if (tokens[k] == "module")
+		{
+			// also skips "module;" and "module :private;"
+			std::string name = read_module_name(tokens, ++k);
+			if (name.empty() || k >= tokens.size() || tokens[k] != ";")
+				continue;
+			module_name = name.substr(0, name.find(':'));
+			if (exported || name.find(':') != std::string::npos)
+				scan.provides = name;
+			else
+				scan.imports.push_back(name);
+		}
+		else if (tokens[k] == "import")
+		{
+			const std::string &next = tokens[++k];
+			std::string name;
+			if (next.size() > 1 && (next.front() == '<' || next.front() == '"'))
+			{
+				if (k + 1 < tokens.size() && tokens[k + 1] == ";")
+					scan.header_units.push_back(
+						next.substr(1, next.size() - 2));
+				continue;
+			}
+			if (next == ":")
+			{
+				std::string partition = read_module_name(tokens, ++k);
+				if (!partition.empty() && !module_name.empty())
+					name = module_name + ":" + partition;
+			}
+			else
+			{
+				name = read_module_name(tokens, k);
+			}
+			if (!name.empty() && k < tokens.size() && tokens[k] == ";")
+				scan.imports.push_back(name);
+		}
+		else
+		{
+			continue;
+		}
+		i = k;
+		statement_start = true;
+	}
+
+	std::sort(scan.imports.begin(), scan.imports.end());
+	scan.imports.erase(std::unique(scan.imports.begin(), scan.imports.end()),
+					   scan.imports.end());
+	return scan;
+}
+
+// Scans one translation unit for the modules it provides and imports
+// scan_file receives the P1689 output of the compiler, the preprocessed
+// source, depfile and compiler output are written next to it and removed
+// afterwards
+// Returns std::nullopt if the scan failed, output then holds why
+std::optional<module_scan> scan_modules(module_scanner scanner,
+										const fs::path &source_file,
+										const fs::path &object_file,
+										const fs::path &scan_file,
+										const compile_options &options,
+										std::string &output)
+{
+	if (scanner == module_scanner::builtin)
+	{
+		if (!fs::is_regular_file(source_file))
+		{
+			output = "Cannot read " + source_file.string();
+			return std::nullopt;
+		}
+		return scan_module_source(file_contents(source_file));
+	}
+
+	fs::path preprocessed_file = scan_file;
+	preprocessed_file += ".ii";
+	fs::path dep_file = scan_file;
+	dep_file += ".d";
+	fs::path log_file = scan_file;
+	log_file += ".log";
+
+	int exit_code;
+	if (scanner == module_scanner::gcc)
+	{
+		std::vector<std::string> arguments = make_preprocess_arguments(
+			source_file, preprocessed_file, object_file, dep_file, options);
+		arguments.insert(arguments.begin() + 1,
+						 { "-fmodules-ts", "-fdeps-format=p1689r5",
+						   "-fdeps-file=" + scan_file.string(),
+						   "-fdeps-target=" + object_file.string() });
+		exit_code = spawn_process(arguments, log_file);
+	}
+	else
+	{
+		// clang-scan-deps prints the description
+		std::vector<std::string> arguments = {
+			clang_scan_deps(options.compiler), "-format=p1689", "--"
+		};
+		std::vector<std::string> compile_arguments =
+			make_compile_arguments(source_file, object_file, dep_file,
+								   options);
+		arguments.insert(arguments.end(), compile_arguments.begin(),
+						 compile_arguments.end());
+		exit_code = spawn_process(arguments, scan_file);
+		log_file = scan_file;
+	}
+
+	std::optional<module_scan> scan;
+	if (exit_code == 0)
+	{
+		scan = parse_p1689(file_contents(scan_file));
+	}
+	if (!scan.has_value())
+	{
+		output = file_contents(log_file);
+	}
+	std::error_code ec;
+	for (const fs::path &file :
+		 { scan_file, preprocessed_file, dep_file, log_file })
+		fs::remove(file, ec);
+	return scan;
+}
+
+// Links every import to the unit providing the module and orders the units
+// so each comes after those it imports from
+// Returns an error if a header unit is imported, a module is imported but
+// not provided, provided by two units, or imports itself through others
+std::optional<std::string>
+make_module_graph(const std::vector<fs::path> &sources,
+				  std::vector<module_scan> scans, module_graph &graph)
+{
+	std::size_t num_units = scans.size();
+	graph = module_graph{};
+	graph.units = std::move(scans);
+	graph.dependencies.resize(num_units);
+	graph.imports.resize(num_units);
+
+	std::unordered_map<std::string, std::size_t> providers;
+	for (std::size_t i = 0; i < num_units; ++i)
+	{
+		const module_scan &unit = graph.units[i];
+		if (!unit.header_units.empty())
+		{
+			return "Header units are not supported, " + sources[i].string() +
+				   " imports " + unit.header_units.front() +
+				   " (#include it instead)";
+		}
+		if (unit.provides.empty())
+			continue;
+		auto [provider, inserted] = providers.emplace(unit.provides, i);
+		if (!inserted)
+		{
+			return "Module " + unit.provides + " is provided by both " +
+				   sources[provider->second].string() + " and " +
+				   sources[i].string();
+		}
+	}
+
+	std::vector<std::vector<std::size_t>> dependents(num_units);
+	std::vector<std::size_t> num_pending(num_units, 0);
+	for (std::size_t i = 0; i < num_units; ++i)
+	{
+		for (const std::string &name : graph.units[i].imports)
+		{
+			auto provider = providers.find(name);
+			if (provider == providers.end())
+			{
+				return "Module " + name + " imported by " +
+					   sources[i].string() + " is not provided by any source";
+			}
+			std::vector<std::size_t> &dependencies = graph.dependencies[i];
+			if (std::find(dependencies.begin(), dependencies.end(),
+						  provider->second) != dependencies.end())
+				continue;
+			dependencies.push_back(provider->second);
+			dependents[provider->second].push_back(i);
+			num_pending[i]++;
+		}
+	}
+
+	// units without pending imports, in source order
+	graph.order.reserve(num_units);
+	for (std::size_t i = 0; i < num_units; ++i)
+	{
+		if (num_pending[i] == 0)
+			graph.order.push_back(i);
+	}
+	for (std::size_t next = 0; next < graph.order.size(); ++next)
+	{
+		for (std::size_t dependent : dependents[graph.order[next]])
+		{
+			if (--num_pending[dependent] == 0)
+				graph.order.push_back(dependent);
+		}
+	}
+
+	if (graph.order.size() != num_units)
+	{
+		// every unit left imports from another one left, following those
+		// imports runs into a cycle
+		std::size_t unit = std::find_if(num_pending.begin(), num_pending.end(),
+										[](std::size_t n) { return n > 0; }) -
+						   num_pending.begin();
+		std::vector<std::size_t> path;
+		while (std::find(path.begin(), path.end(), unit) == path.end())
+		{
+			path.push_back(unit);
+			for (std::size_t dependency : graph.dependencies[unit])
+			{
+				if (num_pending[dependency] > 0)
+				{
+					unit = dependency;
+					break;
+				}
+			}
+		}
+		std::string cycle = graph.units[unit].provides;
+		for (auto it = std::find(path.begin(), path.end(), unit) + 1;
+			 it != path.end(); ++it)
+			cycle += " -> " + graph.units[*it].provides;
+		return "Module import cycle: " + cycle + " -> " +
+			   graph.units[unit].provides;
+	}
+
+	for (std::size_t unit : graph.order)
+	{
+		std::vector<std::string> &imports = graph.imports[unit];
+		for (std::size_t dependency : graph.dependencies[unit])
+		{
+			imports.push_back(graph.units[dependency].provides);
+			imports.insert(imports.end(), graph.imports[dependency].begin(),
+						   graph.imports[dependency].end());
+		}
+		std::sort(imports.begin(), imports.end());
+		imports.erase(std::unique(imports.begin(), imports.end()),
+					  imports.end());
+	}
+	return std::nullopt;
+}
+
+// <directory>/<name>.gcm for gcc, .pcm for clang; a partition m:part is
+// written to m-part
+fs::path module_interface_file(const fs::path &directory,
+							   const std::string &name,
+							   const std::string &compiler)
+{
+	std::string file = name;
+	std::replace(file.begin(), file.end(), ':', '-');
+	file += is_clang_compiler(compiler) ? ".pcm" : ".gcm";
+	return directory / file;
+}
+
+// Flags that compile a unit of the graph against the interfaces it
+// imports and, if it provides a module, write its interface
+// gcc finds every interface through the mapper file (see
+// make_module_mapper), clang is given each one
+// Units that neither provide nor import a module get no flags
+std::vector<std::string> module_flags(const module_graph &graph,
+									  std::size_t unit,
+									  const fs::path &source_file,
+									  const fs::path &interface_directory,
+									  const fs::path &mapper_file,
+									  const std::string &compiler)
+{
+	const module_scan &scan = graph.units[unit];
+	if (!scan.uses_modules())
+	{
+		return {};
+	}
+
+	std::string extension = source_file.extension().string();
+	std::vector<std::string> flags;
+	if (is_clang_compiler(compiler))
+	{
+		if (!scan.provides.empty())
+		{
+			if (extension != ".cppm")
+				flags.insert(flags.end(), { "-x", "c++-module" });
+			flags.push_back(
+				"-fmodule-output=" +
+				module_interface_file(interface_directory, scan.provides,
+									  compiler)
+					.string());
+		}
+		for (const std::string &name : graph.imports[unit])
+		{
+			flags.push_back("-fmodule-file=" + name + "=" +
+							module_interface_file(interface_directory, name,
+												  compiler)
+								.string());
+		}
+	}
+	else
+	{
+		flags = { "-fmodules-ts", "-fmodule-mapper=" + mapper_file.string() };
+		// gcc does not know the extensions of module interface files
+		if (extension == ".cppm" || extension == ".ixx" ||
+			extension == ".mpp" || extension == ".mxx")
+			flags.insert(flags.end(), { "-x", "c++" });
+	}
+	return flags;
+}
+
+// gcc module mapper file, one "<module> <interface file>" line per module
+// the graph provides
+std::string make_module_mapper(const module_graph &graph,
+							   const fs::path &interface_directory,
+							   const std::string &compiler)
+{
+	std::string mapper;
+	for (const module_scan &unit : graph.units)
+	{
+		if (!unit.provides.empty())
+		{
+			mapper += unit.provides + " " +
+					  module_interface_file(interface_directory,
+											unit.provides, compiler)
+						  .string() +
+					  "\n";
+		}
+	}
+	return mapper;
+}
+
+// one line per source: source, key, provided module and imported modules
+// separated by tabs, the imported modules by spaces
+bool module_scan_cache::load(const fs::path &cache_file)
+{
+	entries.clear();
+	std::ifstream input(cache_file);
+	if (!input)
+	{
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(input, line))
+	{
+		std::istringstream fields(line);
+		std::string source, key, imports;
+		entry e;
+		if (!std::getline(fields, source, '\t') ||
+			!std::getline(fields, key, '\t') ||
+			!std::getline(fields, e.scan.provides, '\t'))
+		{
+			continue;
+		}
+		// a damaged line is skipped, its source is scanned again
+		const char *key_end = key.data() + key.size();
+		auto [parsed_end, error] =
+			std::from_chars(key.data(), key_end, e.key, 16);
+		if (error != std::errc() || parsed_end != key_end || key.empty())
+		{
+			continue;
+		}
+		std::getline(fields, imports);
+		std::istringstream names(imports);
+		std::string name;
+		while (names >> name)
+		{
+			e.scan.imports.push_back(name);
+		}
+		entries.insert_or_assign(std::move(source), std::move(e));
+	}
+	return true;
+}
+
+bool module_scan_cache::save(const fs::path &cache_file) const
+{
+	fs::path tmp_file = cache_file;
+	tmp_file += ".tmp";
+	{
+		std::ofstream output(tmp_file, std::ios::trunc);
+		if (!output)
+		{
+			return false;
+		}
+		for (const auto &[source, e] : entries)
+		{
+			output << source << '\t' << hash_to_string(e.key) << '\t'
+				   << e.scan.provides << '\t';
+			for (std::size_t i = 0; i < e.scan.imports.size(); ++i)
+			{
+				output << (i > 0 ? " " : "") << e.scan.imports[i];
+			}
+			output << '\n';
+		}
+		if (!output)
+		{
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(tmp_file, cache_file, ec);
+	return !ec;
+}
+
+// the recorded scan of source, nullptr if there is none for this key
+const module_scan *module_scan_cache::find(const std::string &source,
+										   hash_t key) const
+{
+	auto it = entries.find(source);
+	if (it == entries.end() || it->second.key != key)
+	{
+		return nullptr;
+	}
+	return &it->second.scan;
+}
+
+// Scans that found header units are not kept, the build fails on them
+// until the source changes anyway
+void module_scan_cache::record(const std::string &source, hash_t key,
+							   module_scan scan)
+{
+	if (!scan.header_units.empty())
+	{
+		entries.erase(source);
+		return;
+	}
+	entries.insert_or_assign(source, entry{ key, std::move(scan) });
+}
+} // namespace coup
@@ -0,0 +1,663 @@
+/* coup_net.cxx */
+#include "../include/coup_net.hxx"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// a server that does not answer within this time is treated as gone,
+// unless the client asks for longer
+#define SOCKET_TIMEOUT_SECONDS 30
+// requests and responses coup accepts
+#define MAX_HEADER_BYTES (64 * 1024)
+#define MAX_BODY_BYTES (256L * 1024 * 1024)
+// connections a server serves at once, each may buffer a body of up to
+// MAX_BODY_BYTES; more wait in the listen backlog
+#define MAX_SERVER_CONNECTIONS 32
+
+namespace coup
+{
+
+// Splits http://host[:port][/path]; the path loses its trailing '/'
+// Returns std::nullopt for anything else, https included
+std::optional<http_url> parse_http_url(const std::string &url)
+{
+	const std::string scheme = "http://";
+	if (url.compare(0, scheme.size(), scheme) != 0)
+	{
+		return std::nullopt;
+	}
+	std::string rest = url.substr(scheme.size());
+	http_url parsed;
+	std::size_t slash = rest.find('/');
+	if (slash != std::string::npos)
+	{
+		parsed.path = rest.substr(slash);
+		rest.resize(slash);
+		while (!parsed.path.empty() && parsed.path.back() == '/')
+			parsed.path.pop_back();
+	}
+	std::size_t colon = rest.rfind(':');
+	if (colon != std::string::npos)
+	{
+		parsed.port = rest.substr(colon + 1);
+		rest.resize(colon);
+		if (parsed.port.empty() ||
+			!std::all_of(parsed.port.begin(), parsed.port.end(),
+						 [](unsigned char c) { return std::isdigit(c); }))
+		{
+			return std::nullopt;
+		}
+	}
+	parsed.host = rest;
+	if (parsed.host.empty())
+	{
+		return std::nullopt;
+	}
+	return parsed;
+}
+
+// "host:port" or "unix:<path>", how servers without a path are given
+std::optional<http_url> parse_socket_address(const std::string &address)
+{
+	if (address.starts_with("unix:"))
+	{
+		http_url url;
+		url.host = "localhost";
+		url.socket_path = address.substr(5);
+		if (url.socket_path.empty())
+			return std::nullopt;
+		return url;
+	}
+	if (address.find(':') == std::string::npos)
+	{
+		return std::nullopt;
+	}
+	return parse_http_url("http://" + address);
+}
+
+namespace
+{
+void set_timeouts(int fd, int seconds = SOCKET_TIMEOUT_SECONDS)
+{
+	struct timeval timeout = { seconds, 0 };
+	::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+std::string lower_case(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(),
+				   [](unsigned char c) { return std::tolower(c); });
+	return s;
+}
+
+std::string_view status_reason(int status)
+{
+	switch (status)
+	{
+	case 200:
+		return "OK";
+	case 201:
+		return "Created";
+	case 400:
+		return "Bad Request";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	default:
+		return "Internal Server Error";
+	}
+}
+} // namespace
+
+// connected socket to host:port, with send and receive timeouts
+int connect_tcp(const std::string &host, const std::string &port)
+{
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *addresses = nullptr;
+	if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+	{
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo *address = addresses; address != nullptr;
+		 address = address->ai_next)
+	{
+		fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC,
+					  address->ai_protocol);
+		if (fd < 0)
+			continue;
+		set_timeouts(fd);
+		if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0)
+			break;
+		::close(fd);
+		fd = -1;
+	}
+	::freeaddrinfo(addresses);
+
+	if (fd >= 0)
+	{
+		// requests are written whole, do not hold back small ones
+		int one = 1;
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+// connected unix domain socket, with send and receive timeouts
+int connect_unix(const std::string &path)
+{
+	struct sockaddr_un address = {};
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		return -1;
+	}
+	address.sun_family = AF_UNIX;
+	path.copy(address.sun_path, path.size());
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	set_timeouts(fd);
+	if (::connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+				  sizeof(address)) != 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// listening socket on address:port, port "0" picks a free one
+int listen_tcp(const std::string &address, const std::string &port)
+{
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	struct addrinfo *addresses = nullptr;
+	if (::getaddrinfo(address.empty() ? nullptr : address.c_str(),
+					  port.c_str(), &hints, &addresses) != 0)
+	{
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo *entry = addresses; entry != nullptr;
+		 entry = entry->ai_next)
+	{
+		fd = ::socket(entry->ai_family, entry->ai_socktype | SOCK_CLOEXEC,
+					  entry->ai_protocol);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (::bind(fd, entry->ai_addr, entry->ai_addrlen) == 0 &&
+			::listen(fd, SOMAXCONN) == 0)
+			break;
+		::close(fd);
+		fd = -1;
+	}
+	::freeaddrinfo(addresses);
+	return fd;
+}
+
+// listening unix domain socket, replaces a socket file left behind
+int listen_unix(const std::string &path)
+{
+	struct sockaddr_un address = {};
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		return -1;
+	}
+	address.sun_family = AF_UNIX;
+	path.copy(address.sun_path, path.size());
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	::unlink(path.c_str());
+	if (::bind(fd, reinterpret_cast<struct sockaddr *>(&address),
+			   sizeof(address)) != 0 ||
+		::listen(fd, SOMAXCONN) != 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// port a socket is bound to, -1 if unknown
+int local_port(int fd)
+{
+	struct sockaddr_storage address = {};
+	socklen_t length = sizeof(address);
+	if (::getsockname(fd, reinterpret_cast<struct sockaddr *>(&address),
+					  &length) != 0)
+	{
+		return -1;
+	}
+	if (address.ss_family == AF_INET)
+		return ntohs(reinterpret_cast<struct sockaddr_in &>(address).sin_port);
+	if (address.ss_family == AF_INET6)
+		return ntohs(
+			reinterpret_cast<struct sockaddr_in6 &>(address).sin6_port);
+	return -1;
+}
+
+// writes all of data, false if the connection failed
+bool send_all(int fd, std::string_view data)
+{
+	while (!data.empty())
+	{
+		ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		data.remove_prefix(static_cast<std::size_t>(sent));
+	}
+	return true;
+}
+
+// Reads one request or response with a Content-Length body (or none)
+// buffer holds bytes received past the previous message and keeps those
+// past this one, so pipelined messages are not lost
+// Returns std::nullopt if the connection closed or the message is invalid
+std::optional<http_message> read_http_message(int fd, std::string &buffer)
+{
+	char chunk[64 * 1024];
+	auto receive = [&]
+	{
+		for (;;)
+		{
+			ssize_t received = ::recv(fd, chunk, sizeof(chunk), 0);
+			if (received < 0 && errno == EINTR)
+				continue;
+			if (received <= 0)
+				return false;
+			buffer.append(chunk, static_cast<std::size_t>(received));
+			return true;
+		}
+	};
+
+	std::size_t header_end;
+	while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos)
+	{
+		if (buffer.size() > MAX_HEADER_BYTES || !receive())
+			return std::nullopt;
+	}
+
+	http_message message;
+	std::size_t line_end = buffer.find("\r\n");
+	message.start_line = buffer.substr(0, line_end);
+	while (line_end < header_end)
+	{
+		std::size_t next = buffer.find("\r\n", line_end + 2);
+		std::string line = buffer.substr(line_end + 2, next - line_end - 2);
+		line_end = next;
+		std::size_t colon = line.find(':');
+		if (colon == std::string::npos)
+			continue;
+		std::size_t value = line.find_first_not_of(' ', colon + 1);
+		message.headers[lower_case(line.substr(0, colon))] =
+			value == std::string::npos ? "" : line.substr(value);
+	}
+
+	long length = 0;
+	auto content_length = message.headers.find("content-length");
+	if (content_length != message.headers.end())
+	{
+		char *end;
+		length = std::strtol(content_length->second.c_str(), &end, 10);
+		if (*end != '\0' || length < 0 || length > MAX_BODY_BYTES)
+			return std::nullopt;
+	}
+
+	std::size_t body_start = header_end + 4;
+	std::size_t message_end = body_start + static_cast<std::size_t>(length);
+	while (buffer.size() < message_end)
+	{
+		if (!receive())
+			return std::nullopt;
+	}
+	message.body = buffer.substr(body_start, static_cast<std::size_t>(length));
+	buffer.erase(0, message_end);
+	return message;
+}
+
+std::string make_http_request(const http_request &request,
+							  const std::string &host)
+{
+	return request.method + " " + request.path + " HTTP/1.1\r\nHost: " +
+		   host + "\r\nContent-Length: " +
+		   std::to_string(request.body.size()) + "\r\n\r\n" + request.body;
+}
+
+std::string make_http_response(int status, std::string_view body)
+{
+	std::string response = "HTTP/1.1 " + std::to_string(status) + " " +
+						   std::string(status_reason(status)) +
+						   "\r\nContent-Length: " +
+						   std::to_string(body.size()) + "\r\n\r\n";
+	response += body;
+	return response;
+}
+
+std::string encode_fields(const std::vector<std::string> &fields)
+{
+	std::string body;
+	for (const std::string &field : fields)
+	{
+		body += std::to_string(field.size());
+		body += ':';
+		body += field;
+	}
+	return body;
+}
+
+// the fields of encode_fields, std::nullopt if the body is malformed
+std::optional<std::vector<std::string>> decode_fields(std::string_view body)
+{
+	std::vector<std::string> fields;
+	while (!body.empty())
+	{
+		std::size_t colon = body.find(':');
+		if (colon == std::string_view::npos || colon == 0 || colon > 12)
+			return std::nullopt;
+		std::size_t length = 0;
+		for (char c : body.substr(0, colon))
+		{
+			if (c < '0' || c > '9')
+				return std::nullopt;
+			length = length * 10 + static_cast<std::size_t>(c - '0');
+		}
+		body.remove_prefix(colon + 1);
+		if (length > body.size())
+			return std::nullopt;
+		fields.emplace_back(body.substr(0, length));
+		body.remove_prefix(length);
+	}
+	return fields;
+}
+
+// method and path of a request, e.g. "GET" and "/cas/ab"
+void split_request_line(const http_message &request, std::string &method,
+						std::string &path)
+{
+	std::istringstream start_line(request.start_line);
+	start_line >> method >> path;
+}
+
+http_client::http_client(http_url url_, int timeout_seconds_)
+	: url(std::move(url_)), timeout_seconds(timeout_seconds_)
+{
+}
+
+http_client::~http_client()
+{
+	disconnect();
+}
+
+bool http_client::connect()
+{
+	if (fd < 0)
+	{
+		fd = url.socket_path.empty() ? connect_tcp(url.host, url.port)
+									 : connect_unix(url.socket_path);
+		buffer.clear();
+		if (fd >= 0 && timeout_seconds != SOCKET_TIMEOUT_SECONDS)
+			set_timeouts(fd, timeout_seconds);
+	}
+	return fd >= 0;
+}
+
+void http_client::disconnect()
+{
+	if (fd >= 0)
+	{
+		::close(fd);
+		fd = -1;
+	}
+}
+
+// sends every request, then reads the response to each in order; paths
+// are relative to the path of the URL
+std::optional<std::vector<http_response>>
+http_client::exchange(const std::vector<http_request> &requests)
+{
+	if (!connect())
+	{
+		return std::nullopt;
+	}
+	std::string data;
+	for (const http_request &request : requests)
+	{
+		http_request prefixed = request;
+		prefixed.path = url.path + request.path;
+		data += make_http_request(prefixed, url.host);
+	}
+	if (!send_all(fd, data))
+	{
+		disconnect();
+		return std::nullopt;
+	}
+
+	std::vector<http_response> responses;
+	responses.reserve(requests.size());
+	for (std::size_t i = 0; i < requests.size(); ++i)
+	{
+		std::optional<http_message> message = read_http_message(fd, buffer);
+		// "HTTP/1.1 200 OK"
+		std::size_t space = message.has_value()
+								? message->start_line.find(' ')
+								: std::string::npos;
+		if (space == std::string::npos)
+		{
+			disconnect();
+			return std::nullopt;
+		}
+		http_response response;
+		response.status = std::atoi(message->start_line.c_str() + space + 1);
+		response.body = std::move(message->body);
+		auto connection = message->headers.find("connection");
+		responses.push_back(std::move(response));
+		if (connection != message->headers.end() &&
+			lower_case(connection->second) == "close")
+		{
+			disconnect();
+			if (i + 1 < requests.size())
+				return std::nullopt;
+		}
+	}
+	return responses;
+}
+
+std::optional<http_response> http_client::request(const http_request &request)
+{
+	std::optional<std::vector<http_response>> responses =
+		requests({ request });
+	if (!responses.has_value())
+	{
+		return std::nullopt;
+	}
+	return std::move(responses->front());
+}
+
+std::optional<std::vector<http_response>>
+http_client::requests(const std::vector<http_request> &requests)
+{
+	// an idle keep-alive connection may have been closed by the server
+	bool reused = fd >= 0;
+	std::optional<std::vector<http_response>> responses = exchange(requests);
+	if (!responses.has_value() && reused)
+	{
+		responses = exchange(requests);
+	}
+	return responses;
+}
+
+http_server::~http_server()
+{
+	stop();
+	reap_connections(true);
+	if (listen_fd >= 0)
+	{
+		::close(listen_fd);
+	}
+	if (!socket_path.empty())
+	{
+		::unlink(socket_path.c_str());
+	}
+}
+
+// bind the server, port "0" picks a free one (see port())
+bool http_server::listen(const std::string &address, const std::string &port)
+{
+	listen_fd = listen_tcp(address, port);
+	return listen_fd >= 0;
+}
+
+bool http_server::listen_unix(const std::string &path)
+{
+	listen_fd = coup::listen_unix(path);
+	if (listen_fd >= 0)
+	{
+		socket_path = path;
+	}
+	return listen_fd >= 0;
+}
+
+int http_server::port() const
+{
+	return local_port(listen_fd);
+}
+
+// accepts connections until stop() is called, at most
+// MAX_SERVER_CONNECTIONS are served at once
+void http_server::serve()
+{
+	while (!stopping)
+	{
+		{
+			std::unique_lock<std::mutex> lock(connections_mtx);
+			connections_cv.wait(
+				lock,
+				[&]
+				{
+					return stopping ||
+						   std::count_if(connections.begin(),
+										 connections.end(),
+										 [](const connection &client)
+										 { return !client.done; }) <
+							   MAX_SERVER_CONNECTIONS;
+				});
+		}
+		int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (stopping)
+				break;
+			continue;
+		}
+		// a peer that stops sending or reading gives up its thread after
+		// the timeout
+		set_timeouts(fd);
+		reap_connections(false);
+		std::lock_guard<std::mutex> lock(connections_mtx);
+		connection &client = connections.emplace_back();
+		client.fd = fd;
+		client.thread = std::thread(&http_server::serve_connection, this,
+									std::ref(client));
+	}
+	reap_connections(true);
+}
+
+// makes serve() return, open connections are closed
+void http_server::stop()
+{
+	stopping = true;
+	if (listen_fd >= 0)
+	{
+		::shutdown(listen_fd, SHUT_RDWR);
+	}
+	std::lock_guard<std::mutex> lock(connections_mtx);
+	for (connection &client : connections)
+	{
+		::shutdown(client.fd, SHUT_RDWR);
+	}
+	connections_cv.notify_all();
+}
+
+// joins the threads of closed connections, or of all of them
+void http_server::reap_connections(bool all)
+{
+	std::list<connection> finished;
+	{
+		std::lock_guard<std::mutex> lock(connections_mtx);
+		for (auto it = connections.begin(); it != connections.end();)
+		{
+			auto next = std::next(it);
+			if (all || it->done)
+				finished.splice(finished.end(), connections, it);
+			it = next;
+		}
+	}
+	for (connection &client : finished)
+	{
+		client.thread.join();
+		::close(client.fd);
+	}
+}
+
+void http_server::serve_connection(connection &client)
+{
+	std::string buffer;
+	while (!stopping)
+	{
+		std::optional<http_message> request =
+			read_http_message(client.fd, buffer);
+		if (!request.has_value())
+			break;
+		http_response response = handle_request(*request);
+		if (!send_all(client.fd, make_http_response(response.status,
+													response.body)))
+			break;
+		auto connection_header = request->headers.find("connection");
+		if (connection_header != request->headers.end() &&
+			lower_case(connection_header->second) == "close")
+			break;
+	}
+	std::lock_guard<std::mutex> lock(connections_mtx);
+	client.done = true;
+	connections_cv.notify_all();
+}
+} // namespace coup
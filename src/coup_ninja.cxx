@@ -0,0 +1,134 @@
+/* coup_ninja.cxx */
+#include "../include/coup_ninja.hxx"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace coup
+{
+
+// path in a build statement: '$', ' ' and ':' are escaped with '$'
+std::string ninja_escape_path(const std::string &path)
+{
+	std::string escaped;
+	escaped.reserve(path.size());
+	for (char c : path)
+	{
+		if (c == '$' || c == ' ' || c == ':')
+		{
+			escaped += '$';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+// value of a variable, only '$' is special there
+std::string ninja_escape_value(const std::string &value)
+{
+	std::string escaped;
+	escaped.reserve(value.size());
+	for (char c : value)
+	{
+		if (c == '$')
+		{
+			escaped += '$';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+namespace
+{
+void write_link(std::ostringstream &ninja, const ninja_link &link)
+{
+	ninja << "build " << ninja_escape_path(link.target) << ": link";
+	for (const std::string &object : link.objects)
+	{
+		ninja << " $\n    " << ninja_escape_path(object);
+	}
+	ninja << "\n  cmd = " << ninja_escape_value(link.command) << "\n\n";
+}
+} // namespace
+
+// Renders build.ninja, to be run from the project root with
+//      ninja -f <build>/build.ninja [profile]
+// Compiles use the gcc depfile format; ninja keeps its own logs in the build
+// directory
+// The generator edge re-runs coup when coup_config.json or any source
+// directory changes, i.e. when the source set may have changed; it is
+// restat, coup leaves build.ninja untouched when its contents are the same,
+// so nothing else is rebuilt then
+std::string make_ninja_file(const std::vector<ninja_profile> &profiles,
+							const std::string &default_profile,
+							const std::string &build_directory,
+							const ninja_generator &generator)
+{
+	std::ostringstream ninja;
+	ninja << "# Generated by `coup generate ninja` from coup_config.json, "
+			 "do not edit\n"
+		  << "# Run from the project root: ninja -f "
+		  << generator.ninja_file << " [profile]\n\n"
+		  << "ninja_required_version = 1.7\n"
+		  << "builddir = " << ninja_escape_path(build_directory) << "\n\n"
+		  << "rule cc\n"
+		  << "  command = $cmd\n"
+		  << "  depfile = $dep\n"
+		  << "  deps = gcc\n"
+		  << "  description = Compiling $in\n\n"
+		  << "rule link\n"
+		  << "  command = $cmd\n"
+		  << "  description = Linking $out\n\n"
+		  << "rule regenerate\n"
+		  << "  command = " << ninja_escape_value(generator.command) << "\n"
+		  << "  generator = 1\n"
+		  << "  restat = 1\n"
+		  << "  description = Regenerating $out\n\n"
+		  << "build " << ninja_escape_path(generator.ninja_file)
+		  << ": regenerate";
+	for (const std::string &input : generator.inputs)
+	{
+		ninja << " $\n    " << ninja_escape_path(input);
+	}
+	ninja << "\n\n";
+
+	for (const ninja_profile &profile : profiles)
+	{
+		ninja << "# profile " << profile.name << "\n";
+		for (const ninja_compile &compile : profile.compiles)
+		{
+			ninja << "build " << ninja_escape_path(compile.object) << ": cc "
+				  << ninja_escape_path(compile.source) << "\n"
+				  << "  cmd = " << ninja_escape_value(compile.command) << "\n"
+				  << "  dep = " << ninja_escape_value(compile.dep_file)
+				  << "\n";
+		}
+		ninja << "\n";
+
+		write_link(ninja, profile.executable);
+		ninja << "build " << ninja_escape_path(profile.name) << ": phony "
+			  << ninja_escape_path(profile.executable.target) << "\n\n";
+
+		if (profile.tests.empty())
+		{
+			continue;
+		}
+		for (const ninja_link &test : profile.tests)
+		{
+			write_link(ninja, test);
+		}
+		ninja << "build " << ninja_escape_path(profile.name + "_tests")
+			  << ": phony";
+		for (const ninja_link &test : profile.tests)
+		{
+			ninja << " " << ninja_escape_path(test.target);
+		}
+		ninja << "\n\n";
+	}
+
+	ninja << "default " << ninja_escape_path(default_profile) << "\n";
+	return ninja.str();
+}
+} // namespace coup
@@ -0,0 +1,232 @@
+/* coup_packages.cxx */
+#include "../include/coup_packages.hxx"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_system.hxx"
+
+#define PKG_CONFIG_PROGRAM "pkg-config"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+namespace
+{
+// environment variables that change what pkg-config finds
+const char *const PKG_CONFIG_VARIABLES[] = { "PKG_CONFIG_PATH",
+											 "PKG_CONFIG_LIBDIR",
+											 "PKG_CONFIG_SYSROOT_DIR" };
+
+std::int64_t file_mtime(const fs::path &file)
+{
+	std::optional<file_stamp> stamp = get_file_stamp(file);
+	return stamp.has_value() ? stamp->mtime_ns : 0;
+}
+
+// Runs pkg-config with arguments and returns what it printed
+// search_path is searched before PKG_CONFIG_PATH if it is not empty
+std::string run_pkg_config(const std::vector<std::string> &arguments,
+						   const std::string &search_path,
+						   const fs::path &scratch_file)
+{
+	std::vector<std::string> command;
+	if (!search_path.empty())
+	{
+		std::string path = search_path;
+		if (const char *env = std::getenv("PKG_CONFIG_PATH"))
+			path += ":" + std::string(env);
+		command = { "env", "PKG_CONFIG_PATH=" + path };
+	}
+	command.emplace_back(PKG_CONFIG_PROGRAM);
+	command.insert(command.end(), arguments.begin(), arguments.end());
+
+	int status = spawn_process(command, scratch_file);
+	if (status < 0)
+	{
+		throw std::runtime_error("Failed to run " PKG_CONFIG_PROGRAM);
+	}
+	std::string output = file_contents(scratch_file);
+	if (status != 0)
+	{
+		throw std::runtime_error(PKG_CONFIG_PROGRAM " " +
+								 join_arguments(arguments) + " failed:\n" +
+								 output);
+	}
+	return output;
+}
+
+// adds the .pc file of module and of every module it requires to record
+void add_pc_files(const std::string &module, const std::string &search_path,
+				  const fs::path &scratch_file, package_record &record,
+				  std::unordered_set<std::string> &seen)
+{
+	if (!seen.insert(module).second)
+	{
+		return;
+	}
+	std::vector<std::string> directory = split_pkg_config_output(
+		run_pkg_config({ "--variable=pcfiledir", module }, search_path,
+					   scratch_file));
+	if (directory.size() == 1)
+	{
+		fs::path pc_file = fs::path(directory[0]) / (module + ".pc");
+		record.files.emplace_back(pc_file.string(), file_mtime(pc_file));
+	}
+
+	// one required module per line, maybe followed by a version
+	std::istringstream requires_output(run_pkg_config(
+		{ "--print-requires", "--print-requires-private", module },
+		search_path, scratch_file));
+	std::string line;
+	while (std::getline(requires_output, line))
+	{
+		std::istringstream words(line);
+		std::string required;
+		if (words >> required)
+			add_pc_files(required, search_path, scratch_file, record, seen);
+	}
+}
+
+// flags of a library installed below a prefix without a .pc file
+void resolve_from_prefix(const package_dependency &dependency,
+						 package_record &record)
+{
+	fs::path prefix = fs::path(dependency.prefix).lexically_normal();
+	fs::path include_directory = prefix / "include";
+	fs::path lib_directory = prefix / "lib";
+	if (!fs::is_directory(include_directory) &&
+		!fs::is_directory(lib_directory))
+	{
+		throw std::runtime_error("Dependency " + dependency.name +
+								 " not found: " + prefix.string() +
+								 " has no include or lib directory");
+	}
+	if (fs::is_directory(include_directory))
+	{
+		record.compile_flags.push_back("-I" + include_directory.string());
+	}
+	if (fs::is_directory(lib_directory))
+	{
+		record.link_flags.push_back("-L" + lib_directory.string());
+		record.link_flags.push_back("-Wl,-rpath," + lib_directory.string());
+	}
+	if (dependency.libs.empty())
+	{
+		record.link_flags.push_back("-l" + dependency.name);
+	}
+	for (const std::string &lib : dependency.libs)
+	{
+		record.link_flags.push_back("-l" + lib);
+	}
+}
+} // namespace
+
+hash_t package_key(const package_dependency &dependency)
+{
+	hash_t key = hash_string(dependency.name);
+	key = hash_combine(key, hash_string(dependency.prefix));
+	key = hash_combine(key, hash_strings(dependency.libs));
+	for (const char *variable : PKG_CONFIG_VARIABLES)
+	{
+		const char *value = std::getenv(variable);
+		key = hash_combine(key, hash_string(value ? value : ""));
+	}
+	return key;
+}
+
+bool is_current(const package_record &record, hash_t key)
+{
+	if (record.key != key)
+	{
+		return false;
+	}
+	for (const auto &[file, mtime_ns] : record.files)
+	{
+		if (file_mtime(file) != mtime_ns)
+			return false;
+	}
+	return true;
+}
+
+// A dependency with a prefix is looked up in prefix/{lib,lib64,share}/
+// pkgconfig first; every one of those .pc files is recorded, so one
+// installed later is picked up on the next build
+package_record resolve_package(const package_dependency &dependency,
+							   const fs::path &scratch_file)
+{
+	package_record record;
+	record.key = package_key(dependency);
+
+	std::string search_path;
+	if (!dependency.prefix.empty())
+	{
+		fs::path prefix = fs::path(dependency.prefix).lexically_normal();
+		for (const char *directory : { "lib", "lib64", "share" })
+		{
+			fs::path pkgconfig_directory = prefix / directory / "pkgconfig";
+			fs::path pc_file = pkgconfig_directory / (dependency.name + ".pc");
+			std::int64_t mtime_ns = file_mtime(pc_file);
+			record.files.emplace_back(pc_file.string(), mtime_ns);
+			if (mtime_ns != 0 && search_path.empty())
+				search_path = pkgconfig_directory.string();
+		}
+		if (search_path.empty())
+		{
+			resolve_from_prefix(dependency, record);
+			return record;
+		}
+	}
+
+	record.compile_flags = split_pkg_config_output(run_pkg_config(
+		{ "--cflags", dependency.name }, search_path, scratch_file));
+	record.link_flags = split_pkg_config_output(run_pkg_config(
+		{ "--libs", dependency.name }, search_path, scratch_file));
+	std::unordered_set<std::string> seen;
+	add_pc_files(dependency.name, search_path, scratch_file, record, seen);
+	return record;
+}
+
+std::vector<std::string> split_pkg_config_output(const std::string &output)
+{
+	std::vector<std::string> flags;
+	std::string flag;
+	bool in_flag = false;
+	for (std::size_t i = 0; i < output.size(); ++i)
+	{
+		char c = output[i];
+		if (c == '\\' && i + 1 < output.size())
+		{
+			flag += output[++i];
+			in_flag = true;
+		}
+		else if (std::isspace(static_cast<unsigned char>(c)))
+		{
+			if (in_flag)
+				flags.push_back(std::move(flag));
+			flag.clear();
+			in_flag = false;
+		}
+		else
+		{
+			flag += c;
+			in_flag = true;
+		}
+	}
+	if (in_flag)
+	{
+		flags.push_back(std::move(flag));
+	}
+	return flags;
+}
+} // namespace coup
@@ -0,0 +1,171 @@
+/* coup_path_table.cxx */
+#include "../include/coup_path_table.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../include/coup_hash.hxx"
+
+#define EMPTY_SLOT std::numeric_limits<path_id>::max()
+// slots of an empty table, always a power of two
+#define MIN_SLOTS 64
+
+namespace coup
+{
+// Returns the id of path, adding it to the table if it is new
+path_id path_table::intern(std::string_view path)
+{
+	if (slots.size() < 2 * (size() + 1))
+	{
+		grow();
+	}
+	std::size_t slot = slot_of(path);
+	if (slots[slot] != EMPTY_SLOT)
+	{
+		return slots[slot];
+	}
+	if (buffer.size() + path.size() + 1 >
+		std::numeric_limits<std::uint32_t>::max())
+	{
+		throw std::runtime_error("Too many paths to intern");
+	}
+	path_id id = static_cast<path_id>(size());
+	buffer.append(path);
+	buffer.push_back('\0');
+	offsets.push_back(static_cast<std::uint32_t>(buffer.size()));
+	slots[slot] = id;
+	return id;
+}
+
+std::optional<path_id> path_table::find(std::string_view path) const
+{
+	if (slots.empty())
+	{
+		return std::nullopt;
+	}
+	path_id id = slots[slot_of(path)];
+	return id == EMPTY_SLOT ? std::nullopt : std::optional<path_id>(id);
+}
+
+std::string_view path_table::get(path_id id) const
+{
+	return std::string_view(buffer).substr(offsets[id],
+										   offsets[id + 1] - offsets[id] - 1);
+}
+
+const char *path_table::c_str(path_id id) const
+{
+	return buffer.data() + offsets[id];
+}
+
+std::size_t path_table::size() const noexcept
+{
+	return offsets.size() - 1;
+}
+
+void path_table::clear()
+{
+	buffer.clear();
+	offsets.assign(1, 0);
+	slots.clear();
+}
+
+const std::string &path_table::get_buffer() const noexcept
+{
+	return buffer;
+}
+
+const std::vector<std::uint32_t> &path_table::get_offsets() const noexcept
+{
+	return offsets;
+}
+
+bool path_table::assign(std::string buffer_,
+						std::vector<std::uint32_t> offsets_)
+{
+	clear();
+	if (offsets_.empty() || offsets_.front() != 0 ||
+		offsets_.back() != buffer_.size())
+		return false;
+	for (std::size_t i = 1; i < offsets_.size(); ++i)
+	{
+		if (offsets_[i] <= offsets_[i - 1] || buffer_[offsets_[i] - 1] != '\0')
+			return false;
+	}
+	buffer = std::move(buffer_);
+	offsets = std::move(offsets_);
+	grow();
+	return true;
+}
+
+// slot holding path, or the empty slot where it would go
+std::size_t path_table::slot_of(std::string_view path) const
+{
+	std::size_t mask = slots.size() - 1;
+	std::size_t slot = static_cast<std::size_t>(hash_string(path)) & mask;
+	while (slots[slot] != EMPTY_SLOT && get(slots[slot]) != path)
+	{
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+// rebuilds the index, at most a quarter full afterwards
+void path_table::grow()
+{
+	std::size_t num_slots = MIN_SLOTS;
+	while (num_slots < 4 * (size() + 1))
+	{
+		num_slots *= 2;
+	}
+	slots.assign(num_slots, EMPTY_SLOT);
+	for (path_id id = 0; id < size(); ++id)
+	{
+		slots[slot_of(get(id))] = id;
+	}
+}
+
+// counting sort of the edges by their source node
+path_graph::path_graph(std::size_t num_nodes,
+					   const std::vector<std::pair<path_id, path_id>> &edges)
+	: offsets(num_nodes + 1, 0), targets(edges.size())
+{
+	for (const auto &[from, to] : edges)
+	{
+		offsets[from + 1]++;
+	}
+	for (std::size_t node = 0; node < num_nodes; ++node)
+	{
+		offsets[node + 1] += offsets[node];
+	}
+	std::vector<std::uint32_t> next(offsets.begin(), offsets.end() - 1);
+	for (const auto &[from, to] : edges)
+	{
+		targets[next[from]++] = to;
+	}
+}
+
+// targets of a node, empty for nodes the graph was not built with
+std::span<const path_id> path_graph::edges(path_id node) const
+{
+	if (node >= num_nodes())
+	{
+		return {};
+	}
+	return std::span<const path_id>(targets).subspan(
+		offsets[node], offsets[node + 1] - offsets[node]);
+}
+
+std::size_t path_graph::num_nodes() const noexcept
+{
+	return offsets.size() - 1;
+}
+} // namespace coup
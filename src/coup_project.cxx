@@ -2,285 +2,2275 @@
 #include "../include/coup_project.hxx"
 
 #include <algorithm>
-#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
 #include <filesystem>
+#include <iterator>
+#include <mutex>
 #include <optional>
-#include <ranges>
+#include <set>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <thread>
-#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "../include/coup_database.hxx"
+#include "../include/coup_distributed.hxx"
 #include "../include/coup_filesystem.hxx"
+#include "../include/coup_hash.hxx"
 #include "../include/coup_logger.hxx"
+#include "../include/coup_modules.hxx"
+#include "../include/coup_ninja.hxx"
+#include "../include/coup_packages.hxx"
+#include "../include/coup_parallel.hxx"
+#include "../include/coup_remote_cache.hxx"
+#include "../include/coup_stats.hxx"
 #include "../include/coup_system.hxx"
+#include "../include/coup_test_runner.hxx"
+#include "../include/coup_time_report.hxx"
+
+// parsed coup_config.json, in the build directory
+#define CONFIG_SNAPSHOT_FILE ".coup_config.cache"
+#define DATABASE_FILE ".coup_db"
+#define HASH_CACHE_FILE ".coup_hashes"
+#define OBJECT_DIRECTORY "obj"
+#define TEST_DIRECTORY "tests"
+#define TEST_CACHE_FILE ".coup_tests"
+// entries per section of the --profile-compiles report
+#define TIME_REPORT_LIMIT 10
+#define STATS_FILE ".coup_stats"
+#define COMPILATION_DATABASE_FILE "compile_commands.json"
+// what compile_commands.json was last written for
+#define COMPILATION_DATABASE_KEY_FILE ".coup_compdb"
+#define NINJA_FILE "build.ninja"
+// part of every remote cache key, bumped when what an entry holds changes
+#define REMOTE_CACHE_VERSION "coup-remote-1"
+// per profile: scanned modules of every source, and the directory with
+// the compiled module interfaces and the gcc module mapper
+#define MODULE_CACHE_FILE ".coup_modules"
+#define MODULE_DIRECTORY "modules"
+#define MODULE_MAPPER_FILE "mapper"
+// builds shown by `coup stats` and the size of the regression baseline
+#define STATS_HISTORY 10
+// slowdown over the baseline that counts as a regression
+#define STATS_REGRESSION_THRESHOLD 0.2
+// per profile: pkg-config output while resolving external libraries
+#define PACKAGE_SCRATCH_FILE ".coup_pkg_config"
 
 namespace fs = std::filesystem;
 namespace coup
 {
 
-coup_project::coup_project(const std::vector<fs::path>& source_files_,
-                           const std::vector<fs::path>& object_files_,
-                           const std::vector<fs::path>& source_directories_,
-                           const fs::path& build_directory_,
-                           const fs::path& executable_path_,
-                           const coup_json& coup_config_)
-	: source_files(source_files_),
-      object_files(object_files_),
-      source_directories(source_directories_),
-      build_directory(build_directory_),
-      executable_path(executable_path_)
-      coup_config(coup_config_)
-{}
-
-coup_project::coup_project(std::vector<fs::path>&& source_files_,
-                           std::vector<fs::path>&& object_files_,
-                           std::vector<fs::path>&& source_directories_,
-                           fs::path&& build_directory_, 
-                           fs::path&& executable_path_,
-                           coup_json&& coup_config_) noexcept
-    : source_files(std::move(source_files_)),
-      object_files(std::move(object_files_)),
-      source_directories(std::move(source_directories_)),
-      build_directory(std::move(build_directory_)),
-      executable_path(std::move(executable_path_))
-      coup_config(std::move(coup_config_))
-{}
+coup_project::coup_project(const fs::path &root_,
+						   const std::vector<fs::path> &source_directories_,
+						   const fs::path &build_directory_,
+						   const coup_json &coup_config_)
+	: root(root_)
+	, source_directories(source_directories_)
+	, build_directory(build_directory_)
+	, coup_config(coup_config_)
+{
+}
+
+coup_project::coup_project(fs::path &&root_,
+						   std::vector<fs::path> &&source_directories_,
+						   fs::path &&build_directory_,
+						   coup_json &&coup_config_) noexcept
+	: root(std::move(root_))
+	, source_directories(std::move(source_directories_))
+	, build_directory(std::move(build_directory_))
+	, coup_config(std::move(coup_config_))
+{
+}
 
 // static function: sets up and returns initialized coup_project
-// Find root directory
+// Find root directory and make it the working directory, so every path
+// coup composes (and every command it runs) is relative to the root
 // Find coup_config.json
 // Find source directories
 // Find build directory (okay if it doesn't actually exist yet)
-// Find source files
-// Find object files (okay if they don't actually exist yet)
-// Find executable path (okay if it doesn't actually exist yet)
 coup_project coup_project::make_project()
 {
-    fs::path root, coup_config, build_directory, executable_path;
-    std::vector<fs::path> source_directories, source_files, object_files;
-    coup_json coup_config;
-
-	try {
-        root = get_root_dir();
-    } catch (const std::runtime_error& e) {
-        // log error and exit
-    }
-    
-    coup_config_path = root / "coup_config.json";
-    if (!fs::exists(coup_config_path)) {
-        throw std::runtime_error("No coup_config.json found");
-    }
-    coup_config = coup_json(coup_config_path);
-    source_directories = config.get_source_directories();
-    build_directory = config.get_build_directory();
-
-    for (const fs::path& source_directory : source_directories) {
-        assert(fs::exists(source_directory);
-        std::vector<fs::path> new_sources = find_src_files(source_directory);
-        source_files.insert(source_files.back(), new_sources.begin(), 
-                            new_sources.end());
-    }
-    object_files = find_obj_files(build_directory);
-    executable_path = build_directory / config.get_executable();
-
-    return coup_project(std::move(source_files), 
-                        std::move(object_files),
-                        std::move(source_directories),
-                        std::move(build_directory),
-                        std::move(executable_path),
-                        std::move(coup_config));
-}
-
-
-// Executes build step with multiple parallel workers
-// Each worker completes the following task:
-//      - Retrieves a source file
-//      - Compiles source and prints compilation log
-//      - Stores a new object file for the compiled source
+	fs::path invocation_directory = fs::current_path();
+	fs::path root = get_root_dir();
+	fs::current_path(root);
+
+	coup_json coup_config =
+		coup_json::load(root / "coup_config.json", CONFIG_SNAPSHOT_FILE);
+
+	std::vector<fs::path> source_directories;
+	for (const std::string &source_directory :
+		 coup_config.get_source_directories())
+	{
+		source_directories.emplace_back(source_directory);
+	}
+	fs::path build_directory = coup_config.get_build_directory();
+
+	std::string default_profile = coup_config.get_default_profile();
+	coup_project project(std::move(root), std::move(source_directories),
+						 std::move(build_directory), std::move(coup_config));
+	project.select_profile(default_profile);
+	project.invocation_directory = std::move(invocation_directory);
+	return project;
+}
+
+// Switch to another profile, later commands build into its own
+// subdirectory of the build directory with its own build database
+// Throws std::runtime_error if the profile does not exist
+void coup_project::select_profile(const std::string &name)
+{
+	profile = coup_config.get_profile(name);
+	output_directory = build_directory / profile.name;
+}
+
+// Parse the options following the command, arguments that do not start
+// with '-' are collected as paths
+// Throws std::invalid_argument on an unknown option
+command_options parse_command_options(const std::vector<std::string> &args)
+{
+	command_options options;
+	for (auto it = args.begin(); it != args.end(); ++it)
+	{
+		const std::string &arg = *it;
+		if (arg == "--")
+		{
+			options.run_args.assign(it + 1, args.end());
+			break;
+		}
+		else if (arg == "--verbose" || arg == "-v")
+		{
+			options.verbose = true;
+		}
+		else if (arg.starts_with("--profile="))
+		{
+			options.profile = arg.substr(std::string("--profile=").size());
+		}
+		else if (arg == "--stale")
+		{
+			options.clean = clean_mode::stale;
+		}
+		else if (arg == "--all")
+		{
+			options.clean = clean_mode::all;
+		}
+		else if (arg == "--affected")
+		{
+			options.affected = true;
+		}
+		else if (arg == "--profile-compiles")
+		{
+			options.profile_compiles = true;
+		}
+		else if (arg.starts_with("--events="))
+		{
+			options.events = arg.substr(std::string("--events=").size());
+		}
+		else if (!arg.starts_with("-"))
+		{
+			options.paths.push_back(arg);
+		}
+		else
+		{
+			throw std::invalid_argument("Invalid option '" + arg + "'");
+		}
+	}
+	return options;
+}
+
+// Combined content hash of a source file and its dependencies
+// Returns std::nullopt if any of them can no longer be read, which always
+// forces a recompile
+static std::optional<hash_t>
+hash_inputs(hash_cache &hashes, const fs::path &source_file,
+			const std::vector<std::string> &dependencies)
+{
+	std::optional<hash_t> source_hash = hashes.hash_file(source_file);
+	if (!source_hash.has_value())
+	{
+		return std::nullopt;
+	}
+
+	hash_t input_hash = *source_hash;
+	for (const std::string &dependency : dependencies)
+	{
+		std::optional<hash_t> dependency_hash = hashes.hash_file(dependency);
+		if (!dependency_hash.has_value())
+		{
+			return std::nullopt;
+		}
+		input_hash = hash_combine(input_hash, *dependency_hash);
+	}
+	return input_hash;
+}
+
+// the same for the dependencies of a build database record, stat'ed
+// straight from the database's path table
+static std::optional<hash_t>
+hash_inputs(hash_cache &hashes, const fs::path &source_file,
+			const build_database &database,
+			std::span<const path_id> dependencies)
+{
+	std::optional<hash_t> source_hash = hashes.hash_file(source_file);
+	if (!source_hash.has_value())
+	{
+		return std::nullopt;
+	}
+
+	hash_t input_hash = *source_hash;
+	for (path_id dependency : dependencies)
+	{
+		std::optional<hash_t> dependency_hash =
+			hashes.hash_file(database.get_path(dependency));
+		if (!dependency_hash.has_value())
+		{
+			return std::nullopt;
+		}
+		input_hash = hash_combine(input_hash, *dependency_hash);
+	}
+	return input_hash;
+}
+
+// headers listed in a depfile, without the source file it was written for
+static std::vector<std::string>
+read_dependencies(const fs::path &dep_file, const fs::path &source_file)
+{
+	std::vector<std::string> dependencies = parse_dependency_file(dep_file);
+	std::string source = source_file.string();
+	std::erase(dependencies, source);
+	return dependencies;
+}
+
+namespace
+{
+// compile command and up-to-date check of one source file
+struct compile_job
+{
+	fs::path source_file;
+	fs::path object_file;
+	fs::path dep_file;
+	// compiler output, the gcc time report when profiling
+	fs::path log_file;
+	std::vector<std::string> arguments;
+	std::string compile_command;
+	hash_t command_hash = 0;
+	bool up_to_date = false;
+	// duration of the last compile, negative if never compiled
+	double expected_time = -1.0;
+	// expected time of the job and of the longest chain of jobs waiting
+	// for it, see compile_sources
+	double priority = 0.0;
+	// the source was edited since its object was written, or failed to
+	// compile last time; such jobs run first, newest edit first
+	bool urgent = false;
+	std::int64_t source_mtime_ns = 0;
+	// where the compiler writes the object and depfile when they are
+	// staged, see output_stager; empty otherwise
+	fs::path staged_object;
+	fs::path staged_dep;
+
+	// modules: the interface the source provides, if any, and those it is
+	// compiled against
+	bool uses_modules = false;
+	// a worker accepts its compile flags, see is_worker_compile
+	bool remote_allowed = false;
+	fs::path interface_file;
+	std::vector<fs::path> imported_interfaces;
+	// out of date jobs importing from this one, and the number of out of
+	// date jobs this one still waits for
+	std::vector<compile_job *> dependents;
+	int num_waiting = 0;
+};
+} // namespace
+
+// Remote cache entries of a compile are found through two keys
+// The manifest key names the compile: its command (which includes the
+// source and object paths) and the contents of the source. Its entry lists
+// how long the compile took and the headers it read, one per line
+// The object key adds the contents of those headers, its entry is the
+// object file
+// Returns std::nullopt if the source cannot be read
+static std::optional<hash_t> manifest_key(hash_cache &hashes,
+										  const compile_job &job)
+{
+	std::optional<hash_t> source_hash = hashes.hash_file(job.source_file);
+	if (!source_hash.has_value())
+	{
+		return std::nullopt;
+	}
+	return hash_combine(
+		hash_combine(hash_string(REMOTE_CACHE_VERSION), job.command_hash),
+		*source_hash);
+}
+
+// Replaces out of date objects with those the remote cache has for the
+// same inputs, in two batched rounds: one lookup of the manifests of every
+// stale source, then the objects of those whose headers are all unchanged
+// Fetched jobs are removed from stale_jobs and recorded in the database;
+// sources that provide or import a module are always compiled
+// Returns the number of fetched objects
+static int fetch_remote_objects(std::vector<compile_job *> &stale_jobs,
+								build_state &state, event_stream &events,
+								const std::string &compiler)
+{
+	remote_cache &cache = *state.cache;
+	std::vector<compile_job *> candidates;
+	std::vector<hash_t> manifest_hashes;
+	std::vector<std::string> manifest_keys;
+	for (compile_job *job : stale_jobs)
+	{
+		// a module interface would be missing, and an importer may only be
+		// reused once its interfaces are built
+		if (job->uses_modules)
+			continue;
+		std::optional<hash_t> key = manifest_key(state.hashes, *job);
+		if (key.has_value())
+		{
+			candidates.push_back(job);
+			manifest_hashes.push_back(*key);
+			manifest_keys.push_back(hash_to_string(*key));
+		}
+	}
+
+	std::vector<bool> found = cache.contains(manifest_keys);
+	std::size_t num_found = 0;
+	for (std::size_t i = 0; i < candidates.size(); ++i)
+	{
+		if (!found[i])
+			continue;
+		if (i != num_found)
+		{
+			candidates[num_found] = candidates[i];
+			manifest_hashes[num_found] = manifest_hashes[i];
+			manifest_keys[num_found] = std::move(manifest_keys[i]);
+		}
+		num_found++;
+	}
+	candidates.resize(num_found);
+	manifest_keys.resize(num_found);
+	std::vector<std::optional<std::string>> manifests =
+		cache.get(manifest_keys);
+
+	std::vector<compile_job *> fetches;
+	std::vector<build_record> records;
+	std::vector<std::string> object_keys;
+	for (std::size_t i = 0; i < candidates.size(); ++i)
+	{
+		if (!manifests[i].has_value())
+			continue;
+		compile_job &job = *candidates[i];
+		build_record record;
+		record.source = job.source_file.string();
+		record.object = job.object_file.string();
+		record.command_hash = job.command_hash;
+		std::istringstream manifest(*manifests[i]);
+		if (!(manifest >> record.compile_time >> std::ws))
+			continue;
+		std::string dependency;
+		while (std::getline(manifest, dependency))
+		{
+			record.dependencies.push_back(dependency);
+		}
+		std::optional<hash_t> input_hash =
+			hash_inputs(state.hashes, job.source_file, record.dependencies);
+		if (!input_hash.has_value())
+			continue;
+		record.input_hash = *input_hash;
+		fetches.push_back(&job);
+		records.push_back(std::move(record));
+		object_keys.push_back(
+			hash_to_string(hash_combine(manifest_hashes[i], *input_hash)));
+	}
+
+	std::vector<std::optional<std::string>> objects = cache.get(object_keys);
+	std::unordered_set<const compile_job *> fetched;
+	for (std::size_t i = 0; i < fetches.size(); ++i)
+	{
+		if (!objects[i].has_value())
+			continue;
+		compile_job &job = *fetches[i];
+		write_file_if_changed(job.object_file, *objects[i]);
+		// the time report belongs to an older compile
+		std::error_code ec;
+		fs::remove(time_report_file(job.object_file, compiler), ec);
+		state.database.update(std::move(records[i]));
+		events.emit("cache_hit",
+					{ { "source", job.source_file }, { "remote", true } });
+		fetched.insert(&job);
+	}
+	std::erase_if(stale_jobs, [&](const compile_job *job)
+				  { return fetched.contains(job); });
+	return static_cast<int>(fetched.size());
+}
+
+// Preprocesses a source locally and compiles it on a worker, leaving the
+// object, depfile and compiler output where a local compile leaves them
+// compile_seconds receives how long the compile took on the worker
+// Returns whether it compiled, or std::nullopt if the worker failed and
+// the source has to be compiled locally instead
+static std::optional<bool> compile_remotely(remote_worker &worker,
+											const compile_job &job,
+											const compile_options &options,
+											double &compile_seconds)
+{
+	try
+	{
+		auto start = std::chrono::steady_clock::now();
+		fs::path pre_file = job.object_file;
+		pre_file.replace_extension(".ii");
+		std::error_code ec;
+		if (spawn_process(make_preprocess_arguments(job.source_file, pre_file,
+													job.object_file,
+													job.dep_file, options),
+						  job.log_file) != 0)
+		{
+			fs::remove(pre_file, ec);
+			return false;
+		}
+		std::string output = file_contents(job.log_file);
+		std::optional<remote_compile> result =
+			worker.compile(make_preprocessed_compile_arguments(options),
+						   file_contents(pre_file));
+		fs::remove(pre_file, ec);
+		if (!result.has_value())
+		{
+			return std::nullopt;
+		}
+
+		write_file_if_changed(job.log_file, output + result->output);
+		if (result->exit_code == 0)
+		{
+			write_file_if_changed(job.object_file, result->object);
+		}
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+		compile_seconds = result->seconds;
+		worker.add_overhead(elapsed.count() - result->seconds);
+		return result->exit_code == 0;
+	}
+	catch (const std::exception &)
+	{
+		return std::nullopt;
+	}
+}
+
+// Queues a freshly compiled object and its manifest for upload to the
+// remote cache, the object first so a manifest never leads to nothing
+static void upload_remote_object(remote_cache &cache, hash_cache &hashes,
+								 const compile_job &job,
+								 const build_record &record)
+{
+	std::optional<hash_t> key = manifest_key(hashes, job);
+	if (!key.has_value())
+	{
+		return;
+	}
+	std::ostringstream manifest;
+	manifest << record.compile_time << '\n';
+	for (const std::string &dependency : record.dependencies)
+	{
+		manifest << dependency << '\n';
+	}
+	cache.put(hash_to_string(hash_combine(*key, record.input_hash)),
+			  file_contents(job.staged_object.empty() ? job.object_file
+													 : job.staged_object));
+	cache.put(hash_to_string(*key), manifest.str());
+}
+
+// points the object and depfile arguments of a job at its staged outputs,
+// -pipe keeps the compiler's temporaries in memory as well
+static void stage_arguments(compile_job &job)
+{
+	for (std::size_t i = 1; i + 1 < job.arguments.size(); ++i)
+	{
+		if (job.arguments[i] == "-o")
+			job.arguments[i + 1] = job.staged_object.string();
+		else if (job.arguments[i] == "-MF")
+			job.arguments[i + 1] = job.staged_dep.string();
+	}
+	job.arguments.insert(job.arguments.begin() + 1, "-pipe");
+	job.compile_command = join_arguments(job.arguments);
+}
+
+// path of a command line argument relative to the project root, which is
+// how the build database names files
+std::string coup_project::project_path(const std::string &path) const
+{
+	return (invocation_directory / path)
+		.lexically_normal()
+		.lexically_relative(root)
+		.string();
+}
+
+// returns every source file found in a list of directories
+std::vector<fs::path>
+coup_project::find_sources(const std::vector<fs::path> &directories) const
+{
+	std::vector<fs::path> source_files;
+	for (const fs::path &source_directory : directories)
+	{
+		std::vector<fs::path> new_source_files =
+			find_src_files(source_directory);
+		source_files.insert(source_files.end(),
+							std::make_move_iterator(new_source_files.begin()),
+							std::make_move_iterator(new_source_files.end()));
+	}
+	return source_files;
+}
+
+// Load the build database of the selected profile and the shared file
+// hash cache; records of sources that were deleted are dropped
+void coup_project::load_state(build_state &state) const
+{
+	fs::create_directories(output_directory);
+	state.database.load(output_directory / DATABASE_FILE);
+	// file hashes do not depend on the profile, so all profiles share them
+	state.hashes.load(build_directory / HASH_CACHE_FILE);
+
+	// COUP_REMOTE_CACHE overrides the config, set empty it disables the cache
+	const char *remote_cache_env = std::getenv("COUP_REMOTE_CACHE");
+	std::string remote_cache_url = remote_cache_env != nullptr
+									   ? remote_cache_env
+									   : coup_config.get_remote_cache();
+	if (!remote_cache_url.empty())
+	{
+		std::optional<http_url> url = parse_http_url(remote_cache_url);
+		if (!url.has_value())
+		{
+			throw std::runtime_error("Invalid remote cache '" +
+									 remote_cache_url +
+									 "', expected http://host[:port][/path]");
+		}
+		state.cache = std::make_unique<remote_cache>(std::move(*url));
+	}
+
+	for (const std::string &source : state.database.get_sources())
+	{
+		if (!fs::exists(source))
+		{
+			state.database.erase(source);
+		}
+	}
+}
+
+// persist the build database and file hashes after a command
+// Staged outputs are published first, the database must not name an
+// object the build directory does not have yet; an output that could not
+// be published is removed, so its source is compiled again next time
+void coup_project::save_state(build_state &state) const
+{
+	if (state.stager != nullptr)
+	{
+		std::error_code ec;
+		for (const fs::path &output : state.stager->finish())
+			fs::remove(output, ec);
+		state.stager.reset();
+	}
+	state.hashes.save(build_directory / HASH_CACHE_FILE);
+	state.database.save(output_directory / DATABASE_FILE);
+}
+
+// Compile and link flags of every external library in "dependencies",
+// taken from the build database as long as none of the .pc files they
+// were resolved from changed, so a no-op build runs no pkg-config
+// Throws std::runtime_error if a library is not found
+void coup_project::resolve_packages(build_state &state)
+{
+	package_compile_flags.clear();
+	package_link_flags.clear();
+	fs::path scratch_file = output_directory / PACKAGE_SCRATCH_FILE;
+	for (const package_dependency &dependency :
+		 coup_config.get_dependencies())
+	{
+		const package_record *record =
+			state.database.find_package(dependency.name);
+		if (record == nullptr || !is_current(*record, package_key(dependency)))
+		{
+			state.database.set_package(
+				dependency.name, resolve_package(dependency, scratch_file));
+			record = state.database.find_package(dependency.name);
+		}
+		package_compile_flags.insert(package_compile_flags.end(),
+									 record->compile_flags.begin(),
+									 record->compile_flags.end());
+		package_link_flags.insert(package_link_flags.end(),
+								  record->link_flags.begin(),
+								  record->link_flags.end());
+	}
+	std::error_code ec;
+	fs::remove(scratch_file, ec);
+}
+
+// Workers from COUP_WORKERS (comma separated) or "workers" in
+// coup_config.json that answer; COUP_WORKERS set empty disables them
+// Throws std::runtime_error for an address that is not host:port or
+// unix:<path>
+std::vector<std::unique_ptr<remote_worker>>
+coup_project::connect_workers() const
+{
+	std::vector<std::string> addresses;
+	if (const char *env = std::getenv("COUP_WORKERS"))
+	{
+		std::istringstream list(env);
+		std::string address;
+		while (std::getline(list, address, ','))
+		{
+			if (!address.empty())
+				addresses.push_back(address);
+		}
+	}
+	else
+	{
+		addresses = coup_config.get_workers();
+	}
+
+	std::vector<std::unique_ptr<remote_worker>> workers;
+	for (const std::string &address : addresses)
+	{
+		std::optional<http_url> url = parse_socket_address(address);
+		if (!url.has_value())
+		{
+			throw std::runtime_error("Invalid worker '" + address +
+									 "', expected host:port or unix:<path>");
+		}
+		workers.push_back(
+			std::make_unique<remote_worker>(address, std::move(*url)));
+	}
+	if (workers.empty())
+	{
+		return workers;
+	}
+
+	std::vector<char> reachable(workers.size(), false);
+	parallel_for(workers.size(),
+				 [&](std::size_t i) { reachable[i] = workers[i]->connect(); });
+	int num_slots = 0;
+	std::vector<std::unique_ptr<remote_worker>> connected;
+	for (std::size_t i = 0; i < workers.size(); ++i)
+	{
+		if (!reachable[i])
+			continue;
+		num_slots += workers[i]->get_slots();
+		connected.push_back(std::move(workers[i]));
+	}
+	print_workers(num_slots, static_cast<int>(connected.size()),
+				  static_cast<int>(workers.size()));
+	return connected;
+}
+
+// Scans source_files for the C++20 modules they provide and import and
+// links them into graph (see make_module_graph)
+// The P1689 scanner of the compiler is used if it has one, otherwise coup
+// reads the module declarations itself (see find_module_scanner); scans
+// are kept in <profile>/.coup_modules until the compile command or
+// contents of the source change
+// Remembers the module flags of every source for compile_arguments and
+// writes the gcc module mapper of the profile
+// If the function returns a string, a scan failed or the modules do not
+// form a DAG
+std::optional<std::string>
+coup_project::resolve_modules(const std::vector<fs::path> &source_files,
+							  build_state &state, module_graph &graph)
+{
+	std::string compiler = coup_config.get_compiler();
+	fs::path object_directory = output_directory / OBJECT_DIRECTORY;
+	fs::path cache_file = output_directory / MODULE_CACHE_FILE;
+	module_scan_cache cache;
+	cache.load(cache_file);
+
+	std::vector<compile_options> options(source_files.size());
+	std::vector<std::optional<hash_t>> keys(source_files.size());
+	std::vector<module_scan> scans(source_files.size());
+	std::vector<char> scanned(source_files.size(), false);
+	parallel_for(
+		source_files.size(),
+		[&](std::size_t i)
+		{
+			const fs::path &source = source_files[i];
+			options[i] = source_compile_options(source);
+			std::optional<hash_t> source_hash = state.hashes.hash_file(source);
+			if (!source_hash.has_value())
+				return;
+			keys[i] = hash_combine(
+				hash_strings(make_compile_arguments(
+					source, make_output_file(source, object_directory, "o"),
+					make_output_file(source, object_directory, "d"),
+					options[i])),
+				*source_hash);
+			const module_scan *scan = cache.find(source.string(), *keys[i]);
+			if (scan != nullptr)
+			{
+				scans[i] = *scan;
+				scanned[i] = true;
+			}
+		});
+
+	std::vector<std::size_t> unscanned;
+	std::vector<fs::path> scan_files;
+	for (std::size_t i = 0; i < source_files.size(); ++i)
+	{
+		if (!keys[i].has_value())
+			return "Failed to read " + source_files[i].string();
+		if (!scanned[i])
+		{
+			unscanned.push_back(i);
+			scan_files.push_back(
+				make_output_file(source_files[i], object_directory, "ddi"));
+		}
+	}
+
+	if (!unscanned.empty())
+	{
+		if (!make_parent_directories(scan_files))
+		{
+			return "Failed to create object directories in " +
+				   output_directory.string();
+		}
+		module_scanner scanner = find_module_scanner(compiler);
+		std::vector<std::optional<module_scan>> results(unscanned.size());
+		std::vector<std::string> outputs(unscanned.size());
+		parallel_for(unscanned.size(),
+					 [&](std::size_t j)
+					 {
+						 const fs::path &source = source_files[unscanned[j]];
+						 results[j] = scan_modules(
+							 scanner, source,
+							 make_output_file(source, object_directory, "o"),
+							 scan_files[j], options[unscanned[j]],
+							 outputs[j]);
+					 });
+
+		std::string error_message = "";
+		for (std::size_t j = 0; j < unscanned.size(); ++j)
+		{
+			std::size_t i = unscanned[j];
+			if (!results[j].has_value())
+			{
+				std::string error = "Failed to scan " +
+									source_files[i].string() + " for modules";
+				print_error(outputs[j].empty() ? error
+											   : error + "\n" + outputs[j]);
+				error_message += "\n\t" + error;
+				continue;
+			}
+			scans[i] = *results[j];
+			cache.record(source_files[i].string(), *keys[i],
+						 std::move(*results[j]));
+		}
+		cache.save(cache_file);
+		if (!error_message.empty())
+			return error_message;
+	}
+
+	std::optional<std::string> error =
+		make_module_graph(source_files, std::move(scans), graph);
+	if (error.has_value())
+	{
+		return error;
+	}
+
+	fs::path interface_directory = output_directory / MODULE_DIRECTORY;
+	fs::path mapper_file = interface_directory / MODULE_MAPPER_FILE;
+	bool provides_modules = false;
+	for (std::size_t i = 0; i < source_files.size(); ++i)
+	{
+		std::vector<std::string> flags =
+			module_flags(graph, i, source_files[i], interface_directory,
+						 mapper_file, compiler);
+		if (flags.empty())
+			source_module_flags.erase(source_files[i].string());
+		else
+			source_module_flags[source_files[i].string()] = std::move(flags);
+		provides_modules |= !graph.units[i].provides.empty();
+	}
+	if (provides_modules)
+	{
+		fs::create_directories(interface_directory);
+		if (!is_clang_compiler(compiler))
+			write_file_if_changed(
+				mapper_file,
+				make_module_mapper(graph, interface_directory, compiler));
+	}
+	return std::nullopt;
+}
+
+// Compiles source files with multiple parallel workers
+// Objects and depfiles are written below <profile>/obj at the same relative
+// path as their source, so equally named sources in different directories
+// never collide
+// Each source file is first checked against the build database: its
+// object is reused if the object exists, the compile command hashes to
+// the value recorded when it was built, and the source and its headers
+// still hash to the recorded contents
+// With profile_compiles, the compiler's timing flags are added (but not
+// hashed) and sources whose object has no time report are compiled again;
+// compiling without them removes the time report of the object
+// With a remote cache, out of date objects it has are fetched instead (see
+// fetch_remote_objects) and every compiled object is uploaded to it
+// With workers, each of their slots takes jobs next to the local ones (see
+// compile_remotely), as long as a job costs more than shipping it
+// The remaining sources are compiled longest first, by the time their last
+// compile took, so a slow source does not start last and hold up the build
+// With "modules", sources are scanned first (see resolve_modules): a
+// source importing a module waits until the interface is compiled, and is
+// compiled again whenever the interface is. Jobs then go by the length of
+// the longest chain of compiles waiting on them, so the interfaces on the
+// critical path of the build are compiled first
+// Each worker then completes the following task:
+//      - Retrieves an out of date source file
+//      - Compiles source and reports it to the build progress
+//      - Records the command and input hashes of the new object file
+// object_files receives the object of every source, in source order, and
+// num_compiled the number of sources that were compiled or fetched
+// If the function returns a string, an error has occurred and the string
+// will contain a description of the error
+// Otherwise, std::nullopt will be returned
+std::optional<std::string>
+coup_project::compile_sources(const std::vector<fs::path> &source_files,
+							  build_state &state,
+							  std::vector<fs::path> &object_files,
+							  int &num_compiled, bool verbose,
+							  bool profile_compiles)
+{
+	build_database &database = state.database;
+	hash_cache &hashes = state.hashes;
+	build_metrics &metrics = state.metrics;
+	auto check_start = std::chrono::steady_clock::now();
+
+	module_graph graph;
+	if (coup_config.get_modules())
+	{
+		std::optional<std::string> error =
+			resolve_modules(source_files, state, graph);
+		if (error.has_value())
+			return error;
+	}
+
+	// compile commands and up-to-date checks for every source file
+	std::vector<compile_job> jobs(source_files.size());
+	parallel_for(
+		source_files.size(),
+		[&](std::size_t i)
+		{
+			compile_job &job = jobs[i];
+			job.source_file = source_files[i];
+			job.object_file = make_output_file(
+				job.source_file, output_directory / OBJECT_DIRECTORY, "o");
+			job.dep_file = make_output_file(
+				job.source_file, output_directory / OBJECT_DIRECTORY, "d");
+
+			job.arguments = compile_arguments(job.source_file);
+			job.command_hash = hash_strings(job.arguments);
+			job.log_file = job.object_file;
+			job.log_file.replace_extension(".log");
+			if (profile_compiles)
+			{
+				std::string compiler = coup_config.get_compiler();
+				std::vector<std::string> flags = time_report_flags(compiler);
+				job.arguments.insert(job.arguments.begin() + 1, flags.begin(),
+									 flags.end());
+				// gcc prints its time report with the other output
+				if (!is_clang_compiler(compiler))
+					job.log_file =
+						time_report_file(job.object_file, compiler);
+			}
+			job.compile_command = join_arguments(job.arguments);
+			if (!graph.units.empty())
+			{
+				std::string compiler = coup_config.get_compiler();
+				fs::path interface_directory =
+					output_directory / MODULE_DIRECTORY;
+				const module_scan &unit = graph.units[i];
+				job.uses_modules = unit.uses_modules();
+				if (!unit.provides.empty())
+					job.interface_file = module_interface_file(
+						interface_directory, unit.provides, compiler);
+				for (const std::string &name : graph.imports[i])
+					job.imported_interfaces.push_back(module_interface_file(
+						interface_directory, name, compiler));
+			}
+
+			std::optional<build_record_view> record =
+				database.view(job.source_file.native());
+			if (record.has_value())
+			{
+				job.expected_time = record->compile_time;
+			}
+			if (!record.has_value() ||
+				record->command_hash != job.command_hash ||
+				record->object != job.object_file.native() ||
+				!fs::exists(job.object_file) ||
+				(!job.interface_file.empty() &&
+				 !fs::exists(job.interface_file)))
+			{
+				return;
+			}
+			if (profile_compiles &&
+				!fs::exists(time_report_file(job.object_file,
+											 coup_config.get_compiler())))
+			{
+				return;
+			}
+			job.up_to_date = hash_inputs(hashes, job.source_file, database,
+										 record->dependencies) ==
+							 record->input_hash;
+		});
+
+	// an importer is out of date with any interface it imports, and waits
+	// for it to be compiled
+	for (std::size_t unit : graph.order)
+	{
+		for (std::size_t dependency : graph.dependencies[unit])
+		{
+			if (!jobs[dependency].up_to_date)
+			{
+				jobs[unit].up_to_date = false;
+				jobs[dependency].dependents.push_back(&jobs[unit]);
+				jobs[unit].num_waiting++;
+			}
+		}
+	}
+
+	object_files.clear();
+	object_files.reserve(jobs.size());
+	std::vector<compile_job *> stale_jobs;
+	for (compile_job &job : jobs)
+	{
+		object_files.push_back(job.object_file);
+		if (!job.up_to_date)
+		{
+			stale_jobs.push_back(&job);
+		}
+		else
+		{
+			events->emit("cache_hit", { { "source", job.source_file } });
+		}
+	}
+
+	// create the mirrored object tree before any compile starts
+	std::vector<fs::path> output_files;
+	output_files.reserve(stale_jobs.size());
+	for (const compile_job *job : stale_jobs)
+	{
+		output_files.push_back(job->object_file);
+	}
+	if (!make_parent_directories(output_files))
+	{
+		return "Failed to create object directories in " +
+			   output_directory.string();
+	}
+
+	// objects the remote cache has need no compile; a profiled build
+	// needs the time reports only a compile writes
+	int num_fetched = 0;
+	if (state.cache != nullptr && !profile_compiles && !stale_jobs.empty())
+	{
+		std::size_t num_stale = stale_jobs.size();
+		num_fetched = fetch_remote_objects(stale_jobs, state, *events,
+										   coup_config.get_compiler());
+		if (num_fetched > 0)
+			print_remote_fetch(num_fetched, static_cast<int>(num_stale));
+	}
+
+	// with a staging directory compilers write there instead of to the
+	// build directory, see output_stager; module interfaces and time
+	// reports stay next to the objects
+	std::string staging = coup_config.get_staging();
+	if (const char *env = std::getenv("COUP_STAGING"))
+	{
+		staging = env;
+	}
+	if (!staging.empty() && !profile_compiles && !stale_jobs.empty())
+	{
+		if (state.stager == nullptr)
+			state.stager =
+				std::make_unique<output_stager>(staging, output_directory);
+		std::vector<fs::path> staged_files;
+		for (compile_job *job : stale_jobs)
+		{
+			if (job->uses_modules)
+				continue;
+			job->staged_object = state.stager->staged_file(job->object_file);
+			job->staged_dep = state.stager->staged_file(job->dep_file);
+			job->log_file = state.stager->staged_file(job->log_file);
+			stage_arguments(*job);
+			staged_files.push_back(job->staged_object);
+		}
+		if (!make_parent_directories(staged_files))
+			return "Failed to create staging directories in " + staging;
+	}
+
+	// longest first: workers take jobs from the back, sources that were
+	// never compiled are expected to take as long as the average one
+	double known_time = 0.0;
+	int num_known = 0;
+	for (const compile_job *job : stale_jobs)
+	{
+		if (job->expected_time >= 0.0)
+		{
+			known_time += job->expected_time;
+			num_known++;
+		}
+	}
+	double average_time = num_known > 0 ? known_time / num_known : 1.0;
+	auto expected_time = [&](const compile_job *job)
+	{ return job->expected_time >= 0.0 ? job->expected_time : average_time; };
+	// a job's priority adds the highest priority of the jobs waiting for
+	// it, which without modules leaves the expected time
+	for (compile_job *job : stale_jobs)
+	{
+		job->priority = expected_time(job);
+	}
+	for (auto unit = graph.order.rbegin(); unit != graph.order.rend(); ++unit)
+	{
+		compile_job &job = jobs[*unit];
+		for (const compile_job *dependent : job.dependents)
+		{
+			job.priority = std::max(job.priority,
+									expected_time(&job) + dependent->priority);
+		}
+	}
+	// what is being worked on is heard back from first: sources edited
+	// since their object was written and those that failed last time go
+	// ahead of the critical path
+	for (compile_job *job : stale_jobs)
+	{
+		std::optional<file_stamp> source_stamp =
+			get_file_stamp(job->source_file);
+		std::optional<file_stamp> object_stamp =
+			get_file_stamp(job->object_file);
+		if (source_stamp.has_value())
+			job->source_mtime_ns = source_stamp->mtime_ns;
+		job->urgent =
+			database.has_failed(job->source_file.string()) ||
+			(source_stamp.has_value() && object_stamp.has_value() &&
+			 source_stamp->mtime_ns > object_stamp->mtime_ns);
+	}
+	std::stable_sort(stale_jobs.begin(), stale_jobs.end(),
+					 [&](const compile_job *a, const compile_job *b)
+					 {
+						 if (a->urgent != b->urgent)
+							 return b->urgent;
+						 if (a->urgent)
+							 return a->source_mtime_ns < b->source_mtime_ns;
+						 return a->priority < b->priority;
+					 });
+
+	for (auto it = stale_jobs.rbegin(); it != stale_jobs.rend(); ++it)
+	{
+		events->emit("job_scheduled",
+					 { { "source", (*it)->source_file },
+					   { "expected_seconds", expected_time(*it) } });
+	}
+
+	// Critical sections needed locking:
+	//      - removing from stale_jobs vector, and the jobs waiting for
+	//        a module interface
+	//      - collecting error messages
+	//      - updating the build database
+	// progress does its own locking
+	std::mutex stale_jobs_mtx;
+	std::condition_variable stale_jobs_cv;
+	int num_running = 0;
+	std::mutex error_mtx;
+	std::mutex database_mtx;
+
+	std::atomic<bool> build_success = true;
+
+	int total = static_cast<int>(stale_jobs.size());
+	num_compiled = total + num_fetched;
+	double total_cost = 0.0;
+	for (const compile_job *job : stale_jobs)
+	{
+		total_cost += expected_time(job);
+	}
+	// remote slots join the local ones; a profiled build stays local, the
+	// time reports are written next to the compiler
+	std::vector<std::unique_ptr<remote_worker>> workers;
+	if (!profile_compiles && total > 0)
+	{
+		workers = connect_workers();
+	}
+	if (!workers.empty())
+	{
+		for (compile_job *job : stale_jobs)
+			job->remote_allowed =
+				is_worker_compile(make_preprocessed_compile_arguments(
+					source_compile_options(job->source_file)));
+	}
+	build_progress progress(total, total_cost, verbose);
+
+	std::string error_message = "";
+
+	// Hands the interface of a finished job to the jobs waiting for it
+	// If the job failed, they and the jobs waiting for them are dropped
+	auto release_dependents = [&](compile_job *job, bool compiled)
+	{
+		std::vector<compile_job *> skipped;
+		{
+			std::lock_guard<std::mutex> lock(stale_jobs_mtx);
+			num_running--;
+			std::vector<compile_job *> dependents = job->dependents;
+			while (!dependents.empty())
+			{
+				compile_job *dependent = dependents.back();
+				dependents.pop_back();
+				if (compiled)
+				{
+					dependent->num_waiting--;
+					continue;
+				}
+				auto it = std::find(stale_jobs.begin(), stale_jobs.end(),
+									dependent);
+				if (it == stale_jobs.end())
+					continue;
+				stale_jobs.erase(it);
+				skipped.push_back(dependent);
+				dependents.insert(dependents.end(),
+								  dependent->dependents.begin(),
+								  dependent->dependents.end());
+			}
+		}
+		stale_jobs_cv.notify_all();
+		for (const compile_job *dependent : skipped)
+		{
+			std::string error = "Skipped " + dependent->source_file.string() +
+								", a module it imports failed to compile";
+			progress.print_error(error);
+			std::lock_guard<std::mutex> lock(error_mtx);
+			error_message += "\n\t" + error;
+		}
+	};
+
+	// a worker without a remote_worker compiles locally, one with it
+	// occupies a slot of that worker
+	auto build_worker = [&](remote_worker *worker)
+	{
+		bool worker_lost = false;
+		while (!worker_lost)
+		{
+			compile_job *job;
+			{
+				std::unique_lock<std::mutex> lock(stale_jobs_mtx);
+				// the first job from the back whose interfaces are built;
+				// jobs with modules stay local, next to the interfaces,
+				// urgent ones too, they are needed back soonest, and those
+				// with flags a worker refuses
+				// a job is only shipped if it costs more to compile than to
+				// ship, so a remote slot never holds up the end of a build;
+				// it passes cheap jobs over for the local slots and takes
+				// the expensive ones behind them
+				auto is_ready = [&](const compile_job *candidate)
+				{
+					return candidate->num_waiting == 0 &&
+						   (worker == nullptr ||
+							(candidate->remote_allowed &&
+							 !candidate->uses_modules && !candidate->urgent &&
+							 expected_time(candidate) >=
+								 worker->get_overhead()));
+				};
+				auto ready = std::find_if(stale_jobs.rbegin(),
+										  stale_jobs.rend(), is_ready);
+				while (ready == stale_jobs.rend())
+				{
+					// jobs are left that wait for interfaces still being
+					// compiled; a remote slot could never take them
+					if (stale_jobs.empty() || worker != nullptr ||
+						num_running == 0)
+						return;
+					stale_jobs_cv.wait(lock);
+					ready = std::find_if(stale_jobs.rbegin(),
+										 stale_jobs.rend(), is_ready);
+				}
+				job = *ready;
+				stale_jobs.erase(std::next(ready).base());
+				num_running++;
+			}
+			// log the path, equally named sources may live in different
+			// directories
+			std::string source_filename = job->source_file.string();
+			progress.start_job(source_filename, job->compile_command);
+			events->emit("job_started",
+						 { { "source", source_filename },
+						   { "command", job->compile_command },
+						   { "worker", worker != nullptr
+										   ? worker->get_address()
+										   : "local" } });
+
+			if (!profile_compiles)
+			{
+				// a time report of an older compile would be mistaken for
+				// one of this object
+				std::error_code ec;
+				fs::remove(time_report_file(job->object_file,
+											coup_config.get_compiler()),
+						   ec);
+			}
+			// compiler output is captured so it is printed in one piece,
+			// never interleaved with other compiles or the status line
+			auto compile_start = std::chrono::steady_clock::now();
+			std::optional<bool> remote_compiled;
+			double remote_seconds = 0.0;
+			if (worker != nullptr)
+			{
+				remote_compiled = compile_remotely(
+					*worker, *job,
+					source_compile_options(job->source_file),
+					remote_seconds);
+				// the worker is gone, this slot compiles this job locally
+				// and then stops
+				worker_lost = !remote_compiled.has_value();
+			}
+			bool compiled = remote_compiled.has_value()
+								? *remote_compiled
+								: spawn_process(job->arguments,
+												job->log_file) == 0;
+			std::chrono::duration<double> compile_time =
+				std::chrono::steady_clock::now() - compile_start;
+			std::string output =
+				strip_time_report(file_contents(job->log_file));
+			progress.print_output(output);
+			progress.finish_job(expected_time(job));
+			if (!output.empty())
+			{
+				events->emit("diagnostics", { { "source", source_filename },
+											  { "output", output } });
+			}
+			events->emit("job_finished",
+						 { { "source", source_filename },
+						   { "seconds", compile_time.count() },
+						   { "success", compiled } });
+
+			if (!compiled)
+			{
+				std::string error = "Failed to compile " + source_filename;
+				progress.print_error(error);
+				{
+					std::lock_guard<std::mutex> lock(error_mtx);
+					error_message += "\n\t" + error;
+				}
+				{
+					std::lock_guard<std::mutex> lock(database_mtx);
+					database.mark_failed(job->source_file.string());
+				}
+				build_success = false;
+				release_dependents(job, false);
+				continue;
+			}
+
+			build_record record;
+			record.source = job->source_file.string();
+			record.object = job->object_file.string();
+			record.command_hash = job->command_hash;
+			// the time the compile itself took, wherever it ran
+			record.compile_time = remote_compiled.has_value()
+									  ? remote_seconds
+									  : compile_time.count();
+			// a remote compile writes into the build directory
+			if (remote_compiled.has_value())
+			{
+				job->staged_object.clear();
+				job->staged_dep.clear();
+			}
+			record.dependencies = read_dependencies(
+				job->staged_dep.empty() ? job->dep_file : job->staged_dep,
+				job->source_file);
+			for (const fs::path &interface_file : job->imported_interfaces)
+			{
+				if (std::find(record.dependencies.begin(),
+							  record.dependencies.end(),
+							  interface_file.string()) ==
+					record.dependencies.end())
+					record.dependencies.push_back(interface_file.string());
+			}
+			std::optional<hash_t> input_hash =
+				hash_inputs(hashes, job->source_file, record.dependencies);
+
+			if (input_hash.has_value())
+			{
+				record.input_hash = *input_hash;
+				if (state.cache != nullptr)
+					upload_remote_object(*state.cache, hashes, *job, record);
+			}
+			if (!job->staged_object.empty())
+			{
+				state.stager->publish(job->staged_object, job->object_file);
+				state.stager->publish(job->staged_dep, job->dep_file);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(database_mtx);
+				metrics.units.push_back(
+					{ record.source, record.compile_time });
+				if (input_hash.has_value())
+				{
+					database.update(std::move(record));
+				}
+				else
+				{
+					database.erase(job->source_file.string());
+				}
+			}
+			release_dependents(job, true);
+		}
+	};
+
+	unsigned int num_threads =
+		std::min<unsigned int>(default_job_count(), std::max(total, 1));
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads);
+
+	auto compile_start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> check_time = compile_start - check_start;
+
+	unsigned int i;
+	for (i = 0; i < num_threads; ++i)
+		threads.emplace_back(build_worker, nullptr);
+	// remote slots beyond the number of jobs would stay idle
+	int num_remote = 0;
+	for (const std::unique_ptr<remote_worker> &worker : workers)
+	{
+		for (int slot = 0; slot < worker->get_slots() && num_remote < total;
+			 ++slot, ++num_remote)
+			threads.emplace_back(build_worker, worker.get());
+	}
+	num_threads = static_cast<unsigned int>(threads.size());
+	for (std::thread &th : threads)
+		th.join();
+
+	std::chrono::duration<double> compile_time =
+		std::chrono::steady_clock::now() - compile_start;
+	metrics.check_time += check_time.count();
+	metrics.num_sources += static_cast<int>(jobs.size());
+	if (total > 0)
+	{
+		metrics.compile_time += compile_time.count();
+		metrics.num_compiled += total;
+		metrics.num_jobs = std::max(metrics.num_jobs, num_threads);
+	}
+
+	if (!build_success)
+	{
+		assert(!error_message.empty());
+		return error_message;
+	}
+	return std::nullopt;
+}
+
+// Links object files into target unless the target exists, no object was
+// recompiled and the link command hashes to the recorded value
+// If the function returns a string, linking failed
+std::optional<std::string>
+coup_project::link_objects(const std::vector<fs::path> &object_files,
+						   const fs::path &target,
+						   const std::vector<std::string> &link_flags,
+						   bool objects_changed, build_state &state,
+						   bool verbose)
+{
+	std::vector<std::string> link_arguments = make_link_arguments(
+		object_files, target, coup_config.get_compiler(), link_flags);
+	hash_t link_hash = hash_strings(link_arguments);
+
+	if (!objects_changed && fs::exists(target) &&
+		state.database.get_link_hash(target.string()) == link_hash)
+	{
+		events->emit("cache_hit", { { "target", target } });
+		return std::nullopt;
+	}
+
+	fs::create_directories(target.parent_path());
+	// objects compiled by this command are read from the staging directory,
+	// they may not be published yet
+	if (state.stager != nullptr)
+	{
+		std::vector<fs::path> read_files;
+		read_files.reserve(object_files.size());
+		for (const fs::path &object_file : object_files)
+			read_files.push_back(state.stager->read_path(object_file));
+		link_arguments = make_link_arguments(
+			read_files, target, coup_config.get_compiler(), link_flags);
+	}
+	std::string link_command = join_arguments(link_arguments);
+	print_link(target.filename().string(), link_command, verbose);
+
+	auto link_start = std::chrono::steady_clock::now();
+	bool linked = execute_system_call(link_command.c_str());
+	std::chrono::duration<double> link_time =
+		std::chrono::steady_clock::now() - link_start;
+	state.metrics.link_time += link_time.count();
+	events->emit("link", { { "target", target },
+						   { "command", link_command },
+						   { "seconds", link_time.count() },
+						   { "success", linked } });
+	if (!linked)
+	{
+		state.database.set_link_hash(target.string(), 0);
+		return "Linktime error";
+	}
+	state.database.set_link_hash(target.string(), link_hash);
+	return std::nullopt;
+}
+
+// project sources followed by the sources of every test target
+std::vector<fs::path>
+coup_project::all_sources(const std::vector<fs::path> &project_sources) const
+{
+	std::vector<fs::path> sources = project_sources;
+	for (const test_target &target : coup_config.get_test_targets())
+	{
+		std::vector<fs::path> test_directories(
+			target.source_directories.begin(),
+			target.source_directories.end());
+		std::vector<fs::path> test_sources = find_sources(test_directories);
+		sources.insert(sources.end(), test_sources.begin(),
+					   test_sources.end());
+	}
+	return sources;
+}
+
+// Identifies the commands of compile_commands.json without composing
+// them: the sources, the contents of coup_config.json, the profile, the
+// flags resolved for the sources and the coup binary that composes them
+hash_t coup_project::compilation_database_key(
+	const std::vector<fs::path> &sources) const
+{
+	hash_t key = coup_config.get_content_hash();
+	key = hash_combine(key, hash_string(root.string()));
+	key = hash_combine(key, hash_string(output_directory.string()));
+	key = hash_combine(key, hash_strings(package_compile_flags));
+	std::optional<file_stamp> coup_binary = get_file_stamp("/proc/self/exe");
+	if (coup_binary.has_value())
+	{
+		key = hash_combine(
+			key, hash_combine(static_cast<hash_t>(coup_binary->mtime_ns),
+							  coup_binary->size));
+	}
+	for (const fs::path &source : sources)
+	{
+		key = hash_combine(key, hash_string(source.native()));
+	}
+	// the map is unordered, its entries are summed
+	hash_t module_flags = 0;
+	for (const auto &[source, flags] : source_module_flags)
+	{
+		module_flags += hash_strings(flags, hash_string(source));
+	}
+	return hash_combine(key, module_flags);
+}
+
+// Writes <build>/compile_commands.json for clangd and other tools with
+// the compile command of every project and test source in the selected
+// profile, exactly as compile_sources runs it
+// The file is only replaced if a command changed, so editors do not
+// re-index on every build; unless forced, the commands are not even
+// composed while the key (see compilation_database_key) is the one the
+// file was last written for
+// Returns true if the file was written
+bool coup_project::write_compilation_database(
+	const std::vector<fs::path> &project_sources, bool force) const
+{
+	std::vector<fs::path> sources = all_sources(project_sources);
+	fs::path database_file = build_directory / COMPILATION_DATABASE_FILE;
+	fs::path key_file = build_directory / COMPILATION_DATABASE_KEY_FILE;
+	std::string key = hash_to_string(compilation_database_key(sources));
+	if (!force && file_contents(key_file) == key && fs::exists(database_file))
+	{
+		return false;
+	}
+
+	std::string directory = root.string();
+	nlohmann::json entries = nlohmann::json::array();
+	for (const fs::path &source : sources)
+	{
+		entries.push_back(
+			{ { "directory", directory },
+			  { "arguments", compile_arguments(source) },
+			  { "file", source },
+			  { "output", make_output_file(source,
+										   output_directory / OBJECT_DIRECTORY,
+										   "o") } });
+	}
+	fs::create_directories(build_directory);
+	bool written = write_file_if_changed(database_file, entries.dump(2) + "\n");
+	write_file_if_changed(key_file, key);
+	return written;
+}
+
+// Aggregates the time reports of every source and prints the most
+// expensive headers, template instantiations, functions to generate code
+// for and compiler phases over the whole build
+void coup_project::report_compile_times(
+	const std::vector<fs::path> &source_files,
+	const std::vector<fs::path> &object_files) const
+{
+	std::string compiler = coup_config.get_compiler();
+	time_report report;
+	for (std::size_t i = 0; i < source_files.size(); ++i)
+	{
+		fs::path report_file = time_report_file(object_files[i], compiler);
+		if (is_clang_compiler(compiler))
+			report.add_clang_trace(report_file, source_files[i].string());
+		else
+			report.add_gcc_report(report_file, source_files[i].string());
+	}
+
+	print_time_entries("Slowest translation units",
+					   report.top_units(TIME_REPORT_LIMIT));
+	print_time_entries("Most expensive headers (parse time incl. includes)",
+					   report.top_headers(TIME_REPORT_LIMIT));
+	print_time_entries("Slowest template instantiations",
+					   report.top_instantiations(TIME_REPORT_LIMIT));
+	print_time_entries("Slowest functions to generate code for",
+					   report.top_codegen(TIME_REPORT_LIMIT));
+	print_time_entries("Compiler phases",
+					   report.top_phases(TIME_REPORT_LIMIT));
+}
+
+// Executes build step: compiles every out of date source of the project
+// and relinks the executable if anything changed
+// With profile_compiles, compiles also write time reports, which are
+// aggregated into a report of where the build spends its time
+// If the function returns a string, an error has occurred and the string
+// will contain a description of the error
+// Otherwise, std::nullopt will be returned
+std::optional<std::string>
+coup_project::execute_build(bool verbose, bool profile_compiles) noexcept
+{
+	try
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<fs::path> source_files = find_sources(source_directories);
+		if (source_files.empty())
+		{
+			return "No source files found";
+		}
+
+		build_state state;
+		load_state(state);
+		resolve_packages(state);
+		events->emit("build_start", { { "profile", profile.name },
+									  { "sources", source_files.size() } });
+
+		std::vector<fs::path> object_files;
+		int num_compiled = 0;
+		std::optional<std::string> result =
+			compile_sources(source_files, state, object_files, num_compiled,
+							verbose, profile_compiles);
+		write_compilation_database(source_files, false);
+		if (!result.has_value())
+		{
+			result = link_objects(
+				object_files, output_directory / coup_config.get_executable(),
+				project_link_flags(), num_compiled > 0, state, verbose);
+		}
+
+		save_state(state);
+		std::chrono::duration<double> total_time =
+			std::chrono::steady_clock::now() - start;
+		events->emit("summary", { { "success", !result.has_value() },
+								  { "seconds", total_time.count() },
+								  { "sources", source_files.size() },
+								  { "compiled", num_compiled } });
+		if (result.has_value())
+		{
+			return result;
+		}
+
+		state.metrics.timestamp = std::time(nullptr);
+		state.metrics.total_time = total_time.count();
+		state.metrics.peak_rss_kb = peak_child_rss_kb();
+		append_build_metrics(output_directory / STATS_FILE, state.metrics);
+
+		if (profile_compiles)
+		{
+			report_compile_times(source_files, object_files);
+		}
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
+}
+
+// compile options of a source file in the selected profile, with the
+// flags of the external libraries once resolve_packages has run
+compile_options
+coup_project::source_compile_options(const fs::path &source_file) const
+{
+	compile_options options =
+		coup_config.get_compile_options(source_file, profile);
+	options.flags.insert(options.flags.end(), package_compile_flags.begin(),
+						 package_compile_flags.end());
+	return options;
+}
+
+// compile arguments of a source file in the selected profile, with its
+// module flags once resolve_modules has run
+std::vector<std::string>
+coup_project::compile_arguments(const fs::path &source_file) const
+{
+	compile_options options = source_compile_options(source_file);
+	auto flags = source_module_flags.find(source_file.string());
+	if (flags != source_module_flags.end())
+	{
+		options.flags.insert(options.flags.end(), flags->second.begin(),
+							 flags->second.end());
+	}
+	return make_compile_arguments(
+		source_file,
+		make_output_file(source_file, output_directory / OBJECT_DIRECTORY, "o"),
+		make_output_file(source_file, output_directory / OBJECT_DIRECTORY, "d"),
+		options);
+}
+
+// link flags of the selected profile followed by those of the external
+// libraries
+std::vector<std::string> coup_project::project_link_flags() const
+{
+	std::vector<std::string> link_flags = coup_config.get_link_flags(profile);
+	link_flags.insert(link_flags.end(), package_link_flags.begin(),
+					  package_link_flags.end());
+	return link_flags;
+}
+
+// Sources linked into a test target: its own sources followed by every
+// project source that is not excluded
+std::vector<fs::path>
+coup_project::test_sources(const test_target &target,
+						   const std::vector<fs::path> &project_sources) const
+{
+	std::vector<fs::path> test_directories(target.source_directories.begin(),
+										   target.source_directories.end());
+	std::vector<fs::path> sources = find_sources(test_directories);
+	for (const fs::path &project_source : project_sources)
+	{
+		fs::path source = project_source.lexically_normal();
+		auto is_source = [&](const std::string &excluded)
+		{ return fs::path(excluded).lexically_normal() == source; };
+		if (std::none_of(target.exclude.begin(), target.exclude.end(),
+						 is_source))
+		{
+			sources.push_back(project_source);
+		}
+	}
+	return sources;
+}
+
+// Hash of everything a test binary is built from: the current compile
+// command and contents of each linked source, the headers each source
+// included when it was last compiled, and the current link command
+// Returns std::nullopt if a source was never compiled, since then the
+// headers it depends on are unknown
+std::optional<hash_t>
+coup_project::hash_test_inputs(const std::vector<fs::path> &sources,
+							   const fs::path &test_binary,
+							   const std::vector<std::string> &link_flags,
+							   build_state &state) const
+{
+	std::vector<fs::path> object_files;
+	object_files.reserve(sources.size());
+	hash_t inputs_hash = 0;
+	for (const fs::path &source : sources)
+	{
+		std::optional<build_record_view> record =
+			state.database.view(source.native());
+		if (!record.has_value())
+		{
+			return std::nullopt;
+		}
+		std::optional<hash_t> input_hash = hash_inputs(
+			state.hashes, source, state.database, record->dependencies);
+		if (!input_hash.has_value())
+		{
+			return std::nullopt;
+		}
+		inputs_hash = hash_combine(inputs_hash, hash_string(source.string()));
+		inputs_hash = hash_combine(inputs_hash,
+								   hash_strings(compile_arguments(source)));
+		inputs_hash = hash_combine(inputs_hash, *input_hash);
+		object_files.emplace_back(record->object);
+	}
+
+	std::vector<std::string> link_arguments = make_link_arguments(
+		object_files, test_binary, coup_config.get_compiler(), link_flags);
+	return hash_combine(inputs_hash, hash_strings(link_arguments));
+}
+
+// Builds test targets and runs their tests
+// Test sources compile into the same object tree as the project and each
+// target links its own objects with the project objects, except those of
+// its excluded sources, into <profile>/tests/<name>
+// Tests that passed in a binary with the same hash are not run again
+// With affected_only, targets whose inputs (see hash_test_inputs) are the
+// same as at their last fully passing run are neither built nor run
+// If the function returns a string, building failed or a test failed
+std::optional<std::string>
+coup_project::execute_test(bool verbose, bool affected_only) noexcept
+{
+	try
+	{
+		std::vector<test_target> targets = coup_config.get_test_targets();
+		if (targets.empty())
+		{
+			return "No tests declared in coup_config.json";
+		}
+
+		build_state state;
+		load_state(state);
+		resolve_packages(state);
+
+		fs::path test_cache_file = output_directory / TEST_CACHE_FILE;
+		test_cache cache;
+		cache.load(test_cache_file);
+
+		std::vector<fs::path> project_sources =
+			find_sources(source_directories);
+
+		struct test_build
+		{
+			const test_target *target;
+			std::vector<fs::path> sources;
+			std::vector<std::string> link_flags;
+			fs::path binary;
+		};
+		std::vector<test_build> builds;
+		int num_skipped = 0;
+		for (const test_target &target : targets)
+		{
+			test_build build;
+			build.target = &target;
+			build.sources = test_sources(target, project_sources);
+			build.link_flags = project_link_flags();
+			build.link_flags.insert(build.link_flags.end(),
+									target.link_flags.begin(),
+									target.link_flags.end());
+			build.binary = output_directory / TEST_DIRECTORY / target.name;
+
+			if (affected_only)
+			{
+				// the compile commands include the module flags
+				module_graph graph;
+				bool resolved =
+					!coup_config.get_modules() ||
+					!resolve_modules(build.sources, state, graph).has_value();
+				std::optional<hash_t> inputs_hash = hash_test_inputs(
+					build.sources, build.binary, build.link_flags, state);
+				std::optional<hash_t> green_hash =
+					cache.get_green_hash(target.name);
+				if (resolved && inputs_hash.has_value() &&
+					inputs_hash == green_hash)
+				{
+					print_test(target.name, true, 0.0, true, verbose);
+					++num_skipped;
+					continue;
+				}
+			}
+			builds.push_back(std::move(build));
+		}
+
+		std::optional<std::string> result;
+		for (const test_build &build : builds)
+		{
+			std::vector<fs::path> object_files;
+			int num_compiled = 0;
+			result = compile_sources(build.sources, state, object_files,
+									 num_compiled, verbose, false);
+			if (result.has_value())
+				break;
+			result = link_objects(object_files, build.binary, build.link_flags,
+								  num_compiled > 0, state, verbose);
+			if (result.has_value())
+				break;
+		}
+
+		save_state(state);
+		if (result.has_value())
+			return "Failure during build process\n" + *result;
+
+		test_summary total;
+		for (const test_build &build : builds)
+		{
+			const std::string &name = build.target->name;
+			std::optional<hash_t> binary_hash =
+				state.hashes.hash_file(build.binary);
+			test_summary summary = run_tests(
+				build.binary, name, binary_hash.value_or(0), cache,
+				output_directory / TEST_DIRECTORY / ".runs" / name,
+				default_job_count(), verbose);
+
+			if (summary.failed == 0)
+			{
+				std::optional<hash_t> inputs_hash = hash_test_inputs(
+					build.sources, build.binary, build.link_flags, state);
+				if (inputs_hash.has_value())
+					cache.set_green_hash(name, *inputs_hash);
+			}
+
+			total.passed += summary.passed;
+			total.failed += summary.failed;
+			total.cached += summary.cached;
+			total.failures.insert(total.failures.end(),
+								  summary.failures.begin(),
+								  summary.failures.end());
+		}
+		cache.save(test_cache_file);
+		state.hashes.save(build_directory / HASH_CACHE_FILE);
+		print_test_summary(total.passed, total.failed, total.cached,
+						   num_skipped);
+
+		if (total.failed > 0)
+		{
+			std::string error_message = "";
+			for (const std::string &failure : total.failures)
+				error_message += "\n\t" + failure;
+			return error_message;
+		}
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
+}
+
+// Brings the executable up to date and replaces coup with it
+// The incremental build only compiles stale sources and only relinks when
+// an object or the link command changed, so an up-to-date program starts
+// after a handful of stat calls
+// The program runs in the directory coup was started from, as if it had
+// been started there itself
+// If the function returns a string, building or starting the program
+// failed, on success it does not return at all
+std::optional<std::string>
+coup_project::execute_run(bool verbose,
+						  const std::vector<std::string> &args) noexcept
+{
+	std::string executable_name = coup_config.get_executable();
+	std::error_code ec;
+	fs::path executable =
+		fs::absolute(output_directory / executable_name, ec);
+	if (ec)
+		return "Failed to run " + executable_name;
+
+	std::optional<std::string> build_result = execute_build(verbose, false);
+	if (build_result.has_value())
+		return "Failure during build process\n" + *build_result;
+
+	// the program replaces coup, nothing buffered may be left behind
+	events->close();
+	fs::current_path(invocation_directory, ec);
+	if (ec)
+		return "Failed to enter " + invocation_directory.string();
+	exec_file(executable, args);
+	return "Failed to run " + executable_name;
+}
+
+// Removes build artifacts in-process
+// clean_mode::profile removes the whole tree of the selected profile:
+// objects, depfiles, executables, build database, test results and build
+// history
+// clean_mode::stale removes only objects and depfiles whose source file
+// no longer exists and drops their build database records
+// clean_mode::all removes the whole build directory in one recursive delete
 // If the function returns a string, an error has occurred and the string
 // will contain a description of the error
 // Otherwise, std::nullopt will be returned
+std::optional<std::string> coup_project::execute_clean(bool verbose,
+													   clean_mode mode) noexcept
+{
+	try
+	{
+		if (mode == clean_mode::all)
+		{
+			if (verbose)
+				print_remove(build_directory.string(), 1, 1, verbose);
+			fs::remove_all(build_directory);
+			return std::nullopt;
+		}
+
+		if (!fs::exists(output_directory))
+			return std::nullopt;
+
+		fs::path object_directory = output_directory / OBJECT_DIRECTORY;
+		fs::path database_file = output_directory / DATABASE_FILE;
+		fs::path clean_directory =
+			mode == clean_mode::profile ? output_directory : object_directory;
+
+		std::vector<fs::path> build_files;
+		std::vector<fs::path> directories;
+		if (fs::exists(clean_directory))
+		{
+			for (const auto &entry :
+				 fs::recursive_directory_iterator(clean_directory))
+			{
+				if (entry.is_directory() && !entry.is_symlink())
+				{
+					directories.push_back(entry.path());
+					continue;
+				}
+				const fs::path &file = entry.path();
+				if (mode == clean_mode::stale &&
+					fs::exists(get_output_source(file, object_directory)))
+				{
+					continue;
+				}
+				build_files.push_back(file);
+			}
+		}
+
+		std::mutex output_log_mtx;
+		int count = 1;
+		int total = static_cast<int>(build_files.size());
+
+		std::vector<fs::path> failed = unlink_files(
+			build_files,
+			[&](const fs::path &file)
+			{
+				std::lock_guard<std::mutex> lock(output_log_mtx);
+				print_remove(file.string(), count++, total, verbose);
+			});
+
+		if (mode == clean_mode::stale)
+		{
+			build_database database;
+			if (database.load(database_file))
+			{
+				for (const std::string &source : database.get_sources())
+				{
+					if (!fs::exists(source))
+						database.erase(source);
+				}
+				database.save(database_file);
+			}
+		}
+
+		// deepest directories first, non-empty ones are simply kept
+		std::sort(directories.begin(), directories.end(),
+				  [](const fs::path &a, const fs::path &b)
+				  { return a.native().size() > b.native().size(); });
+		directories.push_back(clean_directory);
+		for (const fs::path &directory : directories)
+		{
+			std::error_code ec;
+			fs::remove(directory, ec);
+		}
+
+		if (!failed.empty())
+		{
+			std::string error_message = "";
+			for (const fs::path &file : failed)
+			{
+				std::string error = "Failed to remove " + file.string();
+				print_error(error);
+				error_message += error + '\n';
+			}
+			return error_message;
+		}
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
+}
+
+// Lists the sources recompiled when any of the given files changes, with
+// the time their last compile took and an estimate of the whole rebuild
+// Answered from the reverse index in the build database of the profile,
+// nothing is read from the sources or compiled
+// If the function returns a string, there is no build database yet
+std::optional<std::string>
+coup_project::execute_affected(const std::vector<std::string> &paths) noexcept
+{
+	try
+	{
+		if (paths.empty())
+			return "Expected the files to look up";
+
+		build_database database;
+		if (!database.load(output_directory / DATABASE_FILE))
+			return "Nothing built with profile '" + profile.name + "' yet";
+
+		std::set<std::string> sources;
+		for (const std::string &path : paths)
+		{
+			std::string file = project_path(path);
+			if (database.view(file).has_value())
+				sources.insert(file);
+			for (std::string &source : database.get_dependents(file))
+				sources.insert(std::move(source));
+		}
+
+		double total_time = 0.0;
+		double longest_time = 0.0;
+		for (const std::string &source : sources)
+		{
+			double compile_time = database.view(source)->compile_time;
+			print_affected(source, compile_time);
+			total_time += compile_time;
+			longest_time = std::max(longest_time, compile_time);
+		}
+
+		// with enough jobs the rebuild takes as long as the slowest compile
+		unsigned int num_jobs = default_job_count();
+		print_affected_summary(static_cast<int>(sources.size()), total_time,
+							   std::max(total_time / num_jobs, longest_time),
+							   num_jobs);
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
+}
+
+// Prints the chain of includes through which a source depends on a header
+// Only the files in the recorded depfile of the source are searched
+// If the function returns a string, the source was never compiled or does
+// not depend on the header
+std::optional<std::string>
+coup_project::execute_why(const std::vector<std::string> &paths) noexcept
+{
+	try
+	{
+		if (paths.size() != 2)
+			return "Expected a source file and a header";
+
+		std::string source = project_path(paths[0]);
+		std::string header = project_path(paths[1]);
+
+		build_database database;
+		database.load(output_directory / DATABASE_FILE);
+		std::optional<build_record> record = database.find(source);
+		if (!record.has_value())
+			return source + " was not compiled with profile '" +
+				   profile.name + "'";
+
+		std::vector<std::string> chain =
+			find_include_chain(source, header, record->dependencies);
+		if (chain.empty())
+			return source + " does not include " + header;
+
+		print_include_chain(chain);
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
+}
+
+// Prints the last builds of the profile and what got slower in the latest
+// one compared with the median of the builds before it
+// If the function returns a string, the profile was never built
+std::optional<std::string> coup_project::execute_stats() noexcept
+{
+	try
+	{
+		std::vector<build_metrics> history =
+			load_build_metrics(output_directory / STATS_FILE);
+		if (history.empty())
+			return "No builds recorded for profile '" + profile.name + "'";
+
+		std::size_t first =
+			history.size() > STATS_HISTORY ? history.size() - STATS_HISTORY : 0;
+		for (std::size_t i = first; i < history.size(); ++i)
+			print_build_metrics(history[i]);
+
+		print_regressions(find_regressions(history, STATS_HISTORY,
+										   STATS_REGRESSION_THRESHOLD));
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
+}
+
+// Brings <build>/compile_commands.json up to date without compiling
+std::optional<std::string> coup_project::execute_compdb() noexcept
+{
+	try
+	{
+		// the flags of the external libraries and the module flags of
+		// every source
+		build_state state;
+		load_state(state);
+		resolve_packages(state);
+		std::vector<fs::path> project_sources =
+			find_sources(source_directories);
+		if (coup_config.get_modules())
+		{
+			module_graph graph;
+			std::optional<std::string> error =
+				resolve_modules(all_sources(project_sources), state, graph);
+			if (error.has_value())
+				return error;
+		}
+		save_state(state);
+		bool written = write_compilation_database(project_sources, true);
+		print_generated((build_directory / COMPILATION_DATABASE_FILE).string(),
+						written);
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
+}
+
+// Writes <build>/build.ninja, which builds the executable and the test
+// targets of every profile with the same commands coup runs, so that
+// ninja can execute the build, e.g. `ninja -f build/build.ninja release`
+// The file regenerates itself through coup when coup_config.json or a
+// source directory changes, and is only replaced if its contents changed
+std::optional<std::string>
+coup_project::execute_generate(const std::vector<std::string> &paths) noexcept
+{
+	try
+	{
+		if (paths.size() != 1 || paths[0] != "ninja")
+		{
+			return "Usage: coup generate ninja";
+		}
+		// ninja would need dyndep files to order module interfaces
+		if (coup_config.get_modules())
+		{
+			return "coup generate ninja does not support \"modules\" yet";
+		}
+
+		fs::path ninja_file = build_directory / NINJA_FILE;
+		ninja_generator generator;
+		generator.ninja_file = ninja_file.string();
+		// the profile build.ninja defaults to is kept when it regenerates
+		std::vector<std::string> generator_arguments = {
+			fs::read_symlink("/proc/self/exe").string(), "generate", "ninja"
+		};
+		if (profile.name != coup_config.get_default_profile())
+		{
+			generator_arguments.push_back("--profile=" + profile.name);
+		}
+		generator.command = join_arguments(generator_arguments);
+		generator.inputs.push_back("coup_config.json");
+		std::vector<fs::path> input_directories = source_directories;
+		for (const test_target &target : coup_config.get_test_targets())
+		{
+			input_directories.insert(input_directories.end(),
+									 target.source_directories.begin(),
+									 target.source_directories.end());
+		}
+		// a directory's mtime changes when an entry is added or removed
+		for (const fs::path &directory : input_directories)
+		{
+			if (!fs::is_directory(directory))
+				continue;
+			generator.inputs.push_back(directory.string());
+			for (const fs::directory_entry &entry :
+				 fs::recursive_directory_iterator(directory))
+			{
+				if (entry.is_directory())
+					generator.inputs.push_back(entry.path().string());
+			}
+		}
+
+		// the flags of the external libraries are the same in every
+		// profile; the build file is regenerated when a .pc file changes
+		build_state state;
+		load_state(state);
+		resolve_packages(state);
+		save_state(state);
+		for (const package_dependency &dependency :
+			 coup_config.get_dependencies())
+		{
+			for (const auto &[file, mtime_ns] :
+				 state.database.find_package(dependency.name)->files)
+			{
+				if (mtime_ns != 0)
+					generator.inputs.push_back(file);
+			}
+		}
 
-std::optional<std::string> coup_project::execute_build(bool verbose) noexcept
-{
-    std::vector<fs::path> source_files;
-    for (const fs::path& source_directory : source_directories) {
-        std::vector<fs::path> new_source_files = find_src_files(source_directory);
-        source_files.insert(source_files.end(), 
-                            std::make_move_iterator(new_source_files.begin()),
-                            std::make_move_iterator(new_source_files.end());
-    }
-
-    // Critical sections needed locking:
-    //      - removing from source_files vector
-    //      - logging to stdout or stderr
-    //      - adding to new_object_files vector
-    std::mutex source_files_mtx
-    std::mutex ouput_log_mtx, 
-    std::mutex object_files_mtx;
-
-    std::vector<fs::path> object_files;
-    bool build_success = true;
-    
-    // Needed for logging messages like this: [2/8] Compiling...
-    int count = 1;
-    int total = source_files.size();
-
-    std::string error_message = "";
-
-    // additional information used during build/compilation step
-    std::vector<std::string> compile_flags = coup_config.get_compile_flags();
-    std::string executable_name = coup_config.get_executable();
-    std::string cpp_standard = coup_config.get_cpp_version();
-    std::string compiler = coup_config.get_compiler();
-
-    auto build_worker = [&] {
-        while (1) {
-            fs::path source_file;
-            {
-                std::lock_guard<std::mutex> lock(source_files_mtx);
-                if (source_files.empty())
-                    return;
-                source_file = std::move(source_files.back());
-                source_files.pop_back();
-            }
-            std::string source_filename = get_filename(source_file.string());
-            std::string compile_command = 
-                make_compile_command(source_file, compiler, 
-                                     cpp_standard, compile_flags);
-            {
-                std::lock_guard<std::mutex> lock(output_log_mtx);
-                print_compile(source_filename, compile_command,
-                              count++, total, verbose);
-            }
-
-            if (!execute_system_call(compile_command.c_str()) {
-                {
-                    std::lock_guard<std::mutex> lock(output_log_mtx);
-                    std::string error = "Failed to compile " + source_filename;
-                    print_error(error);
-                    error_message += "\n\t" + error;
-                }
-                build_success = false;
-            } else {
-                fs::path object_file = 
-                    build_directory / replace_extension(source_filename, "o");
-                {
-                    std::lock_guard<std::mutex> lock(object_files_mtx);
-                    object_files.push_back(std::move(object_file));
-                }
-            }
-        }
-    };
-    
-    unsigned int num_threads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-
-    unsigned int i;
-    for (i = 0; i < num_threads; ++i)
-        threads.emplace_back(build_worker);
-    for (std::thread& th : threads)
-        th.join();
-
-    if (!build_success) {
-        assert(!error_message.empty());
-        return error_message;
-    }
-
-    std::string link_command = make_link_command(new_object_files);
-    print_link(executable, link_command, verbose);
-    
-    if (!execute_system_call(link_command.c_str()))
-        return "Linktime error";
-    else
-        return std::nullopt;
-
-}
-
-std::optional<std::string> coup_project::execute_run(bool verbose) noexcept
-{
-    std::string executable_name = coup_config.get_executable();
-    fs::path executable = build_directory / executable_name;
-
-    if (!fs::exists(executable)) {
-        std::optional<std::string> build_resuilt = execute_build(verbose);
-        if (build_result.has_value())
-            return "Failure during build process\n" + *build_result;
-    }
-
-    if (!run(executable)) {
-        return "Failed to run " + executable_name;
-    } else {
-        return std::nullopt;
-    }
-}
-
-std::optional<std::string> coup_project::execute_clean(bool verbose) noexcept
-{
-    std::vector<fs::path> build_files = find_obj_files(build_directory);
-    fs::path executable = build_directory / coup_config.get_executable();
-    if (fs::exists(executable))
-        build_files.push_back(std::move(executable));
-    
-    std::mutex object_files_mtx;
-    std::mutex output_log_mtx;
-    bool clean_success = true;
-
-    int count = 1;
-    int total = object_files.size();
-
-    std::string error_message = "";
-
-    auto clean_worker = [&] {
-        while (1) {
-            fs::path object_file;
-            {
-                std::lock_guard<std::mutex> lock(object_files_mtx);
-                if (object_files.empty())
-                    return;
-                object_file = std::move(object_files.back());
-                object_files.pop_back();
-            }
-            std::string object_filename = get_filename(object_file.string());
-            std::string rm_command = make_syustem_command("rm", object_file);
-            {
-                std::lock_guard<std::mutex> lock(output_log_mtx);
-                print_remove(object_filename, rm_command, count, total, verbose);
-            }
-
-            if (!execute_system_call(rm_command.c_str())) {
-                std::string error = "Failed to remove " + object_filename;
-                {
-                    std::lock_guard<std::mutex> lock(output_log_mtx);
-                    print_error(error);
-                    error_message += error + '\n';
-                }
-                clean_success = false;
-            }
-        }
-    };
-
-    unsigned int num_threads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-
-    unsigned int i;
-    for (i = 0; i < num_threads; ++i)
-        threads.emplace_back(clean_worker);
-    for (std::thread& th : threads)
-        th.join();
-
-    if (!clean_success) {
-        assert(!error_message.empty());
-        return error_message;
-    } else {
-        return std::nullopt;
-    }
+		std::vector<fs::path> project_sources =
+			find_sources(source_directories);
+		std::vector<fs::path> sources = all_sources(project_sources);
+		std::vector<test_target> targets = coup_config.get_test_targets();
+
+		std::string selected_profile = profile.name;
+		std::vector<ninja_profile> profiles;
+		for (const std::string &name : coup_config.get_profile_names())
+		{
+			select_profile(name);
+			fs::path object_directory = output_directory / OBJECT_DIRECTORY;
+			auto object_file = [&](const fs::path &source)
+			{ return make_output_file(source, object_directory, "o"); };
+			auto link = [&](const std::vector<fs::path> &link_sources,
+							const fs::path &target,
+							const std::vector<std::string> &link_flags)
+			{
+				ninja_link edge;
+				std::vector<fs::path> object_files;
+				for (const fs::path &source : link_sources)
+				{
+					object_files.push_back(object_file(source));
+					edge.objects.push_back(object_files.back().string());
+				}
+				edge.target = target.string();
+				edge.command = join_arguments(make_link_arguments(
+					object_files, target, coup_config.get_compiler(),
+					link_flags));
+				return edge;
+			};
+
+			ninja_profile entry;
+			entry.name = name;
+			std::set<fs::path> seen;
+			for (const fs::path &source : sources)
+			{
+				if (!seen.insert(source.lexically_normal()).second)
+					continue;
+				entry.compiles.push_back(
+					{ source.string(), object_file(source).string(),
+					  make_output_file(source, object_directory, "d").string(),
+					  join_arguments(compile_arguments(source)) });
+			}
+			entry.executable =
+				link(project_sources,
+					 output_directory / coup_config.get_executable(),
+					 project_link_flags());
+			for (const test_target &target : targets)
+			{
+				std::vector<std::string> link_flags = project_link_flags();
+				link_flags.insert(link_flags.end(), target.link_flags.begin(),
+								  target.link_flags.end());
+				entry.tests.push_back(
+					link(test_sources(target, project_sources),
+						 output_directory / TEST_DIRECTORY / target.name,
+						 link_flags));
+			}
+			profiles.push_back(std::move(entry));
+		}
+		select_profile(selected_profile);
+
+		fs::create_directories(build_directory);
+		bool written = write_file_if_changed(
+			ninja_file, make_ninja_file(profiles, selected_profile,
+										build_directory.string(), generator));
+		print_generated(ninja_file.string(), written);
+		return std::nullopt;
+	}
+	catch (const std::exception &e)
+	{
+		return std::string(e.what());
+	}
 }
 
 /*  Calls execution function corresponding to string command argument
@@ -288,26 +2278,67 @@ std::optional<std::string> coup_project::execute_clean(bool verbose) noexcept
  *  and an error message will be logged
  *  Otherwise, execution succeeded and execution success along with the
  *  execution runtime will be logged to the user
+ *  Returns false if execution failed
  */
-void coup_project::execute_command(const std::string &command,
-								   const std::string &option)
+bool coup_project::execute_command(const std::string &command,
+								   const std::vector<std::string> &args)
 {
 	auto start = std::chrono::high_resolution_clock::now();
 	std::optional<std::string> result;
 
+	command_options options = parse_command_options(args);
+	bool verbose = options.verbose;
+	if (!options.profile.empty())
+	{
+		select_profile(options.profile);
+	}
+	if (!options.events.empty() && !events->open(options.events))
+	{
+		throw std::runtime_error("Failed to open event stream '" +
+								 options.events + "'");
+	}
+	if (!options.paths.empty() && command != "affected" && command != "why" &&
+		command != "generate")
+	{
+		throw std::invalid_argument("Invalid option '" + options.paths[0] +
+									"'");
+	}
+
 	if (command == "build")
 	{
-		result = execute_build(option == "--verbose" ||
-                               option == "-v");
+		result = execute_build(verbose, options.profile_compiles);
 	}
 	else if (command == "run")
 	{
-		result = execute_run();
+		result = execute_run(verbose, options.run_args);
 	}
 	else if (command == "clean")
 	{
-		result = execute_clean(option == "--verbose" ||
-                               option == "-v");
+		result = execute_clean(verbose, options.clean);
+	}
+	else if (command == "test")
+	{
+		result = execute_test(verbose, options.affected);
+	}
+	else if (command == "affected")
+	{
+		result = execute_affected(options.paths);
+	}
+	else if (command == "why")
+	{
+		result = execute_why(options.paths);
+	}
+	else if (command == "stats")
+	{
+		result = execute_stats();
+	}
+	else if (command == "compdb")
+	{
+		result = execute_compdb();
+	}
+	else if (command == "generate")
+	{
+		result = execute_generate(options.paths);
 	}
 	else
 	{
@@ -321,11 +2352,13 @@ void coup_project::execute_command(const std::string &command,
 		auto duration =
 			std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
 		print_result_success(command, duration.count() / 1000.0);
+		return true;
 	}
 	else
 	{
 		std::string error_message = *result;
 		print_result_failure(command, error_message);
+		return false;
 	}
 }
 } // namespace coup
@@ -0,0 +1,271 @@
+/* coup_remote_cache.cxx */
+#include "../include/coup_remote_cache.hxx"
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "../include/coup_parallel.hxx"
+
+// requests written to a connection before its responses are read
+#define PIPELINE_DEPTH 32
+// connections a lookup uses at once
+#define MAX_CONNECTIONS 4
+
+namespace fs = std::filesystem;
+namespace coup
+{
+
+// 1 to 64 lower case hex digits, so a key can never name a path outside
+// the cache directory
+bool is_cache_key(const std::string &key)
+{
+	auto is_hex = [](char c)
+	{ return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); };
+	return !key.empty() && key.size() <= 64 &&
+		   std::all_of(key.begin(), key.end(), is_hex);
+}
+
+remote_cache::remote_cache(http_url url_)
+	: url(std::move(url_)), upload_thread(&remote_cache::upload_loop, this)
+{
+}
+
+// pending uploads are still sent
+remote_cache::~remote_cache()
+{
+	{
+		std::lock_guard<std::mutex> lock(upload_mtx);
+		closing = true;
+	}
+	upload_cv.notify_all();
+	upload_thread.join();
+}
+
+bool remote_cache::is_available() const noexcept
+{
+	return available;
+}
+
+// which of the keys the cache has, with a single request
+std::vector<bool> remote_cache::contains(const std::vector<std::string> &keys)
+{
+	std::vector<bool> found(keys.size(), false);
+	if (keys.empty() || !available)
+	{
+		return found;
+	}
+
+	std::string body;
+	for (const std::string &key : keys)
+	{
+		body += key;
+		body += '\n';
+	}
+	http_client client(url);
+	std::optional<http_response> response =
+		client.request({ "POST", "/find", std::move(body) });
+	if (!response.has_value() || response->status != 200)
+	{
+		available = false;
+		return found;
+	}
+
+	std::unordered_set<std::string> present;
+	std::istringstream lines(response->body);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		present.insert(line);
+	}
+	for (std::size_t i = 0; i < keys.size(); ++i)
+	{
+		found[i] = present.contains(keys[i]);
+	}
+	return found;
+}
+
+// Entries of the keys, std::nullopt for those the cache does not have
+// Requests are pipelined PIPELINE_DEPTH at a time over up to
+// MAX_CONNECTIONS connections
+std::vector<std::optional<std::string>>
+remote_cache::get(const std::vector<std::string> &keys)
+{
+	std::vector<std::optional<std::string>> entries(keys.size());
+	if (keys.empty() || !available)
+	{
+		return entries;
+	}
+
+	std::size_t num_batches =
+		(keys.size() + PIPELINE_DEPTH - 1) / PIPELINE_DEPTH;
+	parallel_for(
+		num_batches,
+		[&](std::size_t batch)
+		{
+			if (!available)
+				return;
+			std::size_t first = batch * PIPELINE_DEPTH;
+			std::size_t last = std::min(first + PIPELINE_DEPTH, keys.size());
+			std::vector<http_request> requests;
+			for (std::size_t i = first; i < last; ++i)
+			{
+				requests.push_back({ "GET", "/cas/" + keys[i], "" });
+			}
+
+			http_client client(url);
+			std::optional<std::vector<http_response>> responses =
+				client.requests(requests);
+			if (!responses.has_value())
+			{
+				available = false;
+				return;
+			}
+			for (std::size_t i = first; i < last; ++i)
+			{
+				http_response &response = (*responses)[i - first];
+				if (response.status == 200)
+					entries[i] = std::move(response.body);
+			}
+		},
+		MAX_CONNECTIONS);
+	return entries;
+}
+
+// queue an entry for upload, returns immediately
+void remote_cache::put(std::string key, std::string data)
+{
+	if (!available)
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(upload_mtx);
+		uploads.emplace_back(std::move(key), std::move(data));
+	}
+	upload_cv.notify_all();
+}
+
+// waits until every queued upload was sent, returns how many were stored
+std::size_t remote_cache::flush()
+{
+	std::unique_lock<std::mutex> lock(upload_mtx);
+	upload_cv.wait(lock, [&] { return uploads.empty(); });
+	return num_uploaded;
+}
+
+void remote_cache::upload_loop()
+{
+	http_client client(url);
+	std::unique_lock<std::mutex> lock(upload_mtx);
+	for (;;)
+	{
+		upload_cv.wait(lock, [&] { return closing || !uploads.empty(); });
+		if (uploads.empty())
+		{
+			return;
+		}
+		// the entry stays queued while it is sent, so flush() waits for it
+		std::pair<std::string, std::string> &upload = uploads.front();
+		lock.unlock();
+		bool stored = false;
+		if (available)
+		{
+			std::optional<http_response> response = client.request(
+				{ "PUT", "/cas/" + upload.first, std::move(upload.second) });
+			stored = response.has_value() && response->status / 100 == 2;
+			if (!response.has_value())
+				available = false;
+		}
+		lock.lock();
+		uploads.pop_front();
+		if (stored)
+			num_uploaded++;
+		upload_cv.notify_all();
+	}
+}
+
+cache_server::cache_server(fs::path directory_)
+	: directory(std::move(directory_))
+{
+}
+
+// bind the server, port "0" picks a free one (see port())
+bool cache_server::listen(const std::string &address, const std::string &port)
+{
+	fs::create_directories(directory);
+	return http_server::listen(address, port);
+}
+
+fs::path cache_server::entry_file(const std::string &key) const
+{
+	return directory / key.substr(0, 2) / key;
+}
+
+// "GET /cas/<key>", "PUT /cas/<key>" or "POST /find", below any prefix
+http_response cache_server::handle_request(const http_message &request)
+{
+	std::string method, path;
+	split_request_line(request, method, path);
+
+	std::size_t cas = path.rfind("/cas/");
+	if (cas != std::string::npos && (method == "GET" || method == "PUT"))
+	{
+		std::string key = path.substr(cas + 5);
+		if (!is_cache_key(key))
+			return { 400, "" };
+		fs::path file = entry_file(key);
+		if (method == "GET")
+		{
+			std::ifstream input(file, std::ios::binary);
+			if (!input)
+				return { 404, "" };
+			std::ostringstream contents;
+			contents << input.rdbuf();
+			return { 200, contents.str() };
+		}
+
+		// written aside and renamed, readers never see a partial entry
+		std::error_code ec;
+		fs::create_directories(file.parent_path(), ec);
+		fs::path tmp_file = file;
+		tmp_file += "." +
+					std::to_string(std::hash<std::thread::id>{}(
+						std::this_thread::get_id())) +
+					".tmp";
+		{
+			std::ofstream output(tmp_file, std::ios::binary | std::ios::trunc);
+			output << request.body;
+			if (!output)
+				return { 500, "" };
+		}
+		fs::rename(tmp_file, file, ec);
+		return { ec ? 500 : 201, "" };
+	}
+
+	if (method == "POST" && path.size() >= 5 &&
+		path.compare(path.size() - 5, 5, "/find") == 0)
+	{
+		std::string present;
+		std::istringstream keys(request.body);
+		std::string key;
+		while (std::getline(keys, key))
+		{
+			std::error_code ec;
+			if (is_cache_key(key) && fs::exists(entry_file(key), ec))
+				present += key + "\n";
+		}
+		return { 200, present };
+	}
+	return { cas != std::string::npos ? 405 : 404, "" };
+}
+} // namespace coup
@@ -0,0 +1,158 @@
+/* coup_staging.cxx */
+#include "../include/coup_staging.hxx"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "../include/coup_hash.hxx"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+namespace
+{
+// clones the blocks of source into a new file target, on filesystems
+// that share blocks between files (btrfs, xfs)
+bool reflink_file(const fs::path &source, const fs::path &target)
+{
+	int source_fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+	if (source_fd < 0)
+	{
+		return false;
+	}
+	int target_fd =
+		open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (target_fd < 0)
+	{
+		close(source_fd);
+		return false;
+	}
+	bool cloned = ioctl(target_fd, FICLONE, source_fd) == 0;
+	close(source_fd);
+	close(target_fd);
+	return cloned;
+}
+} // namespace
+
+fs::path staging_directory(const fs::path &staging_root,
+						   const fs::path &output_directory)
+{
+	std::string output =
+		fs::absolute(output_directory).lexically_normal().string();
+	return staging_root / ("coup-" + hash_to_string(hash_string(output)));
+}
+
+bool publish_file(const fs::path &staged, const fs::path &output)
+{
+	fs::path tmp_file = output;
+	tmp_file += ".tmp";
+	std::error_code ec;
+	fs::remove(tmp_file, ec);
+	if (link(staged.c_str(), tmp_file.c_str()) != 0 &&
+		!reflink_file(staged, tmp_file))
+	{
+		fs::copy_file(staged, tmp_file, fs::copy_options::overwrite_existing,
+					  ec);
+		if (ec)
+		{
+			fs::remove(tmp_file, ec);
+			return false;
+		}
+	}
+	fs::rename(tmp_file, output, ec);
+	return !ec;
+}
+
+output_stager::output_stager(const fs::path &staging_root,
+							 fs::path output_directory_)
+	: directory(staging_directory(staging_root, output_directory_)),
+	  output_directory(std::move(output_directory_))
+{
+	// left behind by a build that did not finish
+	fs::remove_all(directory);
+	fs::create_directories(directory);
+	publisher = std::thread(&output_stager::publish_pending, this);
+}
+
+output_stager::~output_stager()
+{
+	if (publisher.joinable())
+	{
+		finish();
+	}
+}
+
+fs::path output_stager::staged_file(const fs::path &output_file) const
+{
+	return directory / output_file.lexically_relative(output_directory);
+}
+
+// hands a compiled output to the publisher thread
+void output_stager::publish(fs::path staged, fs::path output)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		staged_outputs.insert_or_assign(output.string(), staged);
+		pending.emplace_back(std::move(staged), std::move(output));
+	}
+	cv.notify_one();
+}
+
+fs::path output_stager::read_path(const fs::path &output)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = staged_outputs.find(output.string());
+	return it == staged_outputs.end() ? output : it->second;
+}
+
+std::vector<fs::path> output_stager::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_one();
+	if (publisher.joinable())
+	{
+		publisher.join();
+	}
+	std::error_code ec;
+	fs::remove_all(directory, ec);
+	std::lock_guard<std::mutex> lock(mtx);
+	staged_outputs.clear();
+	return std::move(failed_outputs);
+}
+
+// publisher thread: takes every pending output at once, until finish()
+void output_stager::publish_pending()
+{
+	for (;;)
+	{
+		std::vector<std::pair<fs::path, fs::path>> batch;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&] { return stopping || !pending.empty(); });
+			if (pending.empty())
+				return;
+			batch.swap(pending);
+		}
+		for (const auto &[staged, output] : batch)
+		{
+			if (!publish_file(staged, output))
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				failed_outputs.push_back(output);
+			}
+		}
+	}
+}
+} // namespace coup
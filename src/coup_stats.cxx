@@ -0,0 +1,184 @@
+/* coup_stats.cxx */
+#include "../include/coup_stats.hxx"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <unordered_map>
+#include <vector>
+
+// a baseline needs this many earlier measurements
+#define MIN_BASELINE_SAMPLES 3
+// slowdowns below this many seconds are noise, whatever their ratio
+#define MIN_REGRESSION_SECONDS 0.05
+
+namespace fs = std::filesystem;
+namespace coup
+{
+
+// Append one build to the stats file, two kinds of lines:
+//      B <time> <total> <check> <compile> <link> <sources> <compiled>
+//        <jobs> <peak rss kb>
+//      U <seconds> <source>
+// U lines belong to the B line above them
+// The file is only ever appended to, a build costs one small write
+bool append_build_metrics(const fs::path &stats_file,
+						  const build_metrics &metrics)
+{
+	std::ostringstream record;
+	record << "B " << metrics.timestamp << ' ' << metrics.total_time << ' '
+		   << metrics.check_time << ' ' << metrics.compile_time << ' '
+		   << metrics.link_time << ' ' << metrics.num_sources << ' '
+		   << metrics.num_compiled << ' ' << metrics.num_jobs << ' '
+		   << metrics.peak_rss_kb << '\n';
+	for (const unit_time &unit : metrics.units)
+	{
+		record << "U " << unit.seconds << ' ' << unit.source << '\n';
+	}
+
+	std::ofstream output(stats_file, std::ios::app);
+	output << record.str();
+	return static_cast<bool>(output);
+}
+
+// every build in the stats file, oldest first
+std::vector<build_metrics> load_build_metrics(const fs::path &stats_file)
+{
+	std::vector<build_metrics> history;
+	std::ifstream input(stats_file);
+	std::string line;
+	while (std::getline(input, line))
+	{
+		std::istringstream fields(line);
+		std::string type;
+		fields >> type;
+		if (type == "B")
+		{
+			build_metrics metrics;
+			if (fields >> metrics.timestamp >> metrics.total_time >>
+				metrics.check_time >> metrics.compile_time >>
+				metrics.link_time >> metrics.num_sources >>
+				metrics.num_compiled >> metrics.num_jobs >>
+				metrics.peak_rss_kb)
+			{
+				history.push_back(std::move(metrics));
+			}
+		}
+		else if (type == "U" && !history.empty())
+		{
+			unit_time unit;
+			if (fields >> unit.seconds >> std::ws &&
+				std::getline(fields, unit.source))
+			{
+				history.back().units.push_back(std::move(unit));
+			}
+		}
+	}
+	return history;
+}
+
+// peak resident set of the largest child process coup waited for
+long peak_child_rss_kb()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_CHILDREN, &usage) != 0)
+	{
+		return 0;
+	}
+	return usage.ru_maxrss;
+}
+
+namespace
+{
+std::optional<double> median(std::vector<double> values)
+{
+	if (values.size() < MIN_BASELINE_SAMPLES)
+	{
+		return std::nullopt;
+	}
+	std::size_t middle = values.size() / 2;
+	std::nth_element(values.begin(), values.begin() + middle, values.end());
+	return values[middle];
+}
+} // namespace
+
+// Compares the last build with the median of up to window builds before
+// it and returns what got more than threshold (0.2 = 20%) slower
+// Phases are only compared with builds in which they did any work, the
+// total and compile times only with builds that compiled as many sources,
+// and every translation unit with its own earlier compiles
+std::vector<regression>
+find_regressions(const std::vector<build_metrics> &history, std::size_t window,
+				 double threshold)
+{
+	std::vector<regression> regressions;
+	if (history.size() < 2)
+	{
+		return regressions;
+	}
+
+	const build_metrics &latest = history.back();
+	std::size_t first =
+		history.size() - 1 > window ? history.size() - 1 - window : 0;
+	auto baseline = history.begin() + static_cast<std::ptrdiff_t>(first);
+	auto end = history.end() - 1;
+
+	auto check = [&](const std::string &name, double seconds,
+					 std::vector<double> samples)
+	{
+		std::optional<double> base = median(std::move(samples));
+		if (seconds > 0.0 && base.has_value() &&
+			seconds > *base * (1.0 + threshold) &&
+			seconds - *base > MIN_REGRESSION_SECONDS)
+		{
+			regressions.push_back({ name, *base, seconds });
+		}
+	};
+
+	auto phase_samples =
+		[&](std::function<double(const build_metrics &)> phase,
+			std::function<bool(const build_metrics &)> include)
+	{
+		std::vector<double> samples;
+		for (auto it = baseline; it != end; ++it)
+		{
+			if (phase(*it) > 0.0 && include(*it))
+				samples.push_back(phase(*it));
+		}
+		return samples;
+	};
+	auto any = [](const build_metrics &) { return true; };
+
+	check("total", latest.total_time,
+		  phase_samples([](const build_metrics &m) { return m.total_time; },
+						[&](const build_metrics &m)
+						{ return m.num_compiled == latest.num_compiled; }));
+	check("dependency check", latest.check_time,
+		  phase_samples([](const build_metrics &m) { return m.check_time; },
+						any));
+	check("compile", latest.compile_time,
+		  phase_samples([](const build_metrics &m) { return m.compile_time; },
+						[&](const build_metrics &m)
+						{ return m.num_compiled == latest.num_compiled; }));
+	check("link", latest.link_time,
+		  phase_samples([](const build_metrics &m) { return m.link_time; },
+						any));
+
+	std::unordered_map<std::string, std::vector<double>> unit_samples;
+	for (auto it = baseline; it != end; ++it)
+	{
+		for (const unit_time &unit : it->units)
+			unit_samples[unit.source].push_back(unit.seconds);
+	}
+	for (const unit_time &unit : latest.units)
+	{
+		check(unit.source, unit.seconds, unit_samples[unit.source]);
+	}
+	return regressions;
+}
+} // namespace coup
@@ -2,18 +2,31 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
-#include <format>
+#include <iostream>
+#include <map>
+#include <mutex>
 #include <ranges>
+#include <spawn.h>
 #include <string>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <vector>
 
 #include "../include/coup_filesystem.hxx"
 #include "../include/coup_logger.hxx"
+#include "../include/coup_parallel.hxx"
 #include "../include/coup_project.hxx"
 #include "../include/coup_system.hxx"
 
+// files removed per task, keeps one huge directory from serializing a clean
+#define UNLINK_BATCH_SIZE 256
+
 namespace fs = std::filesystem;
 namespace coup
 {
@@ -25,6 +38,55 @@ bool execute_system_call(const char *command)
 	return result == 0;
 }
 
+// Runs a program without a shell and waits for it
+// stdout and stderr are both written to output_file, stdin is /dev/null
+// Returns the exit code, 128 + signal number if the program was killed,
+// or -1 if it could not be started
+int spawn_process(const std::vector<std::string> &arguments,
+				  const fs::path &output_file)
+{
+	assert(!arguments.empty());
+	std::vector<char *> argv;
+	argv.reserve(arguments.size() + 1);
+	for (const std::string &argument : arguments)
+	{
+		argv.push_back(const_cast<char *>(argument.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+									 O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+									 output_file.c_str(),
+									 O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+	pid_t pid;
+	int result = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(),
+							  environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (result != 0)
+	{
+		return -1;
+	}
+
+	int status = 0;
+	while (::waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			return -1;
+		}
+	}
+	if (WIFEXITED(status))
+	{
+		return WEXITSTATUS(status);
+	}
+	return 128 + WTERMSIG(status);
+}
+
 // composes a compile command for a given source file
 std::string make_compile_command(const fs::path &src_file)
 {
@@ -37,6 +99,167 @@ std::string make_compile_command(const fs::path &src_file)
 	return compile_command;
 }
 
+// characters that never need quoting in a shell command
+static bool is_shell_safe(char c)
+{
+	return std::isalnum(static_cast<unsigned char>(c)) ||
+		   std::strchr("-_./=+,:@%", c) != nullptr;
+}
+
+// single-quote an argument for the shell if it contains special characters
+std::string quote_argument(const std::string &argument)
+{
+	if (!argument.empty() &&
+		std::all_of(argument.begin(), argument.end(), is_shell_safe))
+	{
+		return argument;
+	}
+
+	std::string quoted = "'";
+	for (char c : argument)
+	{
+		if (c == '\'')
+		{
+			quoted += "'\\''";
+		}
+		else
+		{
+			quoted += c;
+		}
+	}
+	quoted += '\'';
+	return quoted;
+}
+
+// joins arguments into a single command line for execute_system_call
+std::string join_arguments(const std::vector<std::string> &arguments)
+{
+	std::string command;
+	for (const std::string &argument : arguments)
+	{
+		if (!command.empty())
+		{
+			command += ' ';
+		}
+		command += quote_argument(argument);
+	}
+	return command;
+}
+
+// Composes the argument list that compiles one source file into obj_file
+// and writes its header dependencies to dep_file
+// The same list is hashed to fingerprint the object, so everything that
+// affects the produced object must be part of it
+std::vector<std::string> make_compile_arguments(const fs::path &src_file,
+												const fs::path &obj_file,
+												const fs::path &dep_file,
+												const compile_options &options)
+{
+	std::vector<std::string> arguments;
+	arguments.reserve(options.flags.size() + options.defines.size() +
+					  options.include_directories.size() + 9);
+
+	arguments.push_back(options.compiler);
+	if (!options.cpp_standard.empty())
+	{
+		arguments.push_back("-std=" + options.cpp_standard);
+	}
+	arguments.insert(arguments.end(), options.flags.begin(),
+					 options.flags.end());
+	for (const std::string &define : options.defines)
+	{
+		arguments.push_back("-D" + define);
+	}
+	for (const std::string &include_directory : options.include_directories)
+	{
+		arguments.push_back("-I" + include_directory);
+	}
+	arguments.push_back("-MMD");
+	arguments.push_back("-MF");
+	arguments.push_back(dep_file.string());
+	arguments.push_back("-c");
+	arguments.push_back(src_file.string());
+	arguments.push_back("-o");
+	arguments.push_back(obj_file.string());
+	return arguments;
+}
+
+// Composes the argument list that only preprocesses a source file into
+// pre_file, writing the same depfile a compile into obj_file would
+std::vector<std::string>
+make_preprocess_arguments(const fs::path &src_file, const fs::path &pre_file,
+						  const fs::path &obj_file, const fs::path &dep_file,
+						  const compile_options &options)
+{
+	std::vector<std::string> arguments =
+		make_compile_arguments(src_file, pre_file, dep_file, options);
+	// ... -MMD -MF <dep> -c <src> -o <pre>
+	auto compile_flag = arguments.end() - 4;
+	*compile_flag = "-E";
+	arguments.insert(compile_flag, { "-MT", obj_file.string() });
+	return arguments;
+}
+
+// Composes the argument list that compiles a preprocessed translation unit
+// with the flags of options, without input and output: the compiler,
+// standard and flags, then "-x c++-cpp-output -c"
+// Defines and include directories were already applied by preprocessing
+std::vector<std::string>
+make_preprocessed_compile_arguments(const compile_options &options)
+{
+	std::vector<std::string> arguments;
+	arguments.push_back(options.compiler);
+	if (!options.cpp_standard.empty())
+	{
+		arguments.push_back("-std=" + options.cpp_standard);
+	}
+	arguments.insert(arguments.end(), options.flags.begin(),
+					 options.flags.end());
+	arguments.insert(arguments.end(), { "-x", "c++-cpp-output", "-c" });
+	return arguments;
+}
+
+// composes the argument list that links object files into exec_file
+std::vector<std::string>
+make_link_arguments(const std::vector<fs::path> &obj_files,
+					const fs::path &exec_file, const std::string &compiler,
+					const std::vector<std::string> &link_flags)
+{
+	std::vector<std::string> arguments;
+	arguments.reserve(obj_files.size() + link_flags.size() + 3);
+
+	arguments.push_back(compiler);
+	arguments.push_back("-o");
+	arguments.push_back(exec_file.string());
+	for (const fs::path &obj : obj_files)
+	{
+		arguments.push_back(obj.string());
+	}
+	arguments.insert(arguments.end(), link_flags.begin(), link_flags.end());
+	return arguments;
+}
+
+// composes a compile command for a source file using the project options
+std::string make_compile_command(const fs::path &src_file,
+								 const fs::path &obj_file,
+								 const fs::path &dep_file,
+								 const compile_options &options)
+{
+	return join_arguments(
+		make_compile_arguments(src_file, obj_file, dep_file, options));
+}
+
+// composes a link command for object files using the project options
+std::string make_link_command(const std::vector<fs::path> &obj_files,
+							  const fs::path &exec_file,
+							  const std::string &compiler,
+							  const std::vector<std::string> &link_flags)
+{
+	assert(!obj_files.empty());
+	return join_arguments(
+		make_link_arguments(obj_files, exec_file, compiler, link_flags));
+}
+
 // composes a link command for a given list of object files
 std::string make_link_command(const std::vector<fs::path> &obj_files)
 {
@@ -145,6 +368,27 @@ bool run(const fs::path &exec_file)
 	return result;
 }
 
+// Replace the current process with exec_file, passing args after argv[0]
+// Signals, the exit code and stdin/stdout/stderr belong to the program
+// from then on; only returns (false) if the exec itself failed
+bool exec_file(const fs::path &exec_file, const std::vector<std::string> &args)
+{
+	std::string program = exec_file.string();
+	std::vector<char *> argv;
+	argv.reserve(args.size() + 2);
+	argv.push_back(program.data());
+	for (const std::string &arg : args)
+	{
+		argv.push_back(const_cast<char *>(arg.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	std::cout.flush();
+	std::cerr.flush();
+	::execv(program.c_str(), argv.data());
+	return false;
+}
+
 // obtain command to remove a given file
 // return true if command executes and file is removed, false otherwise
 bool remove_file(const fs::path &file)
@@ -176,6 +420,80 @@ bool make_directory(const fs::path &dir)
 	return result && fs::exists(dir);
 }
 
+// Remove files without spawning a process per file
+// Files are grouped by directory and every batch opens its directory once
+// and removes its entries with unlinkat, batches run in parallel
+// on_remove is called from the worker threads for every removed file
+// Files that are already gone count as removed
+// Returns the files that could not be removed
+std::vector<fs::path>
+unlink_files(const std::vector<fs::path> &files,
+			 const std::function<void(const fs::path &)> &on_remove)
+{
+	std::map<fs::path, std::vector<const fs::path *>> directories;
+	for (const fs::path &file : files)
+	{
+		directories[file.parent_path()].push_back(&file);
+	}
+
+	struct unlink_batch
+	{
+		const fs::path *directory;
+		std::vector<const fs::path *> files;
+	};
+	std::vector<unlink_batch> batches;
+	for (auto &[directory, directory_files] : directories)
+	{
+		for (std::size_t i = 0; i < directory_files.size();
+			 i += UNLINK_BATCH_SIZE)
+		{
+			std::size_t end =
+				std::min(directory_files.size(), i + UNLINK_BATCH_SIZE);
+			batches.push_back(unlink_batch{
+				&directory, { directory_files.begin() + i,
+							  directory_files.begin() + end } });
+		}
+	}
+
+	std::vector<fs::path> failed;
+	std::mutex failed_mtx;
+	parallel_for(
+		batches.size(),
+		[&](std::size_t i)
+		{
+			const unlink_batch &batch = batches[i];
+			const char *directory =
+				batch.directory->empty() ? "." : batch.directory->c_str();
+			int dir_fd = ::open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			for (const fs::path *file : batch.files)
+			{
+				bool removed = dir_fd >= 0 &&
+							   (::unlinkat(dir_fd, file->filename().c_str(),
+										   0) == 0 ||
+								errno == ENOENT);
+				if (removed)
+				{
+					if (on_remove)
+					{
+						on_remove(*file);
+					}
+				}
+				else
+				{
+					std::lock_guard<std::mutex> lock(failed_mtx);
+					failed.push_back(*file);
+				}
+			}
+
+			if (dir_fd >= 0)
+			{
+				::close(dir_fd);
+			}
+		});
+	return failed;
+}
+
 // obtain command to create dependency file for a given source file
 // parse dependecy file to obtain all individual dependencies
 // return a vector of filenames representing dependencies
@@ -0,0 +1,440 @@
+/* coup_test_runner.cxx */
+#include "../include/coup_test_runner.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_logger.hxx"
+#include "../include/coup_parallel.hxx"
+#include "../include/coup_system.hxx"
+
+// expected duration of a test that never ran and has no measured neighbours
+#define DEFAULT_TEST_DURATION 0.1
+// longest --gtest_filter argument, well below the 128 KiB Linux allows
+// for one argument (MAX_ARG_STRLEN)
+#define MAX_FILTER_LENGTH 65536
+
+namespace fs = std::filesystem;
+namespace coup
+{
+
+// Load results written by save(), one record per line:
+//      T\t<test>\t<binary hash>\t<duration>\t<passed>
+//      G\t<target>\t<inputs hash>
+bool test_cache::load(const fs::path &cache_file)
+{
+	entries.clear();
+	green_hashes.clear();
+	std::ifstream input(cache_file);
+	if (!input)
+	{
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(input, line))
+	{
+		std::istringstream fields(line);
+		std::string type, name, hash;
+		if (!std::getline(fields, type, '\t') ||
+			!std::getline(fields, name, '\t') ||
+			!std::getline(fields, hash, '\t'))
+		{
+			continue;
+		}
+
+		entry e;
+		if (type == "T" && fields >> e.duration >> e.passed)
+		{
+			e.binary_hash = std::stoull(hash, nullptr, 16);
+			entries.insert_or_assign(std::move(name), e);
+		}
+		else if (type == "G")
+		{
+			green_hashes.insert_or_assign(std::move(name),
+										  std::stoull(hash, nullptr, 16));
+		}
+	}
+	return true;
+}
+
+// write every result, replacing the cache file atomically
+bool test_cache::save(const fs::path &cache_file) const
+{
+	fs::path tmp_file = cache_file;
+	tmp_file += ".tmp";
+	{
+		std::ofstream output(tmp_file, std::ios::trunc);
+		if (!output)
+		{
+			return false;
+		}
+		for (const auto &[test, e] : entries)
+		{
+			output << "T\t" << test << '\t' << hash_to_string(e.binary_hash)
+				   << '\t' << e.duration << '\t' << e.passed << '\n';
+		}
+		for (const auto &[target, hash] : green_hashes)
+		{
+			output << "G\t" << target << '\t' << hash_to_string(hash) << '\n';
+		}
+		if (!output)
+		{
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(tmp_file, cache_file, ec);
+	return !ec;
+}
+
+// true if the test passed the last time it ran in this exact binary
+bool test_cache::passed(const std::string &test, hash_t binary_hash) const
+{
+	auto it = entries.find(test);
+	return it != entries.end() && it->second.passed &&
+		   it->second.binary_hash == binary_hash;
+}
+
+// duration of the last run of a test, if it ever ran
+std::optional<double> test_cache::get_duration(const std::string &test) const
+{
+	auto it = entries.find(test);
+	if (it == entries.end())
+	{
+		return std::nullopt;
+	}
+	return it->second.duration;
+}
+
+void test_cache::record(const std::string &test, hash_t binary_hash,
+						bool passed, double duration)
+{
+	entries.insert_or_assign(test, entry{ binary_hash, duration, passed });
+}
+
+// inputs hash of a test target at its last fully passing run
+std::optional<hash_t> test_cache::get_green_hash(const std::string &target) const
+{
+	auto it = green_hashes.find(target);
+	if (it == green_hashes.end())
+	{
+		return std::nullopt;
+	}
+	return it->second;
+}
+
+void test_cache::set_green_hash(const std::string &target, hash_t inputs_hash)
+{
+	green_hashes.insert_or_assign(target, inputs_hash);
+}
+
+// Ask a googletest binary for its tests (--gtest_list_tests)
+// Returns full test names (Suite.Test), or nothing if the binary is not a
+// googletest binary or could not be run
+std::vector<std::string> list_tests(const fs::path &test_binary,
+									const fs::path &scratch_file)
+{
+	if (spawn_process({ test_binary.string(), "--gtest_list_tests" },
+					  scratch_file) != 0)
+	{
+		return {};
+	}
+
+	std::vector<std::string> tests;
+	std::ifstream input(scratch_file);
+	std::string line;
+	std::string suite;
+	while (std::getline(input, line))
+	{
+		std::string name = line.substr(0, line.find('#'));
+		name.erase(name.find_last_not_of(" \t\r") + 1);
+		std::size_t start = name.find_first_not_of(" \t");
+		if (start == std::string::npos)
+		{
+			continue;
+		}
+		if (start == 0)
+		{
+			suite = name;
+		}
+		else if (!suite.empty())
+		{
+			tests.push_back(suite + name.substr(start));
+		}
+	}
+	return tests;
+}
+
+// Split tests into at most num_shards groups of about equal total duration
+// Longest tests are placed first, each onto the currently lightest shard
+std::vector<std::vector<std::string>>
+make_test_shards(const std::vector<std::string> &tests,
+				 const std::vector<double> &durations, unsigned int num_shards)
+{
+	num_shards = static_cast<unsigned int>(
+		std::min<std::size_t>(std::max(num_shards, 1u), tests.size()));
+	std::vector<std::vector<std::string>> shards(num_shards);
+	if (tests.empty())
+	{
+		return shards;
+	}
+
+	std::vector<std::size_t> order(tests.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+					 [&](std::size_t a, std::size_t b)
+					 { return durations[a] > durations[b]; });
+
+	using shard_load = std::pair<double, unsigned int>;
+	std::priority_queue<shard_load, std::vector<shard_load>,
+						std::greater<shard_load>>
+		loads;
+	for (unsigned int i = 0; i < num_shards; ++i)
+	{
+		loads.emplace(0.0, i);
+	}
+	for (std::size_t i : order)
+	{
+		auto [load, shard] = loads.top();
+		loads.pop();
+		shards[shard].push_back(tests[i]);
+		loads.emplace(load + durations[i], shard);
+	}
+	return shards;
+}
+
+// --gtest_filter arguments that select tests between them, none longer
+// than max_length unless a single test name is
+// A shard with more tests than one argument can name runs as one process
+// per filter
+std::vector<std::string>
+make_test_filters(const std::vector<std::string> &tests,
+				  std::size_t max_length)
+{
+	std::vector<std::string> filters;
+	std::string filter;
+	for (const std::string &test : tests)
+	{
+		if (!filter.empty() && filter.size() + 1 + test.size() > max_length)
+		{
+			filters.push_back(std::move(filter));
+			filter.clear();
+		}
+		filter += filter.empty() ? "--gtest_filter=" + test : ':' + test;
+	}
+	if (!filter.empty())
+	{
+		filters.push_back(std::move(filter));
+	}
+	return filters;
+}
+
+// per-test outcome read from a googletest JSON report
+struct test_outcome
+{
+	bool passed = false;
+	double duration = 0.0;
+};
+
+// Runs on the shard threads, so it never throws: a report that is missing
+// or malformed has no outcomes, which fails every test of its shard
+static std::unordered_map<std::string, test_outcome>
+read_test_report(const fs::path &report_file)
+{
+	std::unordered_map<std::string, test_outcome> outcomes;
+	std::ifstream input(report_file);
+	nlohmann::json report = nlohmann::json::parse(input, nullptr, false);
+	if (report.is_discarded() || !report.contains("testsuites"))
+	{
+		return outcomes;
+	}
+
+	try
+	{
+		for (const auto &suite : report["testsuites"])
+		{
+			std::string suite_name = suite.value("name", "");
+			for (const auto &test :
+				 suite.value("testsuite", nlohmann::json::array()))
+			{
+				test_outcome outcome;
+				outcome.passed = !test.contains("failures");
+				std::string time = test.value("time", "0s");
+				outcome.duration = std::strtod(time.c_str(), nullptr);
+				outcomes[suite_name + "." + test.value("name", "")] = outcome;
+			}
+		}
+	}
+	catch (const nlohmann::json::exception &)
+	{
+		outcomes.clear();
+	}
+	return outcomes;
+}
+
+// Run the tests of one binary, skipping those that already passed in a
+// binary with the same hash
+// Remaining tests are split into shards balanced by their last measured
+// durations and every shard runs as its own process with --gtest_filter,
+// up to num_jobs at a time
+// Binaries that do not list googletest tests run once as a single test
+test_summary run_tests(const fs::path &test_binary,
+					   const std::string &target_name, hash_t binary_hash,
+					   test_cache &cache, const fs::path &scratch_directory,
+					   unsigned int num_jobs, bool verbose)
+{
+	test_summary summary;
+	fs::create_directories(scratch_directory);
+
+	std::vector<std::string> tests =
+		list_tests(test_binary, scratch_directory / "list.log");
+
+	if (tests.empty())
+	{
+		if (cache.passed(target_name, binary_hash))
+		{
+			summary.cached++;
+			print_test(target_name, true, 0.0, true, verbose);
+			return summary;
+		}
+
+		fs::path log_file = scratch_directory / "run.log";
+		auto start = std::chrono::steady_clock::now();
+		bool passed = spawn_process({ test_binary.string() }, log_file) == 0;
+		std::chrono::duration<double> duration =
+			std::chrono::steady_clock::now() - start;
+
+		cache.record(target_name, binary_hash, passed, duration.count());
+		print_test(target_name, passed, duration.count(), false, verbose);
+		if (passed)
+		{
+			summary.passed++;
+		}
+		else
+		{
+			summary.failed++;
+			summary.failures.push_back(target_name);
+			print_process_output(file_contents(log_file));
+		}
+		return summary;
+	}
+
+	std::vector<std::string> to_run;
+	std::vector<double> durations;
+	double known_total = 0.0;
+	int known_count = 0;
+	for (const std::string &test : tests)
+	{
+		std::string key = target_name + "/" + test;
+		if (cache.passed(key, binary_hash))
+		{
+			summary.cached++;
+			print_test(key, true, 0.0, true, verbose);
+			continue;
+		}
+		std::optional<double> duration = cache.get_duration(key);
+		if (duration.has_value())
+		{
+			known_total += *duration;
+			known_count++;
+		}
+		to_run.push_back(test);
+		durations.push_back(duration.value_or(-1.0));
+	}
+
+	// tests without history are expected to take as long as the average
+	double expected = known_count > 0 ? known_total / known_count
+									  : DEFAULT_TEST_DURATION;
+	for (double &duration : durations)
+	{
+		if (duration < 0.0)
+		{
+			duration = expected;
+		}
+	}
+
+	std::vector<std::vector<std::string>> shards =
+		make_test_shards(to_run, durations, num_jobs);
+	std::mutex summary_mtx;
+
+	parallel_for(
+		shards.size(),
+		[&](std::size_t i)
+		{
+			const std::vector<std::string> &shard = shards[i];
+			std::vector<std::string> filters =
+				make_test_filters(shard, MAX_FILTER_LENGTH);
+			std::unordered_map<std::string, test_outcome> outcomes;
+			std::string output;
+			bool shard_passed = true;
+			for (std::size_t part = 0; part < filters.size(); ++part)
+			{
+				std::string part_name = "shard_" + std::to_string(i);
+				if (part > 0)
+					part_name += "_" + std::to_string(part);
+				fs::path log_file = scratch_directory / (part_name + ".log");
+				fs::path report_file =
+					scratch_directory / (part_name + ".json");
+				// a stale report would pass tests this part never ran
+				std::error_code ec;
+				fs::remove(report_file, ec);
+
+				if (spawn_process({ test_binary.string(), filters[part],
+									"--gtest_output=json:" +
+										report_file.string() },
+								  log_file) != 0)
+				{
+					shard_passed = false;
+					output += file_contents(log_file);
+				}
+				outcomes.merge(read_test_report(report_file));
+			}
+
+			std::lock_guard<std::mutex> lock(summary_mtx);
+			for (const std::string &test : shard)
+			{
+				// tests missing from the report crashed their shard
+				test_outcome outcome = outcomes[test];
+				std::string key = target_name + "/" + test;
+				cache.record(key, binary_hash, outcome.passed,
+							 outcome.duration);
+				print_test(key, outcome.passed, outcome.duration, false,
+						   verbose);
+				if (outcome.passed)
+				{
+					summary.passed++;
+				}
+				else
+				{
+					summary.failed++;
+					summary.failures.push_back(key);
+				}
+			}
+			if (!shard_passed)
+			{
+				print_process_output(output);
+			}
+		},
+		num_jobs);
+
+	return summary;
+}
+} // namespace coup
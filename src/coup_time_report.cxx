@@ -0,0 +1,220 @@
+/* coup_time_report.cxx */
+#include "../include/coup_time_report.hxx"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// first line of the table gcc prints for -ftime-report
+#define GCC_TIME_REPORT_HEADER "Time variable"
+
+namespace fs = std::filesystem;
+namespace coup
+{
+
+// Compilers are told apart by name, clang++, clang-17, ... are clang and
+// everything else is expected to take gcc's options
+bool is_clang_compiler(const std::string &compiler)
+{
+	return fs::path(compiler).filename().string().find("clang") !=
+		   std::string::npos;
+}
+
+// Timing flags added to a compile command, these are never part of the
+// command hash so profiling does not invalidate any object
+std::vector<std::string> time_report_flags(const std::string &compiler)
+{
+	if (is_clang_compiler(compiler))
+	{
+		return { "-ftime-trace" };
+	}
+	return { "-ftime-report" };
+}
+
+// File the timing output of a compile ends up in: clang writes its trace
+// next to the object, gcc prints its report with the rest of the compiler
+// output, which coup then captures to this file instead of the usual log
+fs::path time_report_file(const fs::path &object_file,
+						  const std::string &compiler)
+{
+	fs::path report_file = object_file;
+	return report_file.replace_extension(
+		is_clang_compiler(compiler) ? ".json" : ".time");
+}
+
+void time_report::add(time_totals &totals, const std::string &name,
+					  double seconds)
+{
+	time_entry &entry = totals[name];
+	entry.name = name;
+	entry.seconds += seconds;
+	entry.count++;
+}
+
+// the limit most expensive entries, most expensive first
+std::vector<time_entry> time_report::top(const time_totals &totals,
+										 std::size_t limit)
+{
+	std::vector<time_entry> entries;
+	entries.reserve(totals.size());
+	for (const auto &[name, entry] : totals)
+	{
+		entries.push_back(entry);
+	}
+	std::sort(entries.begin(), entries.end(),
+			  [](const time_entry &a, const time_entry &b)
+			  { return a.seconds > b.seconds; });
+	if (entries.size() > limit)
+	{
+		entries.resize(limit);
+	}
+	return entries;
+}
+
+// Add a clang -ftime-trace file (Chrome trace format, durations in us)
+// Returns false if the file is missing or not a trace
+bool time_report::add_clang_trace(const fs::path &trace_file,
+								  const std::string &source)
+{
+	std::ifstream input(trace_file);
+	nlohmann::json trace = nlohmann::json::parse(input, nullptr, false);
+	if (trace.is_discarded() || !trace.contains("traceEvents"))
+	{
+		return false;
+	}
+
+	for (const auto &event : trace["traceEvents"])
+	{
+		if (!event.contains("dur") || !event.contains("name"))
+		{
+			continue;
+		}
+		std::string name = event["name"].get<std::string>();
+		double seconds = event["dur"].get<double>() / 1e6;
+		std::string detail = "";
+		if (event.contains("args") && event["args"].contains("detail"))
+		{
+			detail = event["args"]["detail"].get<std::string>();
+		}
+
+		if (name == "Source")
+		{
+			add(headers, detail, seconds);
+		}
+		else if (name == "InstantiateClass" || name == "InstantiateFunction")
+		{
+			add(instantiations, detail, seconds);
+		}
+		else if (name == "CodeGen Function" || name == "OptFunction")
+		{
+			add(codegen, detail, seconds);
+		}
+		else if (name == "ExecuteCompiler")
+		{
+			add(units, source, seconds);
+		}
+		else if (name.starts_with("Total "))
+		{
+			add(phases, name.substr(6), seconds);
+		}
+	}
+	return true;
+}
+
+// Add the captured output of a compile with gcc -ftime-report, e.g.
+//      phase parsing    :   0.16 ( 67%)   0.03 ( 50%)   0.20 ( 65%) ...
+// the third column, wall time, is recorded
+// Returns false if the output contains no time report
+bool time_report::add_gcc_report(const fs::path &report_file,
+								 const std::string &source)
+{
+	std::ifstream input(report_file);
+	std::string line;
+	bool in_report = false;
+	while (std::getline(input, line))
+	{
+		if (line.starts_with(GCC_TIME_REPORT_HEADER))
+		{
+			in_report = true;
+			continue;
+		}
+		std::size_t separator = line.find(':');
+		if (!in_report || separator == std::string::npos)
+		{
+			continue;
+		}
+
+		std::string name = line.substr(0, separator);
+		name.erase(0, name.find_first_not_of(" |"));
+		name.erase(name.find_last_not_of(' ') + 1);
+		// drop the percentages, the TOTAL line has none
+		std::string columns = line.substr(separator + 1);
+		for (std::size_t open = columns.find('(');
+			 open != std::string::npos; open = columns.find('('))
+		{
+			columns.erase(open, columns.find(')', open) - open + 1);
+		}
+		double user = 0.0, system = 0.0, wall = 0.0;
+		if (std::sscanf(columns.c_str(), " %lf %lf %lf", &user, &system,
+						&wall) != 3)
+		{
+			continue;
+		}
+
+		if (name == "TOTAL")
+		{
+			add(units, source, wall);
+		}
+		else
+		{
+			add(phases, name, wall);
+		}
+	}
+	return in_report;
+}
+
+std::vector<time_entry> time_report::top_headers(std::size_t limit) const
+{
+	return top(headers, limit);
+}
+
+std::vector<time_entry>
+time_report::top_instantiations(std::size_t limit) const
+{
+	return top(instantiations, limit);
+}
+
+std::vector<time_entry> time_report::top_codegen(std::size_t limit) const
+{
+	return top(codegen, limit);
+}
+
+std::vector<time_entry> time_report::top_phases(std::size_t limit) const
+{
+	return top(phases, limit);
+}
+
+std::vector<time_entry> time_report::top_units(std::size_t limit) const
+{
+	return top(units, limit);
+}
+
+// compiler output without the gcc time report, i.e. its diagnostics
+std::string strip_time_report(const std::string &compiler_output)
+{
+	std::size_t report = compiler_output.find(GCC_TIME_REPORT_HEADER);
+	if (report == std::string::npos)
+	{
+		return compiler_output;
+	}
+	// gcc separates the report with an empty line
+	std::string diagnostics = compiler_output.substr(0, report);
+	diagnostics.erase(diagnostics.find_last_not_of('\n') + 1);
+	return diagnostics;
+}
+} // namespace coup
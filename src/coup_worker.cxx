@@ -0,0 +1,70 @@
+/* coup_worker.cxx */
+#include <csignal>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include "../include/coup_distributed.hxx"
+#include "../include/coup_parallel.hxx"
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT "7070"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+// coup-worker [--port=<port>] [--bind=<address>] [--unix=<path>]
+//             [--jobs=<n>]
+// Compiles preprocessed translation units for coup, on 127.0.0.1:7070
+// unless told otherwise, with one slot per hardware thread by default
+// Point coup at workers with "workers" in coup_config.json or
+// COUP_WORKERS, e.g. "build1:7070,unix:/tmp/coup-worker.sock"
+int main(int argc, char *argv[])
+{
+	std::string address = DEFAULT_ADDRESS;
+	std::string port = DEFAULT_PORT;
+	std::string socket_path;
+	int jobs = static_cast<int>(default_job_count());
+	bool valid = true;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg.starts_with("--port="))
+			port = arg.substr(7);
+		else if (arg.starts_with("--bind="))
+			address = arg.substr(7);
+		else if (arg.starts_with("--unix="))
+			socket_path = arg.substr(7);
+		else if (arg.starts_with("--jobs=") && std::stoi(arg.substr(7)) > 0)
+			jobs = std::stoi(arg.substr(7));
+		else
+			valid = false;
+	}
+	if (!valid)
+	{
+		std::cerr << "Usage: coup-worker [--port=<port>] [--bind=<address>] "
+					 "[--unix=<path>] [--jobs=<n>]\n";
+		return -1;
+	}
+
+	std::signal(SIGPIPE, SIG_IGN);
+	fs::path scratch_directory =
+		fs::temp_directory_path() /
+		("coup-worker-" + std::to_string(::getpid()));
+	compile_worker worker(jobs, scratch_directory);
+	bool listening = socket_path.empty() ? worker.listen(address, port)
+										 : worker.listen_unix(socket_path);
+	std::string endpoint = socket_path.empty()
+							   ? address + ":" + std::to_string(worker.port())
+							   : "unix:" + socket_path;
+	if (!listening)
+	{
+		std::cerr << "Error: cannot listen on " << endpoint << "\n";
+		return -1;
+	}
+	std::cout << "Compiling on " << endpoint << " with " << jobs << " slots"
+			  << std::endl;
+	worker.serve();
+	return 0;
+}
@@ -1,8 +1,10 @@
 /* main.cxx */
 #include <chrono>
 #include <iostream>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "../include/coup_logger.hxx"
 #include "../include/coup_project.hxx"
@@ -18,19 +20,28 @@ int main(int argc, char *argv[])
 	}
 
 	std::string command = argv[1];
-	std::string option;
-	if (argc > 2)
+	std::vector<std::string> args(argv + 2, argv + argc);
+
+	std::optional<coup_project> proj;
+	try
+	{
+		proj.emplace(coup_project::make_project());
+	}
+	catch (const std::exception &e)
 	{
-		option = argv[2];
+		print_error(e.what());
+		return -1;
 	}
 
-	coup_project proj = coup_project::make_project();
 	try
 	{
-		proj.execute_command(command, option);
+		// a failed build or test run fails the process, e.g. in CI
+		if (!proj->execute_command(command, args))
+			return 1;
 	}
 	catch (const std::exception &e)
 	{
+		print_error(e.what());
 		print_usage();
 		return -1;
 	}
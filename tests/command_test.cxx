@@ -0,0 +1,78 @@
+/* command_test.cxx */
+// Runs the coup binary on a small project, checking what it exits with
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_system.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+class test_command : public testing::Test
+{
+protected:
+	fs::path root;
+	fs::path previous_directory;
+
+	void SetUp() override
+	{
+		if (!fs::exists("/usr/include/gtest/gtest.h"))
+		{
+			GTEST_SKIP() << "googletest is not installed";
+		}
+		root = unique_temp_dir();
+		fs::create_directories(root / "src");
+		fs::create_directories(root / "tests");
+		std::ofstream(root / "coup_config.json")
+			<< R"({ "cpp": "c++17", "source": ["src"], "build": "build",
+				"tests": [ { "name": "unit", "source": ["tests"],
+							 "link_flags": ["-lgtest", "-lgtest_main",
+											"-pthread"],
+							 "exclude": ["src/main.cxx"] } ] })";
+		std::ofstream(root / "src" / "main.cxx")
+			<< "int f();\nint main() { return f(); }\n";
+		std::ofstream(root / "src" / "f.cxx") << "int f() { return 0; }\n";
+		previous_directory = fs::current_path();
+		fs::current_path(root);
+	}
+
+	void TearDown() override
+	{
+		if (root.empty())
+			return;
+		fs::current_path(previous_directory);
+		fs::remove_all(root);
+	}
+
+	// exit code of `coup <command>` run in the project
+	int coup(const std::string &command)
+	{
+		int exit_code = spawn_process({ COUP_BINARY, command }, "coup.log");
+		std::cout << file_contents("coup.log");
+		return exit_code;
+	}
+};
+
+TEST_F(test_command, test_exit_status)
+{
+	std::ofstream(root / "tests" / "f_test.cxx")
+		<< "#include <gtest/gtest.h>\nint f();\n"
+		   "TEST(f, value) { EXPECT_EQ(f(), 1); }\n";
+	EXPECT_NE(coup("test"), 0);
+
+	std::ofstream(root / "tests" / "f_test.cxx")
+		<< "#include <gtest/gtest.h>\nint f();\n"
+		   "TEST(f, value) { EXPECT_EQ(f(), 0); }\n";
+	EXPECT_EQ(coup("test"), 0);
+}
+
+TEST_F(test_command, build_exit_status)
+{
+	EXPECT_EQ(coup("build"), 0);
+	std::ofstream(root / "src" / "f.cxx") << "int f() { return }\n";
+	EXPECT_NE(coup("build"), 0);
+}
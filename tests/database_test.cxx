@@ -0,0 +1,191 @@
+/* database_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../include/coup_database.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+class test_database : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		dir = unique_temp_dir();
+	}
+	void TearDown() override
+	{
+		fs::remove_all(dir);
+	}
+
+	fs::path dir;
+};
+
+TEST_F(test_database, save_and_load)
+{
+	build_database database;
+	build_record record;
+	record.source = "src/main.cxx";
+	record.object = "build/main.o";
+	record.command_hash = 42;
+	record.input_hash = 7;
+	record.dependencies = { "include/a.hxx", "include/b.hxx" };
+	database.update(record);
+	database.set_link_hash("build/debug/app", 99);
+	ASSERT_TRUE(database.save(dir / ".coup_db"));
+
+	build_database loaded;
+	ASSERT_TRUE(loaded.load(dir / ".coup_db"));
+	EXPECT_EQ(loaded.get_link_hash("build/debug/app"), 99);
+	EXPECT_EQ(loaded.get_link_hash("build/debug/other"), 0);
+
+	std::optional<build_record> found = loaded.find("src/main.cxx");
+	ASSERT_TRUE(found.has_value());
+	EXPECT_EQ(found->object, "build/main.o");
+	EXPECT_EQ(found->command_hash, 42);
+	EXPECT_EQ(found->input_hash, 7);
+	EXPECT_EQ(found->dependencies, record.dependencies);
+	EXPECT_FALSE(loaded.find("src/other.cxx").has_value());
+}
+
+TEST_F(test_database, reverse_index)
+{
+	build_database database;
+	build_record main_record;
+	main_record.source = "src/main.cxx";
+	main_record.compile_time = 1.5;
+	main_record.dependencies = { "include/a.hxx", "src/../include/b.hxx" };
+	database.update(main_record);
+	build_record util_record;
+	util_record.source = "src/util.cxx";
+	util_record.dependencies = { "include/a.hxx" };
+	database.update(util_record);
+
+	EXPECT_EQ(database.get_dependents("include/a.hxx").size(), 2);
+	EXPECT_EQ(database.get_dependents("include/b.hxx"),
+			  std::vector<std::string>{ "src/main.cxx" });
+
+	// a recompile that drops an include also drops it from the index
+	main_record.dependencies = { "include/a.hxx" };
+	database.update(main_record);
+	database.erase("src/util.cxx");
+	EXPECT_TRUE(database.get_dependents("include/b.hxx").empty());
+	ASSERT_TRUE(database.save(dir / ".coup_db"));
+
+	build_database loaded;
+	ASSERT_TRUE(loaded.load(dir / ".coup_db"));
+	EXPECT_EQ(loaded.get_dependents("include/a.hxx"),
+			  std::vector<std::string>{ "src/main.cxx" });
+	EXPECT_EQ(loaded.find("src/main.cxx")->compile_time, 1.5);
+}
+
+TEST_F(test_database, failures)
+{
+	build_database database;
+	build_record record;
+	record.source = "src/main.cxx";
+	database.update(record);
+	database.mark_failed("src/main.cxx");
+	database.mark_failed("src/util.cxx");
+	EXPECT_FALSE(database.find("src/main.cxx").has_value());
+	EXPECT_TRUE(database.has_failed("src/main.cxx"));
+	ASSERT_TRUE(database.save(dir / ".coup_db"));
+
+	build_database loaded;
+	ASSERT_TRUE(loaded.load(dir / ".coup_db"));
+	EXPECT_TRUE(loaded.has_failed("src/util.cxx"));
+	EXPECT_FALSE(loaded.has_failed("src/other.cxx"));
+
+	// a successful compile clears the failure
+	loaded.update(record);
+	EXPECT_FALSE(loaded.has_failed("src/main.cxx"));
+	EXPECT_EQ(loaded.size(), 1);
+}
+
+TEST_F(test_database, view)
+{
+	build_database database;
+	build_record record;
+	record.source = "src/main.cxx";
+	record.object = "build/main.o";
+	record.input_hash = 7;
+	record.dependencies = { "include/a.hxx" };
+	database.update(record);
+
+	std::optional<build_record_view> found = database.view("src/main.cxx");
+	ASSERT_TRUE(found.has_value());
+	EXPECT_EQ(found->object, "build/main.o");
+	EXPECT_EQ(found->input_hash, 7);
+	ASSERT_EQ(found->dependencies.size(), 1);
+	EXPECT_STREQ(database.get_path(found->dependencies[0]), "include/a.hxx");
+	EXPECT_FALSE(database.view("src/other.cxx").has_value());
+}
+
+// paths only erased records referred to are not written again
+TEST_F(test_database, compacts_paths)
+{
+	build_database database;
+	build_record record;
+	record.source = "src/main.cxx";
+	record.object = "build/main.o";
+	for (int i = 0; i < 100; ++i)
+		record.dependencies.push_back("include/h" + std::to_string(i) +
+									  ".hxx");
+	database.update(record);
+	ASSERT_TRUE(database.save(dir / ".coup_db"));
+	std::uintmax_t full_size = fs::file_size(dir / ".coup_db");
+
+	record.dependencies.resize(1);
+	database.update(record);
+	build_record other = record;
+	other.source = "src/other.cxx";
+	database.update(other);
+	database.erase("src/other.cxx");
+	ASSERT_TRUE(database.save(dir / ".coup_db"));
+	EXPECT_LT(fs::file_size(dir / ".coup_db"), full_size / 4);
+
+	build_database loaded;
+	ASSERT_TRUE(loaded.load(dir / ".coup_db"));
+	std::optional<build_record> found = loaded.find("src/main.cxx");
+	ASSERT_TRUE(found.has_value());
+	EXPECT_EQ(found->object, "build/main.o");
+	EXPECT_EQ(found->dependencies, record.dependencies);
+	EXPECT_EQ(loaded.get_dependents("include/h0.hxx"),
+			  std::vector<std::string>{ "src/main.cxx" });
+	EXPECT_TRUE(loaded.get_dependents("include/h1.hxx").empty());
+}
+
+TEST_F(test_database, rejects_foreign_file)
+{
+	std::ofstream(dir / ".coup_db") << "not a database";
+
+	build_database database;
+	EXPECT_FALSE(database.load(dir / ".coup_db"));
+	EXPECT_EQ(database.size(), 0);
+}
+
+TEST_F(test_database, packages)
+{
+	build_database database;
+	package_record record;
+	record.key = 5;
+	record.files = { { "/usr/lib/pkgconfig/zlib.pc", 123 } };
+	record.compile_flags = { "-I/usr/include/zlib" };
+	record.link_flags = { "-lz" };
+	database.set_package("zlib", record);
+	ASSERT_TRUE(database.save(dir / ".coup_db"));
+
+	build_database loaded;
+	ASSERT_TRUE(loaded.load(dir / ".coup_db"));
+	const package_record *found = loaded.find_package("zlib");
+	ASSERT_NE(found, nullptr);
+	EXPECT_EQ(found->key, 5);
+	EXPECT_EQ(found->files, record.files);
+	EXPECT_EQ(found->compile_flags, record.compile_flags);
+	EXPECT_EQ(found->link_flags, record.link_flags);
+	EXPECT_EQ(loaded.find_package("other"), nullptr);
+}
@@ -0,0 +1,112 @@
+/* distributed_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/coup_distributed.hxx"
+#include "../include/coup_net.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+TEST(distributed, fields)
+{
+	std::vector<std::string> fields = { "g++", "", std::string("a\0:b", 4) };
+	std::optional<std::vector<std::string>> decoded =
+		decode_fields(encode_fields(fields));
+	ASSERT_TRUE(decoded.has_value());
+	EXPECT_EQ(*decoded, fields);
+	EXPECT_FALSE(decode_fields("5:abc").has_value());
+	EXPECT_FALSE(decode_fields("x:abc").has_value());
+}
+
+TEST(distributed, compiler_driver)
+{
+	EXPECT_TRUE(is_compiler_driver("g++"));
+	EXPECT_TRUE(is_compiler_driver("/usr/bin/clang++-17"));
+	EXPECT_TRUE(is_compiler_driver("gcc-13.2"));
+	EXPECT_FALSE(is_compiler_driver("sh"));
+	EXPECT_FALSE(is_compiler_driver("g++-evil"));
+}
+
+TEST(distributed, worker_compile)
+{
+	EXPECT_TRUE(is_worker_compile({ "g++", "-std=c++20", "-O2", "-g", "-Wall",
+									"-fPIC", "-march=native", "-x",
+									"c++-cpp-output", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "sh", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-o", "/tmp/x", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-x", "c++", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-wrapper", "sh,-c", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-fplugin=/tmp/p.so", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-fdump-tree-all", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-specs=/tmp/s", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-B/tmp", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "@/tmp/args", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-MF", "/tmp/d", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-Wl,-o,/tmp/x", "-c" }));
+}
+
+// -f flags are accepted by name, never for reading or writing files
+TEST(distributed, worker_f_flags)
+{
+	EXPECT_TRUE(is_worker_compile({ "g++", "-fno-exceptions",
+									"-fvisibility=hidden",
+									"-fsanitize=address",
+									"-fdiagnostics-color=always", "-c" }));
+	for (const char *flag :
+		 { "-fdeps-file=/tmp/d", "-fdeps-format=p1689r5",
+		   "-foptimization-record-file=/tmp/r",
+		   "-fembed-offload-object=/etc/passwd", "-fprofile-generate",
+		   "-fno-plugin", "-fsanitize-ignorelist=/tmp/i", "-fnew-flag" })
+	{
+		EXPECT_FALSE(is_worker_compile({ "g++", flag, "-c" })) << flag;
+	}
+	EXPECT_FALSE(is_worker_compile({ "clang++", "-mllvm", "-x", "-c" }));
+	EXPECT_FALSE(is_worker_compile(
+		{ "clang++", "-Xclang", "-load", "-Xclang", "/tmp/p.so", "-c" }));
+	EXPECT_FALSE(is_worker_compile({ "g++", "-Xlinker", "-c" }));
+}
+
+TEST(distributed, unix_socket_worker)
+{
+	fs::path directory = unique_temp_dir();
+	std::string socket_path = (directory / "worker.sock").string();
+
+	compile_worker server(2, directory / "scratch");
+	ASSERT_TRUE(server.listen_unix(socket_path));
+	std::thread server_thread(&compile_worker::serve, &server);
+
+	std::optional<http_url> url = parse_socket_address("unix:" + socket_path);
+	ASSERT_TRUE(url.has_value());
+	remote_worker worker("unix:" + socket_path, *url);
+	ASSERT_TRUE(worker.connect());
+	EXPECT_EQ(worker.get_slots(), 2);
+
+	std::optional<remote_compile> compiled =
+		worker.compile({ "g++", "-x", "c++-cpp-output", "-c" },
+					   "int f() { return 1; }\n");
+	ASSERT_TRUE(compiled.has_value());
+	EXPECT_EQ(compiled->exit_code, 0);
+	EXPECT_EQ(compiled->object.substr(0, 4), "\x7f" "ELF");
+
+	compiled = worker.compile({ "g++", "-x", "c++-cpp-output", "-c" },
+							  "int f() { return }\n");
+	ASSERT_TRUE(compiled.has_value());
+	EXPECT_NE(compiled->exit_code, 0);
+	EXPECT_NE(compiled->output.find("error"), std::string::npos);
+
+	// only compilers run on a worker, and never with an output of choice
+	EXPECT_FALSE(worker.compile({ "sh", "-c" }, "true").has_value());
+	EXPECT_FALSE(
+		worker.compile({ "g++", "-o", "/tmp/x", "-c" }, "").has_value());
+	EXPECT_FALSE(worker.compile({ "g++", "-fplugin=/tmp/p.so", "-c" }, "")
+					 .has_value());
+
+	server.stop();
+	server_thread.join();
+	fs::remove_all(directory);
+}
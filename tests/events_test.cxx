@@ -0,0 +1,49 @@
+/* events_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include "../include/coup_events.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+TEST(events, json_lines)
+{
+	fs::path directory = unique_temp_dir();
+	fs::path events_file = directory / "events";
+
+	event_stream events;
+	events.emit("ignored", { { "source", "src/a.cxx" } });
+	ASSERT_TRUE(events.open(events_file.string()));
+	for (int i = 0; i < 1000; ++i)
+	{
+		events.emit("job_finished",
+					{ { "source", "src/\"" + std::to_string(i) + "\".cxx" },
+					  { "success", true } });
+	}
+	events.close();
+	EXPECT_FALSE(events.is_open());
+
+	std::ifstream input(events_file);
+	std::vector<nlohmann::json> lines;
+	std::string line;
+	while (std::getline(input, line))
+		lines.push_back(nlohmann::json::parse(line));
+	ASSERT_EQ(lines.size(), 1000);
+	EXPECT_EQ(lines[0]["event"], "job_finished");
+	EXPECT_EQ(lines[999]["source"], "src/\"999\".cxx");
+	EXPECT_TRUE(lines[999].contains("time"));
+
+	fs::remove_all(directory);
+}
+
+TEST(events, bad_destination)
+{
+	event_stream events;
+	EXPECT_FALSE(events.open("/nonexistent/dir/events"));
+	EXPECT_FALSE(events.open("987654"));
+}
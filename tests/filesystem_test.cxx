@@ -1,10 +1,12 @@
 /* filesystem_test.cxx */
 #include <gtest/gtest.h>
 #include <filesystem>
+#include <fstream>
 #include <string>
 #include <vector>
 #include <iostream>
 #include "../include/coup_filesystem.hxx"
+#include "test_directory.hxx"
 
 namespace fs = std::filesystem;
 using namespace coup;
@@ -117,3 +119,81 @@ TEST_F(test_filesystem, obj_files_test)
 		std::cout << obj.string() << "\n";
 	}
 }
+
+TEST_F(test_filesystem, output_file_test)
+{
+	EXPECT_EQ(make_output_file("src/net/util.cxx", "build/debug/obj", "o"),
+			  fs::path("build/debug/obj/src/net/util.cxx.o"));
+	EXPECT_EQ(make_output_file("src/util.cxx", "build/debug/obj", "d"),
+			  fs::path("build/debug/obj/src/util.cxx.d"));
+	EXPECT_NE(make_output_file("src/a/util.cxx", "out", "o"),
+			  make_output_file("src/b/util.cxx", "out", "o"));
+	EXPECT_EQ(make_output_file("../lib/x.cpp", "out", "o"),
+			  fs::path("out/__/lib/x.cpp.o"));
+	EXPECT_EQ(make_output_file("/abs/y.cc", "out", "o"),
+			  fs::path("out/abs/y.cc.o"));
+}
+
+TEST_F(test_filesystem, parent_directories_test)
+{
+	fs::path tmp = unique_temp_dir();
+
+	std::vector<fs::path> files = { tmp / "a/b/x.o", tmp / "a/b/y.o",
+									tmp / "a/c/z.o", tmp / "d/w.o" };
+	EXPECT_TRUE(make_parent_directories(files));
+	EXPECT_TRUE(fs::is_directory(tmp / "a/b"));
+	EXPECT_TRUE(fs::is_directory(tmp / "a/c"));
+	EXPECT_TRUE(fs::is_directory(tmp / "d"));
+
+	fs::remove_all(tmp);
+}
+
+TEST_F(test_filesystem, output_source_test)
+{
+	for (const char *src : { "src/net/util.cxx", "src/main.cpp",
+							 "../lib/x.cpp" })
+	{
+		fs::path obj = make_output_file(src, "build/debug/obj", "o");
+		EXPECT_EQ(get_output_source(obj, "build/debug/obj"), fs::path(src));
+	}
+}
+
+TEST_F(test_filesystem, include_chain_test)
+{
+	fs::path tmp = unique_temp_dir();
+	fs::create_directories(tmp / "src");
+	fs::create_directories(tmp / "include");
+
+	std::ofstream(tmp / "src/main.cxx")
+		<< "#include <vector>\n#include \"../include/b.hxx\"\n";
+	std::ofstream(tmp / "include/b.hxx") << "  #  include <a.hxx>\n";
+	std::ofstream(tmp / "include/a.hxx") << "int a();\n";
+
+	std::string main_file = (tmp / "src/main.cxx").string();
+	std::string a_file = (tmp / "include/a.hxx").string();
+	std::string b_file = (tmp / "include/b.hxx").string();
+	std::vector<std::string> dependencies = {
+		(tmp / "src/../include/b.hxx").string(), a_file
+	};
+
+	EXPECT_EQ(parse_include_directives(main_file),
+			  (std::vector<std::string>{ "vector", "../include/b.hxx" }));
+	EXPECT_EQ(find_include_chain(main_file, a_file, dependencies),
+			  (std::vector<std::string>{ main_file, b_file, a_file }));
+	EXPECT_TRUE(find_include_chain(b_file, main_file, dependencies).empty());
+
+	fs::remove_all(tmp);
+}
+
+TEST_F(test_filesystem, write_if_changed_test)
+{
+	fs::path tmp = unique_temp_dir();
+	fs::path file = tmp / "compile_commands.json";
+
+	EXPECT_TRUE(write_file_if_changed(file, "[]\n"));
+	EXPECT_FALSE(write_file_if_changed(file, "[]\n"));
+	EXPECT_TRUE(write_file_if_changed(file, "[1]\n"));
+	EXPECT_EQ(file_contents(file), "[1]\n");
+
+	fs::remove_all(tmp);
+}
@@ -0,0 +1,124 @@
+/* hash_test.cxx */
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../include/coup_hash.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+class test_hash : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		dir = unique_temp_dir();
+	}
+	void TearDown() override
+	{
+		fs::remove_all(dir);
+	}
+
+	fs::path write_file(const std::string &name, const std::string &content)
+	{
+		fs::path file = dir / name;
+		std::ofstream output(file, std::ios::trunc);
+		output << content;
+		output.close();
+		// age the file so it is outside the racy window and gets memoized
+		fs::last_write_time(file, fs::file_time_type::clock::now() -
+									  std::chrono::hours(1));
+		return file;
+	}
+
+	fs::path dir;
+};
+
+TEST_F(test_hash, known_vectors)
+{
+	EXPECT_EQ(hash_string(""), 0xEF46DB3751D8E999ULL);
+	EXPECT_EQ(hash_string("a"), 0xD24EC4F1A98C6E5BULL);
+	EXPECT_EQ(hash_string("abc"), 0x44BC2CF5AD770999ULL);
+}
+
+TEST_F(test_hash, long_input)
+{
+	std::string s(1000, 'x');
+	EXPECT_EQ(hash_string(s), hash_string(std::string(1000, 'x')));
+	s[999] = 'y';
+	EXPECT_NE(hash_string(s), hash_string(std::string(1000, 'x')));
+}
+
+TEST_F(test_hash, hash_strings)
+{
+	EXPECT_NE(hash_strings({ "-O2", "-g" }), hash_strings({ "-g", "-O2" }));
+	EXPECT_NE(hash_strings({ "ab", "c" }), hash_strings({ "a", "bc" }));
+	EXPECT_EQ(hash_to_string(0x1234).size(), 16);
+}
+
+TEST_F(test_hash, file_hash)
+{
+	fs::path file = write_file("a.cxx", "int main() {}\n");
+	hash_cache cache;
+
+	std::optional<hash_t> hash = cache.hash_file(file);
+	ASSERT_TRUE(hash.has_value());
+	EXPECT_EQ(*hash, hash_string("int main() {}\n"));
+	EXPECT_EQ(cache.size(), 1);
+
+	write_file("a.cxx", "int main() { return 1; }\n");
+	EXPECT_EQ(cache.hash_file(file), hash_string("int main() { return 1; }\n"));
+
+	EXPECT_FALSE(cache.hash_file(dir / "missing.cxx").has_value());
+}
+
+TEST_F(test_hash, parallel_hash_files)
+{
+	std::vector<fs::path> files;
+	for (int i = 0; i < 64; ++i)
+	{
+		files.push_back(write_file(std::to_string(i) + ".hxx",
+								   "header " + std::to_string(i)));
+	}
+
+	hash_cache cache;
+	std::vector<std::optional<hash_t>> hashes = cache.hash_files(files);
+	ASSERT_EQ(hashes.size(), files.size());
+	for (int i = 0; i < 64; ++i)
+	{
+		EXPECT_EQ(hashes[i], hash_string("header " + std::to_string(i)));
+	}
+}
+
+TEST_F(test_hash, save_and_load)
+{
+	fs::path file = write_file("b.cxx", "void f();\n");
+	fs::path cache_file = dir / ".coup_hashes";
+
+	hash_cache cache;
+	ASSERT_TRUE(cache.hash_file(file).has_value());
+	EXPECT_TRUE(cache.save(cache_file));
+
+	hash_cache loaded;
+	EXPECT_TRUE(loaded.load(cache_file));
+	EXPECT_EQ(loaded.size(), 1);
+	EXPECT_EQ(loaded.hash_file(file), hash_string("void f();\n"));
+
+	hash_cache missing;
+	EXPECT_FALSE(missing.load(dir / "does_not_exist"));
+
+	// a count far beyond what the file holds
+	std::uint64_t count = 1ull << 60;
+	std::fstream corrupt(cache_file, std::ios::in | std::ios::out |
+										 std::ios::binary);
+	corrupt.seekp(8);
+	corrupt.write(reinterpret_cast<const char *>(&count), sizeof(count));
+	corrupt.close();
+	EXPECT_FALSE(loaded.load(cache_file));
+	EXPECT_EQ(loaded.size(), 0);
+}
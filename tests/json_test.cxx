@@ -1,13 +1,20 @@
 /* json_test.cxx */
 #include <gtest/gtest.h>
+#include <chrono>
 #include <nlohmann/json.hpp>
 #include <iostream>
 #include <stdexcept>
 #include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
 #include "../include/coup_json.hxx"
+#include "../include/coup_filesystem.hxx"
+#include "test_directory.hxx"
 
 #define GOOD_CONFIG "../tests/config_examples/good_config.json"
 #define BAD_CONFIG "../tests/config_examples/bad_config.json"
+#define OVERRIDE_CONFIG "../tests/config_examples/override_config.json"
 
 namespace fs = std::filesystem;
 using namespace coup;
@@ -90,3 +97,135 @@ TEST_F(test_json, get_compile_flags)
 	EXPECT_TRUE(find_wextra != compile_flags.end());
 	EXPECT_TRUE(find_wpedantic != compile_flags.end());
 }
+
+TEST_F(test_json, get_compile_options)
+{
+	good = coup_json(fs::path(OVERRIDE_CONFIG));
+
+	compile_options main_options = good.get_compile_options("src/main.cxx");
+	EXPECT_EQ(main_options.compiler, "g++");
+	EXPECT_EQ(main_options.cpp_standard, "c++20");
+	EXPECT_EQ(main_options.flags, std::vector<std::string>{ "-Wall" });
+	EXPECT_EQ(main_options.defines, std::vector<std::string>{ "APP=1" });
+	EXPECT_EQ(main_options.include_directories,
+			  std::vector<std::string>{ "include" });
+
+	compile_options lexer_options =
+		good.get_compile_options("src/legacy/lexer.cxx");
+	EXPECT_EQ(lexer_options.flags,
+			  (std::vector<std::string>{ "-Wall", "-Wno-deprecated" }));
+	EXPECT_EQ(lexer_options.defines, std::vector<std::string>{ "APP=1" });
+
+	compile_options parser_options =
+		good.get_compile_options("src/legacy/parser.cxx");
+	EXPECT_EQ(parser_options.flags,
+			  (std::vector<std::string>{ "-Wall", "-Wno-deprecated" }));
+	EXPECT_EQ(parser_options.defines,
+			  (std::vector<std::string>{ "APP=1", "PARSER_DEBUG" }));
+}
+
+TEST_F(test_json, get_profile)
+{
+	good = coup_json(fs::path(OVERRIDE_CONFIG));
+	EXPECT_EQ(good.get_default_profile(), "fast");
+
+	build_profile fast = good.get_profile("fast");
+	EXPECT_EQ(fast.compile_flags, std::vector<std::string>{ "-O3" });
+	EXPECT_EQ(good.get_link_flags(fast), std::vector<std::string>{ "-flto" });
+
+	build_profile release = good.get_profile("release");
+	EXPECT_EQ(release.defines, std::vector<std::string>{ "NDEBUG" });
+
+	compile_options options = good.get_compile_options("src/legacy/a.cxx",
+													   release);
+	EXPECT_EQ(options.flags, (std::vector<std::string>{ "-Wall", "-O2",
+														"-Wno-deprecated" }));
+	EXPECT_EQ(options.defines,
+			  (std::vector<std::string>{ "APP=1", "NDEBUG" }));
+
+	EXPECT_THROW(good.get_profile("missing"), std::runtime_error);
+}
+
+TEST_F(test_json, validation_reports_every_error)
+{
+	try
+	{
+		parse_project_config(R"({ "cpp": 20, "source": "src",
+			"compile_flags": ["-Wall", 3], "modules": "yes",
+			"tests": [ { "name": "unit" } ],
+			"default_profile": "fast" })");
+		FAIL() << "invalid configuration accepted";
+	}
+	catch (const std::runtime_error &e)
+	{
+		std::string message = e.what();
+		EXPECT_NE(message.find("\"build\" is required"), std::string::npos);
+		EXPECT_NE(message.find("\"cpp\" must be a string"), std::string::npos);
+		EXPECT_NE(message.find("\"source\" must be an array"),
+				  std::string::npos);
+		EXPECT_NE(message.find("\"compile_flags\" must be an array"),
+				  std::string::npos);
+		EXPECT_NE(message.find("\"modules\" must be true or false"),
+				  std::string::npos);
+		EXPECT_NE(message.find("\"tests\"[0]: \"source\" is required"),
+				  std::string::npos);
+		EXPECT_NE(message.find("names no profile: fast"), std::string::npos);
+	}
+	EXPECT_THROW(parse_project_config("{ \"cpp\": "), std::runtime_error);
+}
+
+TEST_F(test_json, snapshot)
+{
+	fs::path directory = unique_temp_dir();
+	fs::path config_file = directory / "coup_config.json";
+	fs::path snapshot_file = directory / "build" / ".coup_config.cache";
+	fs::copy_file(OVERRIDE_CONFIG, config_file);
+	fs::last_write_time(config_file, fs::file_time_type::clock::now() -
+										 std::chrono::hours(1));
+
+	coup_json parsed = coup_json::load(config_file, ".coup_config.cache");
+	ASSERT_TRUE(fs::exists(snapshot_file));
+	EXPECT_FALSE(fs::exists(directory / ".coup_config.cache"));
+	EXPECT_EQ(parsed.get_default_profile(), "fast");
+
+	// same mtime and size: the snapshot is used without reading the file
+	auto mtime = fs::last_write_time(config_file);
+	std::string contents = file_contents(config_file);
+	{
+		std::ofstream output(config_file, std::ios::trunc);
+		output << std::string(contents.size(), ' ');
+	}
+	fs::last_write_time(config_file, mtime);
+	coup_json loaded = coup_json::load(config_file, ".coup_config.cache");
+	EXPECT_EQ(loaded.dump(-1), parsed.dump(-1));
+	EXPECT_EQ(loaded.get_compile_options("src/legacy/parser.cxx").defines,
+			  (std::vector<std::string>{ "APP=1", "PARSER_DEBUG" }));
+	EXPECT_EQ(loaded.get_profile("fast").link_flags,
+			  std::vector<std::string>{ "-flto" });
+	EXPECT_TRUE(loaded.contains("overrides"));
+	EXPECT_FALSE(loaded.contains("tests"));
+
+	// changed contents are parsed again, and the snapshot moves along with
+	// the build directory
+	{
+		std::ofstream output(config_file, std::ios::trunc);
+		output << R"({ "cpp": "c++17", "source": ["lib"], "build": "out" })";
+	}
+	coup_json changed = coup_json::load(config_file, ".coup_config.cache");
+	EXPECT_EQ(changed.get_cpp_version(), "c++17");
+	EXPECT_EQ(changed.get_default_profile(), "debug");
+	EXPECT_FALSE(fs::exists(snapshot_file));
+	EXPECT_TRUE(fs::exists(directory / "out" / ".coup_config.cache"));
+
+	// written just now: a second write of the same size within the same
+	// mtime is still noticed
+	mtime = fs::last_write_time(config_file);
+	{
+		std::ofstream output(config_file, std::ios::trunc);
+		output << R"({ "cpp": "c++20", "source": ["lib"], "build": "out" })";
+	}
+	fs::last_write_time(config_file, mtime);
+	coup_json rewritten = coup_json::load(config_file, ".coup_config.cache");
+	EXPECT_EQ(rewritten.get_cpp_version(), "c++20");
+	fs::remove_all(directory);
+}
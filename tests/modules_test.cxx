@@ -0,0 +1,179 @@
+/* modules_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_modules.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+TEST(modules, scan_interface)
+{
+	module_scan scan = scan_module_source(
+		"module;\n"
+		"#include <vector>\n"
+		"export module app.core:io;\n"
+		"// import commented;\n"
+		"/* import blocked; */\n"
+		"import :detail;\n"
+		"export import app.util;\n"
+		"import app.util;\n"
+		"const char *s = \"import quoted;\";\n"
+		"const char *r = R\"x(import raw;)x\";\n"
+		"int import = 1;\n"
+		"export int f() { return import; }\n");
+	EXPECT_EQ(scan.provides, "app.core:io");
+	EXPECT_EQ(scan.imports,
+			  (std::vector<std::string>{ "app.core:detail", "app.util" }));
+	EXPECT_TRUE(scan.header_units.empty());
+}
+
+TEST(modules, scan_units)
+{
+	module_scan implementation = scan_module_source("module app;\n"
+													"int g() { return 2; }\n");
+	EXPECT_EQ(implementation.provides, "");
+	EXPECT_EQ(implementation.imports, std::vector<std::string>{ "app" });
+
+	module_scan header_unit = scan_module_source("import <vector>;\n");
+	EXPECT_EQ(header_unit.header_units, std::vector<std::string>{ "vector" });
+
+	module_scan plain = scan_module_source("#include <cstdio>\n"
+										   "int main() { return 0; }\n");
+	EXPECT_FALSE(plain.uses_modules());
+}
+
+TEST(modules, parse_p1689)
+{
+	std::optional<module_scan> scan = parse_p1689(R"({
+		"rules": [{
+			"primary-output": "m.o",
+			"provides": [{"logical-name": "m", "is-interface": true}],
+			"requires": [{"logical-name": "n"},
+						 {"logical-name": "<vector>",
+						  "lookup-method": "include-angle",
+						  "source-path": "/usr/include/vector"}]
+		}],
+		"version": 0, "revision": 0
+	})");
+	ASSERT_TRUE(scan.has_value());
+	EXPECT_EQ(scan->provides, "m");
+	EXPECT_EQ(scan->imports, std::vector<std::string>{ "n" });
+	EXPECT_EQ(scan->header_units,
+			  std::vector<std::string>{ "/usr/include/vector" });
+	EXPECT_FALSE(parse_p1689("{}").has_value());
+	EXPECT_FALSE(parse_p1689("not json").has_value());
+}
+
+TEST(modules, graph)
+{
+	std::vector<fs::path> sources = { "main.cxx", "b.cxx", "a.cxx" };
+	std::vector<module_scan> scans(3);
+	scans[0].imports = { "b" };
+	scans[1].provides = "b";
+	scans[1].imports = { "a" };
+	scans[2].provides = "a";
+
+	module_graph graph;
+	ASSERT_FALSE(make_module_graph(sources, scans, graph).has_value());
+	EXPECT_EQ(graph.order, (std::vector<std::size_t>{ 2, 1, 0 }));
+	EXPECT_EQ(graph.dependencies[0], std::vector<std::size_t>{ 1 });
+	EXPECT_EQ(graph.imports[0], (std::vector<std::string>{ "a", "b" }));
+	EXPECT_EQ(make_module_mapper(graph, "bmi", "g++"),
+			  "b bmi/b.gcm\na bmi/a.gcm\n");
+
+	std::vector<std::string> flags =
+		module_flags(graph, 1, "b.cxx", "bmi", "bmi/mapper", "clang++");
+	EXPECT_EQ(flags, (std::vector<std::string>{
+						 "-x", "c++-module", "-fmodule-output=bmi/b.pcm",
+						 "-fmodule-file=a=bmi/a.pcm" }));
+
+	scans[2].imports = { "b" };
+	std::optional<std::string> cycle = make_module_graph(sources, scans, graph);
+	ASSERT_TRUE(cycle.has_value());
+	EXPECT_NE(cycle->find("cycle"), std::string::npos);
+
+	scans[2].imports.clear();
+	scans[0].imports = { "c" };
+	std::optional<std::string> missing =
+		make_module_graph(sources, scans, graph);
+	ASSERT_TRUE(missing.has_value());
+	EXPECT_NE(missing->find("not provided"), std::string::npos);
+
+	scans[0] = scans[2];
+	EXPECT_TRUE(make_module_graph(sources, scans, graph).has_value());
+}
+
+TEST(modules, scan_cache)
+{
+	fs::path directory = unique_temp_dir();
+	fs::path cache_file = directory / "scans";
+	module_scan scan;
+	scan.provides = "m:part";
+	scan.imports = { "n", "o.p" };
+
+	module_scan_cache cache;
+	cache.record("src/m.cxx", 42, scan);
+	cache.record("src/main.cxx", 7, module_scan{});
+	ASSERT_TRUE(cache.save(cache_file));
+
+	module_scan_cache loaded;
+	ASSERT_TRUE(loaded.load(cache_file));
+	const module_scan *found = loaded.find("src/m.cxx", 42);
+	ASSERT_NE(found, nullptr);
+	EXPECT_EQ(found->provides, "m:part");
+	EXPECT_EQ(found->imports, scan.imports);
+	ASSERT_NE(loaded.find("src/main.cxx", 7), nullptr);
+	EXPECT_FALSE(loaded.find("src/main.cxx", 7)->uses_modules());
+	EXPECT_EQ(loaded.find("src/m.cxx", 43), nullptr);
+	fs::remove_all(directory);
+}
+
+// damaged lines are skipped instead of failing the load
+TEST(modules, corrupt_scan_cache)
+{
+	fs::path directory = unique_temp_dir();
+	fs::path cache_file = directory / "scans";
+	std::ofstream(cache_file) << "src/a.cxx\tzz\tm\t\n"
+								 "src/b.cxx\t\tm\t\n"
+								 "src/c.cxx\t1ffffffffffffffff\tm\t\n"
+								 "src/d.cxx\t2a\tn\to\n"
+								 "src/e.cxx\t2a";
+
+	module_scan_cache loaded;
+	ASSERT_TRUE(loaded.load(cache_file));
+	EXPECT_EQ(loaded.find("src/a.cxx", 0), nullptr);
+	EXPECT_EQ(loaded.find("src/b.cxx", 0), nullptr);
+	EXPECT_EQ(loaded.find("src/c.cxx", 0xffffffffffffffffULL), nullptr);
+	const module_scan *found = loaded.find("src/d.cxx", 42);
+	ASSERT_NE(found, nullptr);
+	EXPECT_EQ(found->provides, "n");
+	EXPECT_EQ(found->imports, std::vector<std::string>{ "o" });
+	EXPECT_EQ(loaded.find("src/e.cxx", 42), nullptr);
+	fs::remove_all(directory);
+}
+
+// gcc lists module names and rules for the interface in the depfile
+TEST(modules, gcc_depfile)
+{
+	fs::path directory = unique_temp_dir();
+	fs::path dep_file = directory / "m.d";
+	{
+		std::ofstream output(dep_file);
+		output << "m.o bmi/m.gcm: m.cxx \\\n"
+				  " include/a.hxx\n"
+				  "m.o bmi/m.gcm: m:p.c++m\n"
+				  "m.c++m: bmi/m.gcm\n"
+				  ".PHONY: m.c++m\n"
+				  "bmi/m.gcm:| m.o\n"
+				  "CXX_IMPORTS += m:p.c++m\n";
+	}
+	EXPECT_EQ(parse_dependency_file(dep_file),
+			  (std::vector<std::string>{ "m.cxx", "include/a.hxx" }));
+	fs::remove_all(directory);
+}
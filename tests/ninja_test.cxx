@@ -0,0 +1,56 @@
+/* ninja_test.cxx */
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "../include/coup_ninja.hxx"
+
+using namespace coup;
+
+TEST(ninja, escaping)
+{
+	EXPECT_EQ(ninja_escape_path("src/a b.cxx"), "src/a$ b.cxx");
+	EXPECT_EQ(ninja_escape_path("c:/$x"), "c$:/$$x");
+	EXPECT_EQ(ninja_escape_value("g++ -DX='$a b'"), "g++ -DX='$$a b'");
+}
+
+TEST(ninja, build_file)
+{
+	ninja_profile debug;
+	debug.name = "debug";
+	debug.compiles.push_back({ "src/a.cxx", "build/debug/obj/src/a.o",
+							   "build/debug/obj/src/a.d",
+							   "g++ -c src/a.cxx -o build/debug/obj/src/a.o" });
+	debug.executable = { "build/debug/app",
+						 { "build/debug/obj/src/a.o" },
+						 "g++ build/debug/obj/src/a.o -o build/debug/app" };
+	debug.tests.push_back({ "build/debug/tests/unit",
+							{ "build/debug/obj/src/a.o" },
+							"g++ -o build/debug/tests/unit" });
+	ninja_generator generator{ "build/build.ninja",
+							   "/usr/bin/coup generate ninja",
+							   { "coup_config.json", "src" } };
+
+	std::string ninja = make_ninja_file({ debug }, "debug", "build", generator);
+	EXPECT_NE(ninja.find("rule cc\n  command = $cmd\n  depfile = $dep\n"
+						 "  deps = gcc\n  description"),
+			  std::string::npos);
+	EXPECT_NE(ninja.find("rule regenerate\n"
+						 "  command = /usr/bin/coup generate ninja\n"
+						 "  generator = 1\n  restat = 1\n"),
+			  std::string::npos);
+	EXPECT_NE(ninja.find("build build/build.ninja: regenerate $\n"
+						 "    coup_config.json $\n    src\n"),
+			  std::string::npos);
+	EXPECT_NE(ninja.find("build build/debug/obj/src/a.o: cc src/a.cxx\n"
+						 "  cmd = g++ -c src/a.cxx -o build/debug/obj/src/a.o\n"
+						 "  dep = build/debug/obj/src/a.d\n"),
+			  std::string::npos);
+	EXPECT_NE(ninja.find("build build/debug/app: link $\n"
+						 "    build/debug/obj/src/a.o\n"),
+			  std::string::npos);
+	EXPECT_NE(ninja.find("build debug: phony build/debug/app\n"),
+			  std::string::npos);
+	EXPECT_NE(ninja.find("build debug_tests: phony build/debug/tests/unit\n"),
+			  std::string::npos);
+	EXPECT_NE(ninja.find("default debug\n"), std::string::npos);
+}
@@ -0,0 +1,107 @@
+/* packages_test.cxx */
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../include/coup_packages.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+class test_packages : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		dir = unique_temp_dir();
+	}
+	void TearDown() override
+	{
+		fs::remove_all(dir);
+	}
+
+	fs::path dir;
+};
+
+TEST(packages, split_output)
+{
+	EXPECT_EQ(split_pkg_config_output("-I/usr/include/foo  -DFOO=1 \n"),
+			  (std::vector<std::string>{ "-I/usr/include/foo", "-DFOO=1" }));
+	EXPECT_EQ(split_pkg_config_output("-I/opt/my\\ dir -lfoo"),
+			  (std::vector<std::string>{ "-I/opt/my dir", "-lfoo" }));
+	EXPECT_TRUE(split_pkg_config_output(" \n").empty());
+}
+
+// a prefix without a .pc file: include and lib directories below it
+TEST_F(test_packages, prefix)
+{
+	fs::create_directories(dir / "include");
+	fs::create_directories(dir / "lib");
+	package_dependency dependency;
+	dependency.name = "foo";
+	dependency.prefix = dir.string();
+	package_record record = resolve_package(dependency, dir / "scratch");
+
+	std::string lib = (dir / "lib").string();
+	EXPECT_EQ(record.compile_flags,
+			  std::vector<std::string>{ "-I" + (dir / "include").string() });
+	EXPECT_EQ(record.link_flags,
+			  (std::vector<std::string>{ "-L" + lib, "-Wl,-rpath," + lib,
+										 "-lfoo" }));
+	EXPECT_TRUE(is_current(record, package_key(dependency)));
+
+	dependency.libs = { "foo_core", "foo_io" };
+	EXPECT_FALSE(is_current(record, package_key(dependency)));
+
+	// a .pc file installed later is used from then on
+	dependency.libs.clear();
+	fs::create_directories(dir / "lib" / "pkgconfig");
+	std::ofstream(dir / "lib" / "pkgconfig" / "foo.pc") << "";
+	EXPECT_FALSE(is_current(record, package_key(dependency)));
+
+	dependency.prefix = (dir / "missing").string();
+	EXPECT_THROW(resolve_package(dependency, dir / "scratch"),
+				 std::runtime_error);
+}
+
+TEST_F(test_packages, pkg_config)
+{
+	if (std::system("pkg-config --version > /dev/null 2>&1") != 0)
+	{
+		GTEST_SKIP() << "pkg-config is not installed";
+	}
+	fs::create_directories(dir / "lib" / "pkgconfig");
+	fs::path pc_file = dir / "lib" / "pkgconfig" / "foo.pc";
+	std::ofstream(pc_file) << "prefix=" << dir.string() << "\n"
+						   << "Name: foo\n"
+						   << "Description: test library\n"
+						   << "Version: 1.0\n"
+						   << "Cflags: -I${prefix}/include/foo -DFOO\n"
+						   << "Libs: -L${prefix}/lib -lfoo\n";
+	package_dependency dependency;
+	dependency.name = "foo";
+	dependency.prefix = dir.string();
+	package_record record = resolve_package(dependency, dir / "scratch");
+
+	EXPECT_EQ(record.compile_flags,
+			  (std::vector<std::string>{
+				  "-I" + (dir / "include" / "foo").string(), "-DFOO" }));
+	EXPECT_EQ(record.link_flags,
+			  (std::vector<std::string>{ "-L" + (dir / "lib").string(),
+										 "-lfoo" }));
+	EXPECT_TRUE(is_current(record, package_key(dependency)));
+
+	fs::last_write_time(pc_file,
+						fs::last_write_time(pc_file) + std::chrono::seconds(1));
+	EXPECT_FALSE(is_current(record, package_key(dependency)));
+
+	dependency.name = "coup-no-such-package";
+	dependency.prefix.clear();
+	EXPECT_THROW(resolve_package(dependency, dir / "scratch"),
+				 std::runtime_error);
+}
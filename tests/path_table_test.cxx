@@ -0,0 +1,70 @@
+/* path_table_test.cxx */
+#include <gtest/gtest.h>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../include/coup_path_table.hxx"
+
+using namespace coup;
+
+TEST(path_table, intern)
+{
+	path_table paths;
+	path_id a = paths.intern("include/a.hxx");
+	path_id b = paths.intern("src/main.cxx");
+	EXPECT_EQ(a, 0);
+	EXPECT_EQ(b, 1);
+	EXPECT_EQ(paths.intern("include/a.hxx"), a);
+	EXPECT_EQ(paths.intern(""), 2);
+	EXPECT_EQ(paths.size(), 3);
+	EXPECT_EQ(paths.get(b), "src/main.cxx");
+	EXPECT_EQ(paths.get(2), "");
+	EXPECT_EQ(paths.find("src/main.cxx"), std::optional<path_id>(b));
+	EXPECT_FALSE(paths.find("src/other.cxx").has_value());
+	EXPECT_EQ(paths.get_buffer(),
+			  std::string("include/a.hxx\0src/main.cxx\0\0", 28));
+	EXPECT_STREQ(paths.c_str(b), "src/main.cxx");
+
+	// the index keeps up as it grows past its first size
+	for (int i = 0; i < 1000; ++i)
+		paths.intern("src/" + std::to_string(i) + ".cxx");
+	EXPECT_EQ(paths.size(), 1003);
+	EXPECT_EQ(paths.find("src/999.cxx"), std::optional<path_id>(1002));
+	EXPECT_EQ(paths.intern("include/a.hxx"), a);
+}
+
+TEST(path_table, assign)
+{
+	path_table paths;
+	paths.intern("a");
+	paths.intern("bc");
+
+	path_table copy;
+	ASSERT_TRUE(copy.assign(paths.get_buffer(), paths.get_offsets()));
+	EXPECT_EQ(copy.size(), 2);
+	EXPECT_EQ(copy.find("bc"), std::optional<path_id>(1));
+	EXPECT_EQ(copy.intern("d"), 2);
+
+	EXPECT_FALSE(copy.assign(std::string("abc\0", 4), { 0, 5 }));
+	EXPECT_FALSE(copy.assign(std::string("a\0bc\0", 5), { 0, 2, 1, 5 }));
+	// every path ends in a null character
+	EXPECT_FALSE(copy.assign("abc", { 0, 3 }));
+	EXPECT_EQ(copy.size(), 0);
+}
+
+TEST(path_table, graph)
+{
+	path_graph graph(4, { { 2, 0 }, { 0, 1 }, { 2, 3 }, { 0, 3 } });
+	EXPECT_EQ(graph.num_nodes(), 4);
+	std::span<const path_id> edges = graph.edges(2);
+	EXPECT_EQ(std::vector<path_id>(edges.begin(), edges.end()),
+			  (std::vector<path_id>{ 0, 3 }));
+	edges = graph.edges(0);
+	EXPECT_EQ(std::vector<path_id>(edges.begin(), edges.end()),
+			  (std::vector<path_id>{ 1, 3 }));
+	EXPECT_TRUE(graph.edges(1).empty());
+	EXPECT_TRUE(graph.edges(7).empty());
+	EXPECT_TRUE(path_graph().edges(0).empty());
+}
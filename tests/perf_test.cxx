@@ -0,0 +1,127 @@
+/* perf_test.cxx */
+// Builds a generated project with coup-fake-cxx, whose compiles take a
+// known time, and holds coup's overhead to the budgets in
+// perf_budgets.json
+// Overhead is the wall time of a build less the time its compiles take
+// with every job busy
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "../bench/synthetic_project.hxx"
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_parallel.hxx"
+#include "../include/coup_system.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+class test_perf : public testing::Test
+{
+protected:
+	nlohmann::json budgets;
+	synthetic_project project;
+	fs::path root;
+	fs::path previous_directory;
+	int compile_ms = 0;
+	unsigned int num_jobs = 1;
+
+	void SetUp() override
+	{
+		budgets = nlohmann::json::parse(std::ifstream(PERF_BUDGETS_FILE));
+		project.num_sources = budgets["sources"];
+		project.num_headers = budgets["headers"];
+		project.compiler = FAKE_COMPILER;
+		compile_ms = budgets["compile_ms"];
+		num_jobs = default_job_count();
+
+		root = unique_temp_dir();
+		generate_project(root, project);
+		previous_directory = fs::current_path();
+		fs::current_path(root);
+		setenv("COUP_FAKE_COMPILE_MS", std::to_string(compile_ms).c_str(),
+			   1);
+	}
+
+	void TearDown() override
+	{
+		unsetenv("COUP_FAKE_COMPILE_MS");
+		fs::current_path(previous_directory);
+		fs::remove_all(root);
+	}
+
+	// wall time of `coup build` in milliseconds
+	double build()
+	{
+		auto start = std::chrono::steady_clock::now();
+		int exit_code = spawn_process({ COUP_BINARY, "build" }, "build.log");
+		std::chrono::duration<double, std::milli> wall =
+			std::chrono::steady_clock::now() - start;
+		EXPECT_EQ(exit_code, 0) << file_contents("build.log");
+		return wall.count();
+	}
+
+	// object file of the i-th source in the default profile
+	fs::path object_file(int i) const
+	{
+		return make_output_file(synthetic_source(project, i),
+								"build/debug/obj", "o");
+	}
+
+	// time the compiles of num_sources take with every job busy
+	double compile_time(int num_sources) const
+	{
+		int rounds = (num_sources + static_cast<int>(num_jobs) - 1) /
+					 static_cast<int>(num_jobs);
+		return static_cast<double>(rounds * compile_ms);
+	}
+};
+
+TEST_F(test_perf, clean_build)
+{
+	// the project's sources and main.cxx
+	int num_sources = project.num_sources + 1;
+	double wall = build();
+	// a build that fails early would pass every budget
+	EXPECT_TRUE(fs::exists("build/debug/app"));
+	EXPECT_TRUE(fs::exists(
+		make_output_file("src/main.cxx", "build/debug/obj", "o")));
+	for (int i = 0; i < project.num_sources; ++i)
+	{
+		EXPECT_TRUE(fs::exists(object_file(i))) << object_file(i);
+	}
+	double overhead = wall - compile_time(num_sources);
+	double utilization =
+		static_cast<double>(num_sources * compile_ms) / (wall * num_jobs);
+	EXPECT_LE(overhead, budgets["clean_build"]["max_overhead_ms"]);
+	EXPECT_GE(utilization, budgets["clean_build"]["min_utilization"]);
+	RecordProperty("overhead_ms", std::to_string(overhead));
+	RecordProperty("utilization", std::to_string(utilization));
+}
+
+TEST_F(test_perf, noop_build)
+{
+	build();
+	double wall = build();
+	EXPECT_LE(wall, budgets["noop_build"]["max_ms"]);
+	RecordProperty("wall_ms", std::to_string(wall));
+}
+
+TEST_F(test_perf, touched_build)
+{
+	build();
+	auto touched_mtime = fs::last_write_time(object_file(0));
+	auto other_mtime = fs::last_write_time(object_file(1));
+	std::ofstream(synthetic_source(project, 0), std::ios::app) << "// x\n";
+	double overhead = build() - compile_time(1);
+	// only the touched source was compiled again
+	EXPECT_GT(fs::last_write_time(object_file(0)), touched_mtime);
+	EXPECT_EQ(fs::last_write_time(object_file(1)), other_mtime);
+	EXPECT_LE(overhead, budgets["touched_build"]["max_overhead_ms"]);
+	RecordProperty("overhead_ms", std::to_string(overhead));
+}
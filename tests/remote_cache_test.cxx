@@ -0,0 +1,78 @@
+/* remote_cache_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/coup_net.hxx"
+#include "../include/coup_remote_cache.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+TEST(remote_cache, parse_url)
+{
+	std::optional<http_url> url = parse_http_url("http://cache:9000/coup/");
+	ASSERT_TRUE(url.has_value());
+	EXPECT_EQ(url->host, "cache");
+	EXPECT_EQ(url->port, "9000");
+	EXPECT_EQ(url->path, "/coup");
+
+	url = parse_http_url("http://127.0.0.1");
+	ASSERT_TRUE(url.has_value());
+	EXPECT_EQ(url->port, "80");
+	EXPECT_EQ(url->path, "");
+
+	EXPECT_FALSE(parse_http_url("https://cache").has_value());
+	EXPECT_FALSE(parse_http_url("http://cache:x").has_value());
+	EXPECT_TRUE(is_cache_key("0123abcd"));
+	EXPECT_FALSE(is_cache_key("../etc"));
+}
+
+TEST(remote_cache, round_trip)
+{
+	fs::path directory = unique_temp_dir();
+
+	cache_server server(directory);
+	ASSERT_TRUE(server.listen("127.0.0.1", "0"));
+	std::thread server_thread(&cache_server::serve, &server);
+
+	std::optional<http_url> url = parse_http_url(
+		"http://127.0.0.1:" + std::to_string(server.port()) + "/prefix");
+	ASSERT_TRUE(url.has_value());
+	{
+		remote_cache cache(*url);
+		std::vector<std::string> keys;
+		for (int i = 0; i < 100; ++i)
+		{
+			keys.push_back("a" + std::to_string(i));
+			if (i % 2 == 0)
+				cache.put(keys.back(), std::string(i * 1000, '\0') + "x");
+		}
+		EXPECT_EQ(cache.flush(), 50);
+
+		std::vector<bool> found = cache.contains(keys);
+		std::vector<std::optional<std::string>> entries = cache.get(keys);
+		for (int i = 0; i < 100; ++i)
+		{
+			EXPECT_EQ(found[i], i % 2 == 0);
+			ASSERT_EQ(entries[i].has_value(), i % 2 == 0);
+			if (i % 2 == 0)
+			{
+				EXPECT_EQ(*entries[i], std::string(i * 1000, '\0') + "x");
+			}
+		}
+		EXPECT_TRUE(cache.is_available());
+	}
+
+	server.stop();
+	server_thread.join();
+
+	// a cache that cannot be reached turns itself off instead of failing
+	remote_cache unreachable(*url);
+	EXPECT_EQ(unreachable.contains({ "a0" }), std::vector<bool>{ false });
+	EXPECT_FALSE(unreachable.is_available());
+	fs::remove_all(directory);
+}
@@ -0,0 +1,43 @@
+/* staging_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "../include/coup_filesystem.hxx"
+#include "../include/coup_staging.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+TEST(staging, publish)
+{
+	fs::path dir = unique_temp_dir();
+	fs::path output_directory = dir / "build";
+	fs::create_directories(output_directory / "obj");
+	std::ofstream(output_directory / "obj" / "a.o") << "old";
+
+	fs::path staging_root = dir / "shm";
+	std::vector<fs::path> failed;
+	{
+		output_stager stager(staging_root, output_directory);
+		fs::path staged = stager.staged_file(output_directory / "obj" / "a.o");
+		EXPECT_EQ(staged.parent_path().parent_path(),
+				  staging_directory(staging_root, output_directory));
+		fs::create_directories(staged.parent_path());
+		std::ofstream(staged) << "new";
+
+		stager.publish(staged, output_directory / "obj" / "a.o");
+		EXPECT_EQ(stager.read_path(output_directory / "obj" / "a.o"), staged);
+		EXPECT_EQ(stager.read_path(output_directory / "obj" / "b.o"),
+				  output_directory / "obj" / "b.o");
+		// a directory is missing for this one
+		stager.publish(staged, output_directory / "missing" / "c.o");
+		failed = stager.finish();
+		EXPECT_FALSE(fs::exists(staged));
+	}
+	EXPECT_EQ(file_contents(output_directory / "obj" / "a.o"), "new");
+	EXPECT_EQ(failed,
+			  std::vector<fs::path>{ output_directory / "missing" / "c.o" });
+	fs::remove_all(dir);
+}
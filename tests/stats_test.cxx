@@ -0,0 +1,61 @@
+/* stats_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "../include/coup_stats.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+static build_metrics make_build(double compile_time, double unit_time)
+{
+	build_metrics metrics;
+	metrics.timestamp = 1700000000;
+	metrics.total_time = compile_time + 0.5;
+	metrics.check_time = 0.01;
+	metrics.compile_time = compile_time;
+	metrics.link_time = 0.5;
+	metrics.num_sources = 10;
+	metrics.num_compiled = 2;
+	metrics.num_jobs = 4;
+	metrics.units = { { "src/a.cxx", unit_time },
+					  { "src/dir with space/b.cxx", 0.2 } };
+	return metrics;
+}
+
+TEST(stats, append_and_load)
+{
+	fs::path directory = unique_temp_dir();
+	fs::path stats_file = directory / "stats";
+
+	ASSERT_TRUE(append_build_metrics(stats_file, make_build(1.0, 0.8)));
+	ASSERT_TRUE(append_build_metrics(stats_file, make_build(2.0, 1.8)));
+
+	std::vector<build_metrics> history = load_build_metrics(stats_file);
+	ASSERT_EQ(history.size(), 2);
+	EXPECT_EQ(history[1].compile_time, 2.0);
+	EXPECT_EQ(history[1].num_jobs, 4u);
+	ASSERT_EQ(history[1].units.size(), 2);
+	EXPECT_EQ(history[1].units[1].source, "src/dir with space/b.cxx");
+
+	fs::remove_all(directory);
+}
+
+TEST(stats, regressions_against_median)
+{
+	std::vector<build_metrics> history;
+	for (double compile_time : { 1.0, 1.1, 0.9, 5.0 })
+		history.push_back(make_build(compile_time, 0.8));
+	history.push_back(make_build(1.05, 2.0));
+
+	std::vector<regression> regressions = find_regressions(history, 10, 0.2);
+	ASSERT_EQ(regressions.size(), 1);
+	EXPECT_EQ(regressions[0].name, "src/a.cxx");
+	EXPECT_DOUBLE_EQ(regressions[0].baseline, 0.8);
+
+	// too little history for a baseline
+	history.erase(history.begin(), history.end() - 2);
+	EXPECT_TRUE(find_regressions(history, 10, 0.2).empty());
+}
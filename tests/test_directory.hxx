@@ -0,0 +1,27 @@
+/* test_directory.hxx */
+#pragma once
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+namespace coup
+{
+// Empty directory below the temp directory, named after the running test
+// and this process so that tests running in parallel never share one
+// The test removes it when it is done
+inline fs::path unique_temp_dir()
+{
+	const testing::TestInfo *test =
+		testing::UnitTest::GetInstance()->current_test_info();
+	fs::path directory =
+		fs::temp_directory_path() /
+		("coup_" + std::string(test->test_suite_name()) + "_" + test->name() +
+		 "_" + std::to_string(getpid()));
+	fs::remove_all(directory);
+	fs::create_directories(directory);
+	return directory;
+}
+} // namespace coup
@@ -0,0 +1,69 @@
+/* test_runner_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "../include/coup_test_runner.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+TEST(test_runner, shards_are_balanced)
+{
+	std::vector<std::string> tests = { "a.slow", "a.b", "a.c", "a.d", "a.e" };
+	std::vector<double> durations = { 4.0, 1.0, 1.0, 1.0, 1.0 };
+
+	std::vector<std::vector<std::string>> shards =
+		make_test_shards(tests, durations, 2);
+	ASSERT_EQ(shards.size(), 2);
+	EXPECT_EQ(shards[0], std::vector<std::string>{ "a.slow" });
+	EXPECT_EQ(shards[1].size(), 4);
+}
+
+TEST(test_runner, more_shards_than_tests)
+{
+	std::vector<std::vector<std::string>> shards =
+		make_test_shards({ "a.b", "a.c" }, { 1.0, 1.0 }, 8);
+	EXPECT_EQ(shards.size(), 2);
+	EXPECT_TRUE(make_test_shards({}, {}, 8).empty());
+}
+
+TEST(test_runner, test_filters)
+{
+	EXPECT_EQ(make_test_filters({ "a.b", "a.c", "b.d" }, 1000),
+			  std::vector<std::string>{ "--gtest_filter=a.b:a.c:b.d" });
+	EXPECT_EQ(make_test_filters({ "a.b", "a.c", "b.d" }, 25),
+			  (std::vector<std::string>{ "--gtest_filter=a.b:a.c",
+										 "--gtest_filter=b.d" }));
+	EXPECT_TRUE(make_test_filters({}, 1000).empty());
+
+	std::vector<std::string> tests(100000, "suite.some_test_name");
+	for (const std::string &filter : make_test_filters(tests, 65536))
+		EXPECT_LE(filter.size(), 65536);
+}
+
+TEST(test_runner, cache_round_trip)
+{
+	fs::path directory = unique_temp_dir();
+	fs::path cache_file = directory / "tests";
+
+	test_cache cache;
+	cache.record("unit/a.b", 0xabc, true, 0.5);
+	cache.record("unit/a.c", 0xabc, false, 1.5);
+	cache.set_green_hash("unit", 0x123);
+	ASSERT_TRUE(cache.save(cache_file));
+
+	test_cache loaded;
+	ASSERT_TRUE(loaded.load(cache_file));
+	EXPECT_TRUE(loaded.passed("unit/a.b", 0xabc));
+	EXPECT_FALSE(loaded.passed("unit/a.b", 0xdef));
+	EXPECT_FALSE(loaded.passed("unit/a.c", 0xabc));
+	EXPECT_EQ(loaded.get_duration("unit/a.c"), 1.5);
+	EXPECT_FALSE(loaded.get_duration("unit/a.d").has_value());
+	EXPECT_EQ(loaded.get_green_hash("unit"), 0x123u);
+	EXPECT_FALSE(loaded.get_green_hash("other").has_value());
+
+	fs::remove_all(directory);
+}
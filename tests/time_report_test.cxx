@@ -0,0 +1,97 @@
+/* time_report_test.cxx */
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../include/coup_time_report.hxx"
+#include "test_directory.hxx"
+
+namespace fs = std::filesystem;
+using namespace coup;
+
+class test_time_report : public testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		dir = unique_temp_dir();
+	}
+	void TearDown() override
+	{
+		fs::remove_all(dir);
+	}
+
+	fs::path dir;
+};
+
+TEST_F(test_time_report, report_files)
+{
+	EXPECT_TRUE(is_clang_compiler("/usr/bin/clang++-17"));
+	EXPECT_FALSE(is_clang_compiler("g++"));
+	EXPECT_EQ(time_report_flags("clang++"),
+			  std::vector<std::string>{ "-ftime-trace" });
+	EXPECT_EQ(time_report_file("obj/src/a.cxx.o", "clang++"),
+			  fs::path("obj/src/a.cxx.json"));
+	EXPECT_EQ(time_report_file("obj/src/a.cxx.o", "g++"),
+			  fs::path("obj/src/a.cxx.time"));
+}
+
+TEST_F(test_time_report, clang_traces)
+{
+	for (const char *name : { "a.json", "b.json" })
+	{
+		std::ofstream(dir / name) << R"({"traceEvents": [
+			{"name": "Source", "dur": 300000, "args": {"detail": "vector"}},
+			{"name": "InstantiateClass", "dur": 2000,
+			 "args": {"detail": "std::vector<int>"}},
+			{"name": "OptFunction", "dur": 1000, "args": {"detail": "main"}},
+			{"name": "ExecuteCompiler", "dur": 500000},
+			{"name": "Total Frontend", "dur": 400000}
+		]})";
+	}
+
+	time_report report;
+	EXPECT_TRUE(report.add_clang_trace(dir / "a.json", "src/a.cxx"));
+	EXPECT_TRUE(report.add_clang_trace(dir / "b.json", "src/b.cxx"));
+	EXPECT_FALSE(report.add_clang_trace(dir / "missing.json", "src/c.cxx"));
+
+	std::vector<time_entry> headers = report.top_headers(10);
+	ASSERT_EQ(headers.size(), 1);
+	EXPECT_EQ(headers[0].name, "vector");
+	EXPECT_DOUBLE_EQ(headers[0].seconds, 0.6);
+	EXPECT_EQ(headers[0].count, 2);
+	EXPECT_EQ(report.top_instantiations(10)[0].name, "std::vector<int>");
+	EXPECT_EQ(report.top_codegen(10)[0].name, "main");
+	EXPECT_EQ(report.top_units(1).size(), 1);
+	EXPECT_EQ(report.top_phases(10)[0].name, "Frontend");
+}
+
+TEST_F(test_time_report, gcc_reports)
+{
+	std::ofstream(dir / "a.log")
+		<< "src/a.cxx:1:5: warning: unused variable\n"
+		<< "\nTime variable                                   usr           "
+		   "sys          wall           GGC\n"
+		<< " phase parsing                      :   0.21 ( 60%)   0.15 ( "
+		   "88%)   0.36 ( 68%)    32M ( 69%)\n"
+		<< " |name lookup                       :   0.03 (  9%)   0.03 ( "
+		   "18%)   0.08 ( 15%)  2090k (  4%)\n"
+		<< " TOTAL                              :   0.35          0.17    "
+		   "      0.53            47M\n";
+
+	time_report report;
+	EXPECT_TRUE(report.add_gcc_report(dir / "a.log", "src/a.cxx"));
+	std::vector<time_entry> phases = report.top_phases(10);
+	ASSERT_EQ(phases.size(), 2);
+	EXPECT_EQ(phases[0].name, "phase parsing");
+	EXPECT_DOUBLE_EQ(phases[0].seconds, 0.36);
+	EXPECT_EQ(phases[1].name, "name lookup");
+
+	std::ofstream(dir / "b.log") << "no report\n";
+	EXPECT_FALSE(report.add_gcc_report(dir / "b.log", "src/b.cxx"));
+
+	EXPECT_EQ(strip_time_report("warning\n\nTime variable  usr\n"),
+			  "warning");
+	EXPECT_EQ(strip_time_report("Time variable  usr\n"), "");
+}